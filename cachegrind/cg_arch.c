@@ -134,7 +134,41 @@ Bool VG_(str_clo_cache_opt)(const HChar *arg,
       return False;
 }
 
-static void umsg_cache_img(const HChar* desc, cache_t* c)
+Bool VG_(str_clo_cache_model_opt)(const HChar *arg,
+                                  cache_model_t* clo_model)
+{
+   const HChar* tmp_str;
+
+   if VG_STR_CLO(arg, "--L2-cache", tmp_str) {
+      parse_cache_opt(&clo_model->L2, arg, tmp_str);
+      return True;
+   }
+   else if VG_XACT_CLO(arg, "--replacement=lru",
+                            clo_model->repl, CacheReplLRU) {}
+   else if VG_XACT_CLO(arg, "--replacement=plru",
+                            clo_model->repl, CacheReplPLRU) {}
+   else if VG_XACT_CLO(arg, "--replacement=rrip",
+                            clo_model->repl, CacheReplRRIP) {}
+   else if VG_XACT_CLO(arg, "--prefetch=none",
+                            clo_model->prefetch, CachePrefetchNone) {}
+   else if VG_XACT_CLO(arg, "--prefetch=next-line",
+                            clo_model->prefetch, CachePrefetchNextLine) {}
+   else if VG_XACT_CLO(arg, "--prefetch=stride",
+                            clo_model->prefetch, CachePrefetchStride) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=nine",
+                            clo_model->LL_policy, CacheLLNINE) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=inclusive",
+                            clo_model->LL_policy, CacheLLInclusive) {}
+   else if VG_XACT_CLO(arg, "--LL-policy=exclusive",
+                            clo_model->LL_policy, CacheLLExclusive) {}
+   else if VG_BINT_CLO(arg, "--cores", clo_model->cores, 1, MAX_CORES) {}
+   else
+      return False;
+
+   return True;
+}
+
+static void umsg_cache_img(const HChar* desc, const cache_t* c)
 {
    VG_(umsg)("  %s: %'d B, %d-way, %d B lines\n", desc,
              c->size, c->assoc, c->line_size);
@@ -313,6 +347,47 @@ void VG_(post_clo_init_configure_caches)(cache_t* I1c,
 #undef DEFINED
 }
 
+void VG_(post_clo_init_configure_cache_model)(const cache_t* I1c,
+                                              const cache_t* D1c,
+                                              const cache_t* LLc,
+                                              const cache_model_t* model)
+{
+   Bool have_L2 = model->L2.size != -1;
+
+   // Tree-PLRU keeps one bit per internal node of a binary tree over the
+   // ways of a set, in a single ULong.
+   if (model->repl == CacheReplPLRU) {
+      if (I1c->assoc > 64 || D1c->assoc > 64 || LLc->assoc > 64
+          || (have_L2 && model->L2.assoc > 64))
+         VG_(fmsg_bad_option)("--replacement=plru",
+            "Tree-PLRU supports at most 64 ways per set.\n");
+   }
+
+   // Lines move between the levels as a whole when the LL cache is
+   // inclusive or exclusive, so the line sizes must all be equal.
+   if (model->LL_policy != CacheLLNINE) {
+      if (I1c->line_size != LLc->line_size
+          || D1c->line_size != LLc->line_size
+          || (have_L2 && model->L2.line_size != LLc->line_size))
+         VG_(fmsg_bad_option)(model->LL_policy == CacheLLInclusive
+                              ? "--LL-policy=inclusive"
+                              : "--LL-policy=exclusive",
+            "All caches must have the same line size.\n");
+   }
+   if (model->LL_policy == CacheLLExclusive && !have_L2)
+      VG_(fmsg_bad_option)("--LL-policy=exclusive",
+         "An exclusive LL cache requires an L2 cache (--L2-cache=...).\n");
+
+   // Lines evicted from an inclusive or exclusive LL cache would have to
+   // be tracked in the private caches of every core.
+   if (model->cores > 1 && model->LL_policy != CacheLLNINE)
+      VG_(fmsg_bad_option)("--cores",
+         "Multiple cores require --LL-policy=nine.\n");
+
+   if (VG_(clo_verbosity) >= 2 && have_L2)
+      umsg_cache_img ("L2", &model->L2);
+}
+
 void VG_(print_cache_clo_opts)()
 {
    VG_(printf)(
@@ -322,6 +397,21 @@ void VG_(print_cache_clo_opts)()
                );
 }
 
+void VG_(print_cache_model_clo_opts)()
+{
+   VG_(printf)(
+"    --L2-cache=<size>,<assoc>,<line_size>\n"
+"                                     simulate an L2 cache between the L1\n"
+"                                     caches and the LL cache [none]\n"
+"    --replacement=lru|plru|rrip      cache replacement policy [lru]\n"
+"    --prefetch=none|next-line|stride hardware prefetcher model [none]\n"
+"    --LL-policy=nine|inclusive|exclusive\n"
+"                                     LL cache inclusion policy [nine]\n"
+"    --cores=<n>                      simulate n cores with private I1, D1\n"
+"                                     and L2 caches, kept coherent [1]\n"
+               );
+}
+
 
 // Traverse the cache info and return a cache of the given kind and level.
 // Return NULL if no such cache exists.
@@ -67,6 +67,60 @@ void VG_(post_clo_init_configure_caches)(cache_t* I1c,
 
 void VG_(print_cache_clo_opts)(void);
 
+// Replacement policy used within a cache set.
+typedef enum {
+   CacheReplLRU,     // true LRU
+   CacheReplPLRU,    // tree pseudo-LRU
+   CacheReplRRIP     // static re-reference interval prediction (2-bit)
+} cache_repl_t;
+
+// Hardware prefetcher, trained on first level cache misses.
+typedef enum {
+   CachePrefetchNone,
+   CachePrefetchNextLine,  // fetch the line following each miss
+   CachePrefetchStride     // per-page stride detection
+} cache_prefetch_t;
+
+// How the LL cache relates to the levels above it.
+typedef enum {
+   CacheLLNINE,       // neither inclusive nor exclusive
+   CacheLLInclusive,  // LL evictions invalidate the upper levels
+   CacheLLExclusive   // LL only holds lines evicted from L2
+} cache_LL_policy_t;
+
+// Most cores that can be simulated; see cache_model_t.cores.
+#define MAX_CORES 64
+
+// Optional parts of the cache model, beyond I1/D1/LL.
+typedef struct {
+   cache_t           L2;         // UNDEFINED_CACHE if there is no L2
+   cache_repl_t      repl;
+   cache_prefetch_t  prefetch;
+   cache_LL_policy_t LL_policy;
+   Int               cores;      // cores with private I1/D1/L2 caches
+} cache_model_t;
+
+#define DEFAULT_CACHE_MODEL \
+   { UNDEFINED_CACHE, CacheReplLRU, CachePrefetchNone, CacheLLNINE, 1 }
+
+// If arg is a command line option configuring the L2 cache, the
+// replacement policy, the prefetcher, the LL policy or the number of
+// cores, then parses arg and sets the relevant fields of clo_model.
+// (The L2 cache is configured with --L2-cache, as --L2 remains an alias
+// for --LL.)
+// Returns True if arg is such an option, False otherwise.
+Bool VG_(str_clo_cache_model_opt)(const HChar *arg,
+                                  cache_model_t* clo_model);
+
+// Checks that the cache model is consistent with the configured caches.
+// Exits with a fatal error otherwise.
+void VG_(post_clo_init_configure_cache_model)(const cache_t* I1c,
+                                              const cache_t* D1c,
+                                              const cache_t* LLc,
+                                              const cache_model_t* model);
+
+void VG_(print_cache_model_clo_opts)(void);
+
 #endif   // __CG_ARCH_H
 
 /*--------------------------------------------------------------------*/
@@ -0,0 +1,50 @@
+/*--------------------------------------------------------------------*/
+/*--- Client requests between the intercepts and the tool.         ---*/
+/*---                                                cg_clientreq.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a Valgrind tool for cache
+   profiling programs.
+
+   Copyright (C) 2002-2015 Nicholas Nethercote
+      njn@valgrind.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __CG_CLIENTREQ_H
+#define __CG_CLIENTREQ_H
+
+// These requests are a tool-internal interface, used only by the malloc
+// wrappers in cg_intercepts.c to tell the tool about heap blocks when
+// --cache-objects=yes.  There is no public cachegrind.h.
+enum {
+   // Is --cache-objects=yes?  No args; returns 1 or 0.
+   _VG_USERREQ__CG_OBJECTS_ENABLED = VG_USERREQ_TOOL_BASE('C','G'),
+   // A heap block was allocated.  args: address, size.
+   _VG_USERREQ__CG_MALLOC,
+   // A heap block was freed.  args: address.
+   _VG_USERREQ__CG_FREE
+};
+
+#endif   // __CG_CLIENTREQ_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,193 @@
+
+/*--------------------------------------------------------------------*/
+/*--- malloc wrappers for data object attribution.                 ---*/
+/*---                                              cg_intercepts.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a Valgrind tool for cache
+   profiling programs.
+
+   Copyright (C) 2002-2015 Nicholas Nethercote
+      njn@valgrind.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Cachegrind must not change the addresses the client's heap blocks get,
+   as they determine which cache sets are used.  So unlike the tools that
+   need to know about heap blocks, it does not replace malloc and
+   friends: it wraps the client's own ones, and after each call tells the
+   tool about the block.  This file is only preloaded with
+   --cache-objects=yes;  otherwise the tool removes it from LD_PRELOAD. */
+
+#include "pub_tool_basics.h"
+#include "pub_tool_redir.h"
+#include "pub_tool_clreq.h"
+#include "cg_clientreq.h"
+
+// Whether the tool wants to hear about heap blocks: -1 until asked.
+// Threads racing to set it all store the same value.
+static int cg_objects = -1;
+
+static __inline__ int objects_enabled(void)
+{
+   if (cg_objects < 0)
+      cg_objects = VALGRIND_DO_CLIENT_REQUEST_EXPR(
+                      0, _VG_USERREQ__CG_OBJECTS_ENABLED, 0, 0, 0, 0, 0);
+   return cg_objects;
+}
+
+#define MALLOC_NEW(p, n) \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__CG_MALLOC, p, n, 0, 0, 0)
+#define FREE_OLD(p) \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__CG_FREE, p, 0, 0, 0, 0)
+
+/*---------------------- malloc ----------------------*/
+
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, malloc) ( SizeT n );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, malloc) ( SizeT n )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_W(p, fn, n);
+   if (p && objects_enabled())
+      MALLOC_NEW(p, n);
+   return p;
+}
+
+/*---------------------- calloc ----------------------*/
+
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, calloc) ( SizeT nmemb,
+                                                          SizeT size );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, calloc) ( SizeT nmemb,
+                                                          SizeT size )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WW(p, fn, nmemb, size);
+   if (p && objects_enabled())
+      MALLOC_NEW(p, nmemb * size);
+   return p;
+}
+
+/*---------------------- realloc ----------------------*/
+
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, realloc) ( void* old,
+                                                           SizeT n );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, realloc) ( void* old,
+                                                           SizeT n )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WW(p, fn, old, n);
+   // A failed realloc leaves the old block alone; realloc(p, 0) may free
+   // it and return NULL.
+   if (objects_enabled() && (p || n == 0)) {
+      if (old)
+         FREE_OLD(old);
+      if (p)
+         MALLOC_NEW(p, n);
+   }
+   return p;
+}
+
+/*---------------------- memalign ----------------------*/
+
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, memalign) ( SizeT alignment,
+                                                            SizeT n );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, memalign) ( SizeT alignment,
+                                                            SizeT n )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WW(p, fn, alignment, n);
+   if (p && objects_enabled())
+      MALLOC_NEW(p, n);
+   return p;
+}
+
+/*---------------------- posix_memalign ----------------------*/
+
+int I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, posix_memalign)
+       ( void** memptr, SizeT alignment, SizeT n );
+int I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, posix_memalign)
+       ( void** memptr, SizeT alignment, SizeT n )
+{
+   OrigFn fn;
+   Word   res;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WWW(res, fn, memptr, alignment, n);
+   // *memptr is only set on success, and may be NULL if n is 0.
+   if ((int)res == 0 && *memptr && objects_enabled())
+      MALLOC_NEW(*memptr, n);
+   return (int)res;
+}
+
+/*---------------------- aligned_alloc ----------------------*/
+
+// In older glibcs this is an alias of memalign, in which case the
+// redirection is the same as the one above, and one of them is ignored.
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, aligned_alloc)
+         ( SizeT alignment, SizeT n );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, aligned_alloc)
+         ( SizeT alignment, SizeT n )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WW(p, fn, alignment, n);
+   if (p && objects_enabled())
+      MALLOC_NEW(p, n);
+   return p;
+}
+
+/*---------------------- valloc ----------------------*/
+
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, valloc) ( SizeT n );
+void* I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, valloc) ( SizeT n )
+{
+   OrigFn fn;
+   void*  p;
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_W(p, fn, n);
+   if (p && objects_enabled())
+      MALLOC_NEW(p, n);
+   return p;
+}
+
+/*---------------------- free ----------------------*/
+
+void I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, free) ( void* p );
+void I_WRAP_SONAME_FNNAME_ZU(VG_Z_LIBC_SONAME, free) ( void* p )
+{
+   OrigFn fn;
+   VALGRIND_GET_ORIG_FN(fn);
+   // Forget the block first, as it may be reused as soon as it is freed.
+   if (p && objects_enabled())
+      FREE_OLD(p);
+   CALL_FN_v_W(fn, p);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -43,8 +43,12 @@
 #include "pub_tool_xarray.h"
 #include "pub_tool_clientstate.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
+#include "pub_tool_threadstate.h"  // VG_INVALID_THREADID
+#include "pub_tool_execontext.h"
+#include "pub_tool_clreq.h"        // VG_USERREQ_TOOL_BASE
 
 #include "cg_arch.h"
+#include "cg_clientreq.h"
 #include "cg_sim.c"
 #include "cg_branchpred.c"
 
@@ -61,6 +65,7 @@
 
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
+static Bool  clo_cache_objects = False; /* charge misses to data objects? */
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 
 /*------------------------------------------------------------*/
@@ -77,7 +82,8 @@ typedef
    struct {
       ULong a;  /* total # memory accesses of this kind */
       ULong m1; /* misses in the first level cache */
-      ULong mL; /* misses in the second level cache */
+      ULong m2; /* misses in the L2 cache, if simulated */
+      ULong mL; /* misses in the last level cache */
    }
    CacheCC;
 
@@ -88,6 +94,13 @@ typedef
    }
    BranchCC;
 
+typedef
+   struct {
+      ULong inv; /* # lines invalidated in other cores by writes (--cores) */
+      ULong cm;  /* # coherence misses (--cores) */
+   }
+   CoherenceCC;
+
 //------------------------------------------------------------
 // Primary data structure #1: CC table
 // - Holds the per-source-line hit/miss stats, grouped by file/function/line.
@@ -109,6 +122,7 @@ typedef struct {
    CacheCC  Dw;  /* Data write/modify counts */
    BranchCC Bc;  /* Conditional branch counts */
    BranchCC Bi;  /* Indirect branch counts */
+   CoherenceCC Co; /* Coherence counts, if --cores > 1 */
 } LineCC;
 
 // First compare file, then fn, then line.
@@ -267,23 +281,188 @@ static LineCC* get_lineCC(Addr origAddr)
       lineCC->loc.line = loc.line;
       lineCC->Ir.a     = 0;
       lineCC->Ir.m1    = 0;
+      lineCC->Ir.m2    = 0;
       lineCC->Ir.mL    = 0;
       lineCC->Dr.a     = 0;
       lineCC->Dr.m1    = 0;
+      lineCC->Dr.m2    = 0;
       lineCC->Dr.mL    = 0;
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
+      lineCC->Dw.m2    = 0;
       lineCC->Dw.mL    = 0;
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
       lineCC->Bi.mp    = 0;
+      lineCC->Co.inv   = 0;
+      lineCC->Co.cm    = 0;
       VG_(OSetGen_Insert)(CC_table, lineCC);
    }
 
    return lineCC;
 }
 
+/*------------------------------------------------------------*/
+/*--- Data objects                                         ---*/
+/*------------------------------------------------------------*/
+
+// With --cache-objects=yes, D1 and LL data misses are also charged to the
+// data object containing the missing address: a heap block, with all the
+// blocks allocated at one place forming one object, or a global variable.
+// Misses are also counted by offset within the object, which shows the
+// fields that should share a cache line.  Heap blocks are reported by the
+// malloc wrappers in cg_intercepts.c.
+
+#define OBJ_SLOT_SZB    8    // granularity of the offset histogram
+#define OBJ_HIST_SLOTS  512  // number of slots in the histogram
+
+typedef struct {
+   UWord        key;      // ec or name, whichever is non-NULL
+   ExeContext*  ec;       // allocation point of a heap object
+   const HChar* name;     // name of a global object
+   SizeT        max_szB;  // largest heap block allocated at ec
+   ULong        blocks;   // # heap blocks allocated at ec
+   ULong        D1mr, D1mw, DLmr, DLmw;
+   ULong*       hist;     // D1 misses per slot; NULL until the first miss
+   ULong        hist_beyond; // D1 misses at offsets past the histogram
+} DataObj;
+
+typedef struct {
+   Addr     start;
+   SizeT    szB;
+   DataObj* obj;
+} HeapBlock;
+
+static OSet* objTable;    // DataObj, keyed by key
+static OSet* blockTable;  // HeapBlock, found by any address it contains
+
+static HeapBlock* last_block = NULL;  // where the last heap miss was
+
+// Misses outside any known object, eg. on the stack.
+static ULong obj_unknown_D1m = 0;
+static ULong obj_unknown_DLm = 0;
+
+static Word cmp_Addr_HeapBlock(const void* key, const void* elem)
+{
+   Addr a = *(const Addr*)key;
+   const HeapBlock* hb = (const HeapBlock*)elem;
+   SizeT szB = hb->szB > 0 ? hb->szB : 1;
+
+   if (a < hb->start)        return -1;
+   if (a >= hb->start + szB) return  1;
+   return 0;
+}
+
+static DataObj* get_DataObj(ExeContext* ec, const HChar* name)
+{
+   UWord    key = ec ? (UWord)ec : (UWord)name;
+   DataObj* obj = VG_(OSetGen_Lookup)(objTable, &key);
+
+   if (!obj) {
+      obj = VG_(OSetGen_AllocNode)(objTable, sizeof(DataObj));
+      VG_(memset)(obj, 0, sizeof(DataObj));
+      obj->key  = key;
+      obj->ec   = ec;
+      obj->name = name;
+      VG_(OSetGen_Insert)(objTable, obj);
+   }
+   return obj;
+}
+
+static void obj_remove(HeapBlock* hb)
+{
+   hb = VG_(OSetGen_Remove)(blockTable, &hb->start);
+   if (hb == last_block)
+      last_block = NULL;
+   VG_(OSetGen_FreeNode)(blockTable, hb);
+}
+
+// Blocks allocated by libc internally are never recorded, but may still be
+// freed through free(), so a free of an unknown block is ignored.  It must
+// not remove a recorded block that merely contains the address.
+static void obj_free(Addr a)
+{
+   HeapBlock* hb = VG_(OSetGen_Lookup)(blockTable, &a);
+
+   if (hb && hb->start == a)
+      obj_remove(hb);
+}
+
+static void obj_malloc(ThreadId tid, Addr a, SizeT szB)
+{
+   HeapBlock* hb;
+   DataObj*   obj;
+   Addr       end = a + (szB > 0 ? szB : 1);
+
+   // Conversely, recorded blocks may be freed inside libc without going
+   // through free().  Drop any such block that overlaps the new one, as
+   // the blocks in the table must not overlap.
+   while ((hb = VG_(OSetGen_Lookup)(blockTable, &a)) != NULL)
+      obj_remove(hb);
+   VG_(OSetGen_ResetIterAt)(blockTable, &a);
+   while ((hb = VG_(OSetGen_Next)(blockTable)) != NULL && hb->start < end) {
+      obj_remove(hb);
+      VG_(OSetGen_ResetIterAt)(blockTable, &a);
+   }
+
+   obj = get_DataObj(VG_(record_ExeContext)(tid, 0), NULL);
+   obj->blocks++;
+   if (szB > obj->max_szB)
+      obj->max_szB = szB;
+
+   hb = VG_(OSetGen_AllocNode)(blockTable, sizeof(HeapBlock));
+   hb->start = a;
+   hb->szB   = szB;
+   hb->obj   = obj;
+   VG_(OSetGen_Insert)(blockTable, hb);
+}
+
+// A data reference to a missed in D1, and in LL if LL_miss.
+static void obj_miss(Addr a, Bool is_write, Bool LL_miss)
+{
+   HeapBlock*   hb = last_block;
+   DataObj*     obj;
+   PtrdiffT     off;
+   const HChar* name;
+   UWord        slot;
+
+   if (!hb || a < hb->start || a >= hb->start + hb->szB)
+      hb = VG_(OSetGen_Lookup)(blockTable, &a);
+   if (hb) {
+      last_block = hb;
+      obj = hb->obj;
+      off = a - hb->start;
+   } else if (VG_(get_datasym_and_offset)(a, &name, &off)) {
+      obj = get_DataObj(NULL, get_perm_string(name));
+   } else {
+      obj_unknown_D1m++;
+      if (LL_miss)
+         obj_unknown_DLm++;
+      return;
+   }
+
+   if (is_write) {
+      obj->D1mw++;
+      if (LL_miss) obj->DLmw++;
+   } else {
+      obj->D1mr++;
+      if (LL_miss) obj->DLmr++;
+   }
+
+   slot = off / OBJ_SLOT_SZB;
+   if (slot >= OBJ_HIST_SLOTS) {
+      obj->hist_beyond++;
+      return;
+   }
+   if (!obj->hist) {
+      obj->hist = VG_(malloc)("cg.main.om.1",
+                              OBJ_HIST_SLOTS * sizeof(ULong));
+      VG_(memset)(obj->hist, 0, OBJ_HIST_SLOTS * sizeof(ULong));
+   }
+   obj->hist[slot]++;
+}
+
 /*------------------------------------------------------------*/
 /*--- Cache simulation functions                           ---*/
 /*------------------------------------------------------------*/
@@ -324,115 +503,107 @@ void log_3Ir(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
    n3->parent->Ir.a++;
 }
 
-// Generic case for instruction reads: may cross cache lines.
-// All other Ir handlers expect IrNoX instruction reads.
-static VG_REGPARM(1)
-void log_1IrGen_0D_cache_access(InstrInfo* n)
-{
-   //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
-   //             n, n->instr_addr, n->instr_len);
-   cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-}
-
-static VG_REGPARM(1)
-void log_1IrNoX_0D_cache_access(InstrInfo* n)
-{
-   //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
-   //             n, n->instr_addr, n->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-}
-
-static VG_REGPARM(2)
-void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
-{
-   //VG_(printf)("2IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
-   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n",
-   //            n,  n->instr_addr,  n->instr_len,
-   //            n2, n2->instr_addr, n2->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
-   n2->parent->Ir.a++;
-}
+/* With --cache-sim=yes, instrumented code does not call the simulator
+ * for each event.  Instead, it appends a record for each instruction and
+ * data reference to the trace buffer, and the simulator consumes the
+ * records in bulk when the buffer is drained.  Each superblock reserves
+ * room for all the records it may append on entry, draining the buffer
+ * if needed.  The buffer is also drained before InstrInfos are freed and
+ * at exit, so the records never outlive their InstrInfo.
+ *
+ * There is a single buffer rather than one per thread: threads run one
+ * at a time, so it holds the references of all threads in the order in
+ * which they were made, which is also the order in which they were
+ * simulated when each event was a helper call.
+ */
 
-static VG_REGPARM(3)
-void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
-{
-   //VG_(printf)("3IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
-   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n"
-   //            "            CC3addr=0x%010lx, i3addr=0x%010lx, i3size=%lu\n",
-   //            n,  n->instr_addr,  n->instr_len,
-   //            n2, n2->instr_addr, n2->instr_len,
-   //            n3, n3->instr_addr, n3->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
-   n2->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
-			 &n3->parent->Ir.m1, &n3->parent->Ir.mL);
-   n3->parent->Ir.a++;
-}
+/* Kinds of trace records.  Data modifies are simulated as reads, but
+   with --cores they invalidate other cores' copies like writes do. */
+#define TR_IrNoX  0
+#define TR_IrGen  1
+#define TR_Dr     2
+#define TR_Dw     3
+#define TR_Dm     4
+#define TR_KIND_MASK 7
+#define TR_SZB_SHIFT 3   /* data size is kept above the kind */
 
-static VG_REGPARM(3)
-void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
-{
-   //VG_(printf)("1IrNoX_1Dr:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
-   //            "                               daddr=0x%010lx,  dsize=%lu\n",
-   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
+typedef struct {
+   InstrInfo* inode;
+   Addr       data_addr;   /* TR_Dr, TR_Dw and TR_Dm only */
+   UWord      kind;        /* TR_* | data size << TR_SZB_SHIFT */
+} TraceRec;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
-   n->parent->Dr.a++;
-}
+/* Number of records in the buffer.  Must be enough for any superblock. */
+#define TRACE_RECS 4096
 
-static VG_REGPARM(3)
-void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
-{
-   //VG_(printf)("1IrNoX_1Dw:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
-   //            "                               daddr=0x%010lx,  dsize=%lu\n",
-   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
+static TraceRec  trace_buf[TRACE_RECS];
+static TraceRec* trace_next = trace_buf;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
-   n->parent->Dw.a++;
-}
+static ULong trace_recs_total   = 0;
+static ULong trace_drains_total = 0;
 
-/* Note that addEvent_D_guarded assumes that log_0Ir_1Dr_cache_access
-   and log_0Ir_1Dw_cache_access have exactly the same prototype.  If
-   you change them, you must change addEvent_D_guarded too. */
-static VG_REGPARM(3)
-void log_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+static void trace_drain(void)
 {
-   //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
-   //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
-   n->parent->Dr.a++;
-}
+   TraceRec* r;
+   InstrInfo* n;
+   ULong m1, mL;
 
-/* See comment on log_0Ir_1Dr_cache_access. */
-static VG_REGPARM(3)
-void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
-{
-   //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
-   //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
-   n->parent->Dw.a++;
+   if (trace_next == trace_buf)
+      return;
+   for (r = trace_buf; r < trace_next; r++) {
+      n = r->inode;
+      switch (r->kind & TR_KIND_MASK) {
+         case TR_IrNoX:
+            cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir.m1, &n->parent->Ir.m2,
+                                  &n->parent->Ir.mL);
+            n->parent->Ir.a++;
+            break;
+         case TR_IrGen:
+            cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir.m1, &n->parent->Ir.m2,
+                                  &n->parent->Ir.mL);
+            n->parent->Ir.a++;
+            break;
+         case TR_Dm:
+            if (n_cores > 1)
+               n->parent->Co.inv +=
+                  cachesim_D1_write_invalidate(r->data_addr,
+                                               r->kind >> TR_SZB_SHIFT);
+            /* fall through */
+         case TR_Dr:
+            m1 = n->parent->Dr.m1;
+            mL = n->parent->Dr.mL;
+            cachesim_D1_doref(r->data_addr, r->kind >> TR_SZB_SHIFT,
+                              &n->parent->Dr.m1, &n->parent->Dr.m2,
+                              &n->parent->Dr.mL);
+            n->parent->Dr.a++;
+            if (clo_cache_objects && n->parent->Dr.m1 != m1)
+               obj_miss(r->data_addr, False, n->parent->Dr.mL != mL);
+            break;
+         case TR_Dw:
+            if (n_cores > 1)
+               n->parent->Co.inv +=
+                  cachesim_D1_write_invalidate(r->data_addr,
+                                               r->kind >> TR_SZB_SHIFT);
+            m1 = n->parent->Dw.m1;
+            mL = n->parent->Dw.mL;
+            cachesim_D1_doref(r->data_addr, r->kind >> TR_SZB_SHIFT,
+                              &n->parent->Dw.m1, &n->parent->Dw.m2,
+                              &n->parent->Dw.mL);
+            n->parent->Dw.a++;
+            if (clo_cache_objects && n->parent->Dw.m1 != m1)
+               obj_miss(r->data_addr, True, n->parent->Dw.mL != mL);
+            break;
+      }
+      if (coherence_misses > 0) {
+         n->parent->Co.cm += coherence_misses;
+         coherence_misses = 0;
+      }
+   }
+   trace_recs_total += trace_next - trace_buf;
+   trace_drains_total++;
+   trace_next = trace_buf;
 }
 
 /* For branches, we consult two different predictors, one which
@@ -585,6 +756,10 @@ typedef
       /* Number InstrInfo bins 'used' so far. */
       Int sbInfo_i;
 
+      /* Trace records reserved on entry, and appended so far. */
+      Int trace_reserved;
+      Int trace_used;
+
       /* The output SB being constructed. */
       IRSB* sbOut;
    }
@@ -686,9 +861,206 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
 }
 
 
+#if defined(VG_BIGENDIAN)
+# define CGEndness Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define CGEndness Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
+#define hWordTy_of_host (sizeof(HWord) == 4 ? Ity_I32 : Ity_I64)
+
+/* Generate IR to store data at offset bytes from the address in tmp. */
+static void addStoreAt ( CgState* cgs, IRTemp tmp, HWord offset,
+                         IRAtom* data )
+{
+   IRType tyW  = hWordTy_of_host;
+   IRTemp addr = newIRTemp(cgs->sbOut->tyenv, tyW);
+
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( addr,
+                                IRExpr_Binop( tyW == Ity_I32 ? Iop_Add32
+                                                             : Iop_Add64,
+                                              IRExpr_RdTmp(tmp),
+                                              mkIRExpr_HWord(offset) )));
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store( CGEndness, IRExpr_RdTmp(addr), data ));
+}
+
+/* Generate IR to load trace_next into a new temp. */
+static IRTemp loadTraceNext ( CgState* cgs )
+{
+   IRType tyW  = hWordTy_of_host;
+   IRTemp next = newIRTemp(cgs->sbOut->tyenv, tyW);
+
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( next,
+                                IRExpr_Load( CGEndness, tyW,
+                                             mkIRExpr_HWord(
+                                                (HWord)&trace_next ))));
+   return next;
+}
+
+/* Generate IR to fill in trace record number k, counting from the one
+   next points to.  ea is NULL for instruction reads. */
+static void addTraceRec ( CgState* cgs, IRTemp next, Int k,
+                          InstrInfo* inode, UWord kind, IRAtom* ea )
+{
+   HWord base = k * sizeof(TraceRec);
+
+   tl_assert(cgs->trace_used < cgs->trace_reserved);
+   cgs->trace_used++;
+   addStoreAt( cgs, next, base + offsetof(TraceRec, inode),
+               mkIRExpr_HWord( (HWord)inode ));
+   if (ea)
+      addStoreAt( cgs, next, base + offsetof(TraceRec, data_addr), ea );
+   addStoreAt( cgs, next, base + offsetof(TraceRec, kind),
+               mkIRExpr_HWord( kind ));
+}
+
+/* An upper bound on the number of trace records appended by the code
+   for sbIn;  see the event handling in cg_instrument. */
+static Int count_trace_recs ( IRSB* sbIn )
+{
+   Int      i, n = 0;
+   IRStmt*  st;
+   IRDirty* d;
+
+   for (i = 0; i < sbIn->stmts_used; i++) {
+      st = sbIn->stmts[i];
+      switch (st->tag) {
+         case Ist_IMark:
+         case Ist_Store:
+         case Ist_StoreG:
+         case Ist_LoadG:
+         case Ist_LLSC:
+            n++;
+            break;
+         case Ist_WrTmp:
+            if (st->Ist.WrTmp.data->tag == Iex_Load)
+               n++;
+            break;
+         case Ist_Dirty:
+            d = st->Ist.Dirty.details;
+            if (d->mFx == Ifx_Modify)
+               n += 2;
+            else if (d->mFx != Ifx_None)
+               n++;
+            break;
+         case Ist_CAS:
+            n += 2;
+            break;
+         default:
+            break;
+      }
+   }
+   return n;
+}
+
+/* Generate IR at the start of a superblock to make room for all the
+   trace records it may append, by draining the buffer if needed. */
+static void reserveTraceRecs ( CgState* cgs, Int n )
+{
+   IRType   tyW  = hWordTy_of_host;
+   IRTemp   next, full;
+   IRDirty* di;
+
+   tl_assert(n <= TRACE_RECS);
+   cgs->trace_reserved = n;
+   cgs->trace_used     = 0;
+   if (n == 0)
+      return;
+
+   next = loadTraceNext(cgs);
+   full = newIRTemp(cgs->sbOut->tyenv, Ity_I1);
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( full,
+                                IRExpr_Binop( tyW == Ity_I32 ? Iop_CmpLT32U
+                                                             : Iop_CmpLT64U,
+                                              mkIRExpr_HWord(
+                                                 (HWord)&trace_buf[TRACE_RECS - n] ),
+                                              IRExpr_RdTmp(next) )));
+   di = unsafeIRDirty_0_N( 0, "trace_drain",
+                           VG_(fnptr_to_fnentry)( &trace_drain ),
+                           mkIRExprVec_0() );
+   di->guard  = IRExpr_RdTmp(full);
+   /* It resets trace_next, which later IR loads. */
+   di->mFx    = Ifx_Modify;
+   di->mAddr  = mkIRExpr_HWord( (HWord)&trace_next );
+   di->mSize  = sizeof(trace_next);
+   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+}
+
+/* Generate IR to append a trace record for each instruction and data
+   reference event in the queue, in order. */
+static void traceEvents ( CgState* cgs )
+{
+   IRType  tyW = hWordTy_of_host;
+   IRTemp  next, newNext;
+   Int     i, k;
+   Event*  ev;
+   UWord   kind;
+   IRAtom* ea;
+
+   next = IRTemp_INVALID;
+   k    = 0;
+   for (i = 0; i < cgs->events_used; i++) {
+      ev = &cgs->events[i];
+      ea = NULL;
+      switch (ev->tag) {
+         case Ev_IrNoX:
+            kind = TR_IrNoX;
+            break;
+         case Ev_IrGen:
+            kind = TR_IrGen;
+            break;
+         case Ev_Dr:
+            kind = TR_Dr | (get_Event_dszB(ev) << TR_SZB_SHIFT);
+            ea   = get_Event_dea(ev);
+            break;
+         case Ev_Dm:
+            kind = TR_Dm | (get_Event_dszB(ev) << TR_SZB_SHIFT);
+            ea   = get_Event_dea(ev);
+            break;
+         case Ev_Dw:
+            kind = TR_Dw | (get_Event_dszB(ev) << TR_SZB_SHIFT);
+            ea   = get_Event_dea(ev);
+            break;
+         default:
+            continue;  /* branch events are not traced */
+      }
+      if (DEBUG_CG) {
+         VG_(printf)("   trace ");
+         showEvent( ev );
+      }
+      if (next == IRTemp_INVALID)
+         next = loadTraceNext(cgs);
+      addTraceRec( cgs, next, k, ev->inode, kind, ea );
+      k++;
+   }
+
+   if (k == 0)
+      return;
+   newNext = newIRTemp(cgs->sbOut->tyenv, tyW);
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( newNext,
+                                IRExpr_Binop( tyW == Ity_I32 ? Iop_Add32
+                                                             : Iop_Add64,
+                                              IRExpr_RdTmp(next),
+                                              mkIRExpr_HWord(
+                                                 k * sizeof(TraceRec) ))));
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store( CGEndness,
+                                mkIRExpr_HWord( (HWord)&trace_next ),
+                                IRExpr_RdTmp(newNext) ));
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
-   'consumes' slots in cgs->sbInfo. */
+   'consumes' slots in cgs->sbInfo.  With --cache-sim=yes, instruction
+   and data reference events are appended to the trace buffer, and only
+   branch events become helper calls. */
 
 static void flushEvents ( CgState* cgs )
 {
@@ -702,6 +1074,9 @@ static void flushEvents ( CgState* cgs )
    Event*     ev2;
    Event*     ev3;
 
+   if (clo_cache_sim)
+      traceEvents(cgs);
+
    i = 0;
    while (i < cgs->events_used) {
 
@@ -725,68 +1100,35 @@ static void flushEvents ( CgState* cgs )
 
       i_node_expr = mkIRExpr_HWord( (HWord)ev->inode );
 
+      /* Skip the traced events. */
+      if (clo_cache_sim && ev->tag != Ev_Bc && ev->tag != Ev_Bi) {
+         i++;
+         continue;
+      }
+
       /* Decide on helper fn to call and args to pass it, and advance
-         i appropriately. */
+         i appropriately.  Without cache simulation, there are no data
+         reference events, and all Ir events are counted alike. */
       switch (ev->tag) {
          case Ev_IrNoX:
-            /* Merge an IrNoX with a following Dr/Dm. */
-            if (ev2 && (ev2->tag == Ev_Dr || ev2->tag == Ev_Dm)) {
-               /* Why is this true?  It's because we're merging an Ir
-                  with a following Dr or Dm.  The Ir derives from the
-                  instruction's IMark and the Dr/Dm from data
-                  references which follow it.  In short it holds
-                  because each insn starts with an IMark, hence an
-                  Ev_Ir, and so these Dr/Dm must pertain to the
-                  immediately preceding Ir.  Same applies to analogous
-                  assertions in the subsequent cases. */
-               tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dr_cache_access";
-               helperAddr = &log_1IrNoX_1Dr_cache_access;
-               argv = mkIRExprVec_3( i_node_expr,
-                                     get_Event_dea(ev2),
-                                     mkIRExpr_HWord( get_Event_dszB(ev2) ) );
-               regparms = 3;
-               i += 2;
-            }
-            /* Merge an IrNoX with a following Dw. */
-            else
-            if (ev2 && ev2->tag == Ev_Dw) {
-               tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dw_cache_access";
-               helperAddr = &log_1IrNoX_1Dw_cache_access;
-               argv = mkIRExprVec_3( i_node_expr,
-                                     get_Event_dea(ev2),
-                                     mkIRExpr_HWord( get_Event_dszB(ev2) ) );
-               regparms = 3;
-               i += 2;
-            }
-            /* Merge an IrNoX with two following IrNoX's. */
-            else
-            if (ev2 && ev3 && ev2->tag == Ev_IrNoX && ev3->tag == Ev_IrNoX)
+         case Ev_IrGen:
+            /* Merge an Ir with two following Ir's. */
+            if (ev2 && ev3 && (ev2->tag == Ev_IrNoX || ev2->tag == Ev_IrGen)
+                && (ev3->tag == Ev_IrNoX || ev3->tag == Ev_IrGen))
             {
-               if (clo_cache_sim) {
-                  helperName = "log_3IrNoX_0D_cache_access";
-                  helperAddr = &log_3IrNoX_0D_cache_access;
-               } else {
-                  helperName = "log_3Ir";
-                  helperAddr = &log_3Ir;
-               }
+               helperName = "log_3Ir";
+               helperAddr = &log_3Ir;
                argv = mkIRExprVec_3( i_node_expr, 
                                      mkIRExpr_HWord( (HWord)ev2->inode ), 
                                      mkIRExpr_HWord( (HWord)ev3->inode ) );
                regparms = 3;
                i += 3;
             }
-            /* Merge an IrNoX with one following IrNoX. */
+            /* Merge an Ir with one following Ir. */
             else
-            if (ev2 && ev2->tag == Ev_IrNoX) {
-               if (clo_cache_sim) {
-                  helperName = "log_2IrNoX_0D_cache_access";
-                  helperAddr = &log_2IrNoX_0D_cache_access;
-               } else {
-                  helperName = "log_2Ir";
-                  helperAddr = &log_2Ir;
-               }
+            if (ev2 && (ev2->tag == Ev_IrNoX || ev2->tag == Ev_IrGen)) {
+               helperName = "log_2Ir";
+               helperAddr = &log_2Ir;
                argv = mkIRExprVec_2( i_node_expr,
                                      mkIRExpr_HWord( (HWord)ev2->inode ) );
                regparms = 2;
@@ -794,51 +1136,13 @@ static void flushEvents ( CgState* cgs )
             }
             /* No merging possible; emit as-is. */
             else {
-               if (clo_cache_sim) {
-                  helperName = "log_1IrNoX_0D_cache_access";
-                  helperAddr = &log_1IrNoX_0D_cache_access;
-               } else {
-                  helperName = "log_1Ir";
-                  helperAddr = &log_1Ir;
-               }
+               helperName = "log_1Ir";
+               helperAddr = &log_1Ir;
                argv = mkIRExprVec_1( i_node_expr );
                regparms = 1;
                i++;
             }
             break;
-         case Ev_IrGen:
-            if (clo_cache_sim) {
-	       helperName = "log_1IrGen_0D_cache_access";
-	       helperAddr = &log_1IrGen_0D_cache_access;
-	    } else {
-	       helperName = "log_1Ir";
-	       helperAddr = &log_1Ir;
-	    }
-	    argv = mkIRExprVec_1( i_node_expr );
-	    regparms = 1;
-	    i++;
-            break;
-         case Ev_Dr:
-         case Ev_Dm:
-            /* Data read or modify */
-            helperName = "log_0Ir_1Dr_cache_access";
-            helperAddr = &log_0Ir_1Dr_cache_access;
-            argv = mkIRExprVec_3( i_node_expr, 
-                                  get_Event_dea(ev), 
-                                  mkIRExpr_HWord( get_Event_dszB(ev) ) );
-            regparms = 3;
-            i++;
-            break;
-         case Ev_Dw:
-            /* Data write */
-            helperName = "log_0Ir_1Dw_cache_access";
-            helperAddr = &log_0Ir_1Dw_cache_access;
-            argv = mkIRExprVec_3( i_node_expr,
-                                  get_Event_dea(ev), 
-                                  mkIRExpr_HWord( get_Event_dszB(ev) ) );
-            regparms = 3;
-            i++;
-            break;
          case Ev_Bc:
             /* Conditional branch */
             helperName = "log_cond_branch";
@@ -953,6 +1257,9 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
                           Int datasize, IRAtom* ea, IRAtom* guard,
                           Bool isWrite )
 {
+   IRType tyW = hWordTy_of_host;
+   IRTemp next, advanced, newNext;
+
    tl_assert(isIRAtom(ea));
    tl_assert(guard);
    tl_assert(isIRAtom(guard));
@@ -970,27 +1277,28 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    tl_assert(cgs->events_used >= 0);
    flushEvents(cgs);
    tl_assert(cgs->events_used == 0);
-   /* Same as case Ev_Dw / case Ev_Dr in flushEvents, except with guard */
-   IRExpr*      i_node_expr;
-   const HChar* helperName;
-   void*        helperAddr;
-   IRExpr**     argv;
-   Int          regparms;
-   IRDirty*     di;
-   i_node_expr = mkIRExpr_HWord( (HWord)inode );
-   helperName  = isWrite ? "log_0Ir_1Dw_cache_access"
-                         : "log_0Ir_1Dr_cache_access";
-   helperAddr  = isWrite ? &log_0Ir_1Dw_cache_access
-                         : &log_0Ir_1Dr_cache_access;
-   argv        = mkIRExprVec_3( i_node_expr,
-                                ea, mkIRExpr_HWord( datasize ) );
-   regparms    = 3;
-   di          = unsafeIRDirty_0_N(
-                    regparms, 
-                    helperName, VG_(fnptr_to_fnentry)( helperAddr ), 
-                    argv );
-   di->guard = guard;
-   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+   /* Append a record, but only move trace_next past it if the guard
+      holds. */
+   next     = loadTraceNext(cgs);
+   addTraceRec( cgs, next, 0, inode,
+                (isWrite ? TR_Dw : TR_Dr) | (datasize << TR_SZB_SHIFT), ea );
+   advanced = newIRTemp(cgs->sbOut->tyenv, tyW);
+   newNext  = newIRTemp(cgs->sbOut->tyenv, tyW);
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( advanced,
+                                IRExpr_Binop( tyW == Ity_I32 ? Iop_Add32
+                                                             : Iop_Add64,
+                                              IRExpr_RdTmp(next),
+                                              mkIRExpr_HWord(
+                                                 sizeof(TraceRec) ))));
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp( newNext,
+                                IRExpr_ITE( guard, IRExpr_RdTmp(advanced),
+                                                   IRExpr_RdTmp(next) )));
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store( CGEndness,
+                                mkIRExpr_HWord( (HWord)&trace_next ),
+                                IRExpr_RdTmp(newNext) ));
 }
 
 
@@ -1085,6 +1393,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
    cgs.events_used = 0;
    cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
    cgs.sbInfo_i    = 0;
+   reserveTraceRecs(&cgs, clo_cache_sim ? count_trace_recs(sbIn) : 0);
 
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
@@ -1357,6 +1666,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
+static cache_model_t clo_cache_model = DEFAULT_CACHE_MODEL;
 
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
@@ -1369,6 +1679,40 @@ static CacheCC  Dr_total;
 static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
+static CoherenceCC Co_total;
+
+// Print the counts of one line (or of the summary) in the order of the
+// "events:" line, followed by a newline.
+static void fprint_counts(VgFile* fp, const CacheCC* Ir, const CacheCC* Dr,
+                          const CacheCC* Dw, const BranchCC* Bc,
+                          const BranchCC* Bi, const CoherenceCC* Co)
+{
+   if (clo_cache_sim && have_L2) {
+      VG_(fprintf)(fp, " %llu %llu %llu %llu"
+                       " %llu %llu %llu %llu"
+                       " %llu %llu %llu %llu",
+                       Ir->a, Ir->m1, Ir->m2, Ir->mL,
+                       Dr->a, Dr->m1, Dr->m2, Dr->mL,
+                       Dw->a, Dw->m1, Dw->m2, Dw->mL);
+   } else if (clo_cache_sim) {
+      VG_(fprintf)(fp, " %llu %llu %llu"
+                       " %llu %llu %llu"
+                       " %llu %llu %llu",
+                       Ir->a, Ir->m1, Ir->mL,
+                       Dr->a, Dr->m1, Dr->mL,
+                       Dw->a, Dw->m1, Dw->mL);
+   } else {
+      VG_(fprintf)(fp, " %llu", Ir->a);
+   }
+   if (clo_branch_sim) {
+      VG_(fprintf)(fp, " %llu %llu %llu %llu",
+                       Bc->b, Bc->mp, Bi->b, Bi->mp);
+   }
+   if (clo_cache_sim && n_cores > 1) {
+      VG_(fprintf)(fp, " %llu %llu", Co->inv, Co->cm);
+   }
+   VG_(fprintf)(fp, "\n");
+}
 
 static void fprint_CC_table_and_calc_totals(void)
 {
@@ -1403,9 +1747,13 @@ static void fprint_CC_table_and_calc_totals(void)
    // "desc:" lines (giving I1/D1/LL cache configuration).  The spaces after
    // the 2nd colon makes cg_annotate's output look nicer.
    VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
-                     "desc: D1 cache:         %s\n"
-                     "desc: LL cache:         %s\n",
-                     I1.desc_line, D1.desc_line, LL.desc_line);
+                     "desc: D1 cache:         %s\n",
+                     I1.desc_line, D1.desc_line);
+   if (have_L2)
+      VG_(fprintf)(fp, "desc: L2 cache:         %s\n", L2.desc_line);
+   VG_(fprintf)(fp,  "desc: LL cache:         %s\n", LL.desc_line);
+   if (n_cores > 1)
+      VG_(fprintf)(fp, "desc: Cores:            %d, sharing LL\n", n_cores);
 
    // "cmd:" line
    VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
@@ -1414,20 +1762,19 @@ static void fprint_CC_table_and_calc_totals(void)
       VG_(fprintf)(fp, " %s", arg);
    }
    // "events:" line
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
-   }
-   else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+   VG_(fprintf)(fp, "\nevents: Ir");
+   if (clo_cache_sim) {
+      if (have_L2)
+         VG_(fprintf)(fp, " I1mr I2mr ILmr Dr D1mr D2mr DLmr"
+                          " Dw D1mw D2mw DLmw");
+      else
+         VG_(fprintf)(fp, " I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw");
    }
+   if (clo_branch_sim)
+      VG_(fprintf)(fp, " Bc Bcm Bi Bim");
+   if (clo_cache_sim && n_cores > 1)
+      VG_(fprintf)(fp, " Cinv Cmiss");
+   VG_(fprintf)(fp, "\n");
 
    // Traverse every lineCC
    VG_(OSetGen_ResetIter)(CC_table);
@@ -1455,97 +1802,135 @@ static void fprint_CC_table_and_calc_totals(void)
       }
 
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
-      }
+      VG_(fprintf)(fp, "%d", lineCC->loc.line);
+      fprint_counts(fp, &lineCC->Ir, &lineCC->Dr, &lineCC->Dw,
+                    &lineCC->Bc, &lineCC->Bi, &lineCC->Co);
 
       // Update summary stats
       Ir_total.a  += lineCC->Ir.a;
       Ir_total.m1 += lineCC->Ir.m1;
+      Ir_total.m2 += lineCC->Ir.m2;
       Ir_total.mL += lineCC->Ir.mL;
       Dr_total.a  += lineCC->Dr.a;
       Dr_total.m1 += lineCC->Dr.m1;
+      Dr_total.m2 += lineCC->Dr.m2;
       Dr_total.mL += lineCC->Dr.mL;
       Dw_total.a  += lineCC->Dw.a;
       Dw_total.m1 += lineCC->Dw.m1;
+      Dw_total.m2 += lineCC->Dw.m2;
       Dw_total.mL += lineCC->Dw.mL;
       Bc_total.b  += lineCC->Bc.b;
       Bc_total.mp += lineCC->Bc.mp;
       Bi_total.b  += lineCC->Bi.b;
       Bi_total.mp += lineCC->Bi.mp;
+      Co_total.inv += lineCC->Co.inv;
+      Co_total.cm  += lineCC->Co.cm;
 
       distinct_lines++;
    }
 
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
+   VG_(fprintf)(fp, "summary:");
+   fprint_counts(fp, &Ir_total, &Dr_total, &Dw_total, &Bc_total, &Bi_total,
+                 &Co_total);
+
+   VG_(fclose)(fp);
+}
+
+// Objects with the most D1 misses come first.
+static Int cmp_DataObj_misses(const void* a, const void* b)
+{
+   const DataObj* o1 = *(const DataObj* const*)a;
+   const DataObj* o2 = *(const DataObj* const*)b;
+   ULong m1 = o1->D1mr + o1->D1mw;
+   ULong m2 = o2->D1mr + o2->D1mw;
+
+   return m1 > m2 ? -1 : m1 < m2 ? 1 : 0;
+}
+
+static VgFile* objects_fp;
+
+static void fprint_ExeContext_IP(UInt n, Addr ip)
+{
+   VG_(fprintf)(objects_fp, "   %s %s\n", n == 0 ? "at" : "by",
+                VG_(describe_IP)(ip, NULL));
+}
+
+// Write the data objects, most missed first, to <cachegrind-out-file>.objects.
+static void fprint_objects(void)
+{
+   HChar*    out_file;
+   HChar*    objects_file;
+   DataObj*  obj;
+   DataObj** objs;
+   UWord     n_objs, i, k;
+
+   out_file =
+      VG_(expand_file_name)("--cachegrind-out-file", clo_cachegrind_out_file);
+   objects_file = VG_(malloc)("cg.main.fo.1", VG_(strlen)(out_file) + 9);
+   VG_(sprintf)(objects_file, "%s.objects", out_file);
+   VG_(free)(out_file);
+
+   objects_fp = VG_(fopen)(objects_file,
+                           VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                           VKI_S_IRUSR|VKI_S_IWUSR);
+   if (objects_fp == NULL) {
+      VG_(umsg)("error: can't open data object output file '%s'\n",
+                objects_file);
+      VG_(umsg)("       ... so data object results will be missing.\n");
+      VG_(free)(objects_file);
+      return;
    }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
+   VG_(free)(objects_file);
+
+   n_objs = VG_(OSetGen_Size)(objTable);
+   objs   = VG_(malloc)("cg.main.fo.2", (n_objs + 1) * sizeof(DataObj*));
+   i = 0;
+   VG_(OSetGen_ResetIter)(objTable);
+   while ( (obj = VG_(OSetGen_Next)(objTable)) )
+      objs[i++] = obj;
+   tl_assert(i == n_objs);
+   VG_(ssort)(objs, n_objs, sizeof(DataObj*), cmp_DataObj_misses);
+
+   VG_(fprintf)(objects_fp, "D1 and LL data misses by data object.\n");
+   VG_(fprintf)(objects_fp, "Misses outside any object: D1 %'llu, LL %'llu\n",
+                obj_unknown_D1m, obj_unknown_DLm);
+
+   for (i = 0; i < n_objs; i++) {
+      obj = objs[i];
+      if (obj->D1mr + obj->D1mw == 0)
+         break;
+      VG_(fprintf)(objects_fp, "\n");
+      if (obj->ec) {
+         VG_(fprintf)(objects_fp,
+                      "Heap: %'llu blocks of up to %'lu bytes, allocated\n",
+                      obj->blocks, obj->max_szB);
+         VG_(apply_ExeContext)(fprint_ExeContext_IP, obj->ec,
+                               VG_(get_ExeContext_n_ips)(obj->ec));
+      } else {
+         VG_(fprintf)(objects_fp, "Global: %s\n", obj->name);
+      }
+      VG_(fprintf)(objects_fp,
+                   "D1 misses: %'llu (%'llu rd + %'llu wr)\n",
+                   obj->D1mr + obj->D1mw, obj->D1mr, obj->D1mw);
+      VG_(fprintf)(objects_fp,
+                   "LL misses: %'llu (%'llu rd + %'llu wr)\n",
+                   obj->DLmr + obj->DLmw, obj->DLmr, obj->DLmw);
+      VG_(fprintf)(objects_fp, "D1 misses by offset:\n");
+      for (k = 0; obj->hist && k < OBJ_HIST_SLOTS; k++) {
+         if (obj->hist[k] > 0)
+            VG_(fprintf)(objects_fp, "   %5lu-%-5lu %'llu\n",
+                         k * OBJ_SLOT_SZB, (k + 1) * OBJ_SLOT_SZB - 1,
+                         obj->hist[k]);
+      }
+      if (obj->hist_beyond > 0)
+         VG_(fprintf)(objects_fp, "   %5u-      %'llu\n",
+                      OBJ_SLOT_SZB * OBJ_HIST_SLOTS, obj->hist_beyond);
    }
 
-   VG_(fclose)(fp);
+   VG_(free)(objs);
+   VG_(fclose)(objects_fp);
 }
 
 static UInt ULong_width(ULong n)
@@ -1569,7 +1954,10 @@ static void cg_fini(Int exitcode)
          LL_total, LL_total_r, LL_total_w;
    Int l1, l2, l3;
 
+   trace_drain();
    fprint_CC_table_and_calc_totals();
+   if (clo_cache_objects)
+      fprint_objects();
 
    if (VG_(clo_verbosity) == 0) 
       return;
@@ -1593,11 +1981,16 @@ static void cg_fini(Int exitcode)
       miss numbers */
    if (clo_cache_sim) {
       VG_(umsg)(fmt, "I1  misses:   ", Ir_total.m1);
+      if (have_L2)
+         VG_(umsg)(fmt, "L2i misses:   ", Ir_total.m2);
       VG_(umsg)(fmt, "LLi misses:   ", Ir_total.mL);
 
       if (0 == Ir_total.a) Ir_total.a = 1;
       VG_(umsg)("I1  miss rate: %*.2f%%\n", l1,
                 Ir_total.m1 * 100.0 / Ir_total.a);
+      if (have_L2)
+         VG_(umsg)("L2i miss rate: %*.2f%%\n", l1,
+                   Ir_total.m2 * 100.0 / Ir_total.a);
       VG_(umsg)("LLi miss rate: %*.2f%%\n", l1,
                 Ir_total.mL * 100.0 / Ir_total.a);
       VG_(umsg)("\n");
@@ -1606,6 +1999,7 @@ static void cg_fini(Int exitcode)
        * determine the width of columns 2 & 3. */
       D_total.a  = Dr_total.a  + Dw_total.a;
       D_total.m1 = Dr_total.m1 + Dw_total.m1;
+      D_total.m2 = Dr_total.m2 + Dw_total.m2;
       D_total.mL = Dr_total.mL + Dw_total.mL;
 
       /* Make format string, getting width right for numbers */
@@ -1616,6 +2010,9 @@ static void cg_fini(Int exitcode)
                      D_total.a, Dr_total.a, Dw_total.a);
       VG_(umsg)(fmt, "D1  misses:   ",
                      D_total.m1, Dr_total.m1, Dw_total.m1);
+      if (have_L2)
+         VG_(umsg)(fmt, "L2d misses:   ",
+                        D_total.m2, Dr_total.m2, Dw_total.m2);
       VG_(umsg)(fmt, "LLd misses:   ",
                      D_total.mL, Dr_total.mL, Dw_total.mL);
 
@@ -1626,17 +2023,29 @@ static void cg_fini(Int exitcode)
                 l1, D_total.m1  * 100.0 / D_total.a,
                 l2, Dr_total.m1 * 100.0 / Dr_total.a,
                 l3, Dw_total.m1 * 100.0 / Dw_total.a);
+      if (have_L2)
+         VG_(umsg)("L2d miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, D_total.m2  * 100.0 / D_total.a,
+                   l2, Dr_total.m2 * 100.0 / Dr_total.a,
+                   l3, Dw_total.m2 * 100.0 / Dw_total.a);
       VG_(umsg)("LLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
                 l1, D_total.mL  * 100.0 / D_total.a,
                 l2, Dr_total.mL * 100.0 / Dr_total.a,
                 l3, Dw_total.mL * 100.0 / Dw_total.a);
       VG_(umsg)("\n");
 
-      /* LL overall results */
-
-      LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
-      LL_total_r = Dr_total.m1 + Ir_total.m1;
-      LL_total_w = Dw_total.m1;
+      /* LL overall results.  LL is referenced upon misses in the level
+         above it. */
+
+      if (have_L2) {
+         LL_total   = Dr_total.m2 + Dw_total.m2 + Ir_total.m2;
+         LL_total_r = Dr_total.m2 + Ir_total.m2;
+         LL_total_w = Dw_total.m2;
+      } else {
+         LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         LL_total_r = Dr_total.m1 + Ir_total.m1;
+         LL_total_w = Dw_total.m1;
+      }
       VG_(umsg)(fmt, "LL refs:      ",
                      LL_total, LL_total_r, LL_total_w);
 
@@ -1650,6 +2059,15 @@ static void cg_fini(Int exitcode)
                 l1, LL_total_m  * 100.0 / (Ir_total.a + D_total.a),
                 l2, LL_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
                 l3, LL_total_mw * 100.0 / Dw_total.a);
+
+      /* Coherence results.  Invalidations are caused by writes; the
+         coherence misses they lead to can be reads or writes. */
+      if (n_cores > 1) {
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "Coh invals:   ", Co_total.inv);
+         VG_(umsg)(fmt, "Coh misses:   ", Co_total.cm);
+      }
    }
 
    /* If branch profiling is enabled, show branch overall results. */
@@ -1704,6 +2122,11 @@ static void cg_fini(Int exitcode)
                 VG_(OSetGen_Size)(CC_table));
       VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
                 VG_(OSetGen_Size)(instrInfoTable));
+      if (prefetch_kind != CachePrefetchNone)
+         VG_(dmsg)("cachegrind: prefetches issued: %llu\n", prefetch_count);
+      if (clo_cache_sim)
+         VG_(dmsg)("cachegrind: trace records: %llu in %llu drains\n",
+                   trace_recs_total, trace_drains_total);
    }
 }
 
@@ -1727,6 +2150,9 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
                    (void*)orig_addr,
                    (void*)vge.base[0], (ULong)vge.len[0]);
 
+   // Trace records may still point to its InstrInfos.
+   trace_drain();
+
    // Get BB info, remove from table, free BB info.  Simple!  Note that we
    // use orig_addr, not the first instruction address in vge.
    sbInfo = VG_(OSetGen_Remove)(instrInfoTable, &orig_addr);
@@ -1740,7 +2166,9 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 
 static Bool cg_process_cmd_line_option(const HChar* arg)
 {
-   if (VG_(str_clo_cache_opt)(arg,
+   if (VG_(str_clo_cache_model_opt)(arg, &clo_cache_model)) {}
+
+   else if (VG_(str_clo_cache_opt)(arg,
                               &clo_I1_cache,
                               &clo_D1_cache,
                               &clo_LL_cache)) {}
@@ -1748,6 +2176,7 @@ static Bool cg_process_cmd_line_option(const HChar* arg)
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
+   else if VG_BOOL_CLO(arg, "--cache-objects", clo_cache_objects) {}
    else
       return False;
 
@@ -1757,9 +2186,12 @@ static Bool cg_process_cmd_line_option(const HChar* arg)
 static void cg_print_usage(void)
 {
    VG_(print_cache_clo_opts)();
+   VG_(print_cache_model_clo_opts)();
    VG_(printf)(
 "    --cache-sim=yes|no  [yes]        collect cache stats?\n"
 "    --branch-sim=yes|no [no]         collect branch prediction stats?\n"
+"    --cache-objects=yes|no [no]      charge data misses to heap blocks\n"
+"                                     and globals too?\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
    );
 }
@@ -1771,12 +2203,60 @@ static void cg_print_debug_usage(void)
    );
 }
 
+/*--------------------------------------------------------------------*/
+/*--- Client requests                                              ---*/
+/*--------------------------------------------------------------------*/
+
+static Bool cg_handle_client_request(ThreadId tid, UWord* args, UWord* ret)
+{
+   if (!VG_IS_TOOL_USERREQ('C','G',args[0]))
+      return False;
+
+   switch (args[0]) {
+      case _VG_USERREQ__CG_OBJECTS_ENABLED:
+         *ret = clo_cache_objects ? 1 : 0;
+         return True;
+      case _VG_USERREQ__CG_MALLOC:
+      case _VG_USERREQ__CG_FREE:
+         if (!clo_cache_objects) {
+            *ret = 0;
+            return True;
+         }
+         // Buffered references must be charged to the blocks that held
+         // their addresses when they were made.
+         trace_drain();
+         if (args[0] == _VG_USERREQ__CG_MALLOC)
+            obj_malloc(tid, (Addr)args[1], (SizeT)args[2]);
+         else
+            obj_free((Addr)args[1]);
+         *ret = 0;
+         return True;
+   }
+   VG_(message)(Vg_UserMsg,
+                "Warning: unknown cachegrind client request code %llx\n",
+                (ULong)args[0]);
+   return False;
+}
+
 /*--------------------------------------------------------------------*/
 /*--- Setup                                                        ---*/
 /*--------------------------------------------------------------------*/
 
 static void cg_post_clo_init(void); /* just below */
 
+// With --cores, thread N runs on core (N-1) % cores.  The trace is drained
+// first, as its records were made by the thread that ran before.
+static ThreadId trace_tid = VG_INVALID_THREADID;
+
+static void cg_start_client_code(ThreadId tid, ULong blocks_done)
+{
+   if (tid == trace_tid)
+      return;
+   trace_drain();
+   cachesim_switch_core((tid - 1) % n_cores);
+   trace_tid = tid;
+}
+
 static void cg_pre_clo_init(void)
 {
    VG_(details_name)            ("Cachegrind");
@@ -1796,6 +2276,7 @@ static void cg_pre_clo_init(void)
                                    cg_fini);
 
    VG_(needs_superblock_discards)(cg_discard_superblock_info);
+   VG_(needs_client_requests)     (cg_handle_client_request);
    VG_(needs_command_line_options)(cg_process_cmd_line_option,
                                    cg_print_usage,
                                    cg_print_debug_usage);
@@ -1821,6 +2302,46 @@ static void cg_post_clo_init(void)
                           VG_(malloc), "cg.main.cpci.3",
                           VG_(free));
 
+   // Without --cache-objects=yes the malloc wrappers in
+   // vgpreload_cachegrind-$PLATFORM.so are not wanted, and only calling
+   // them would already change the counts.  So, as massif does for
+   // --pages-as-heap=yes, blank out its entry in LD_PRELOAD (or the
+   // platform equivalent), which was set up before the tool started.
+   if (!clo_cache_objects) {
+      HChar* LD_PRELOAD_val = VG_(getenv)( VG_(LD_PRELOAD_var_name) );
+      HChar* s;
+      HChar* s2;
+
+      tl_assert(LD_PRELOAD_val);
+      // Make sure the vgpreload_core-$PLATFORM entry is there, for sanity.
+      tl_assert(VG_(strstr)(LD_PRELOAD_val, "vgpreload_core"));
+      s2 = VG_(strstr)(LD_PRELOAD_val, "vgpreload_cachegrind");
+      tl_assert(s2);
+
+      // Blank out the entry, from the preceding ':', which the
+      // vgpreload_core-$PLATFORM entry guarantees, to its end.
+      for (s = s2; *s != ':'; s--)
+         *s = ' ';
+      for (s = s2; *s != ':' && *s != '\0'; s++)
+         *s = ' ';
+   }
+
+   if (clo_cache_objects) {
+      if (!clo_cache_sim)
+         VG_(fmsg_bad_option)("--cache-objects=yes",
+            "Data object attribution requires --cache-sim=yes.\n");
+      objTable =
+         VG_(OSetGen_Create)(offsetof(DataObj, key),
+                             NULL,
+                             VG_(malloc), "cg.main.cpci.4",
+                             VG_(free));
+      blockTable =
+         VG_(OSetGen_Create)(offsetof(HeapBlock, start),
+                             cmp_Addr_HeapBlock,
+                             VG_(malloc), "cg.main.cpci.5",
+                             VG_(free));
+   }
+
    VG_(post_clo_init_configure_caches)(&I1c, &D1c, &LLc,
                                        &clo_I1_cache,
                                        &clo_D1_cache,
@@ -1831,6 +2352,8 @@ static void cg_post_clo_init(void)
    // cache lines at any cache level
    min_line_size = (I1c.line_size < D1c.line_size) ? I1c.line_size : D1c.line_size;
    min_line_size = (LLc.line_size < min_line_size) ? LLc.line_size : min_line_size;
+   if (clo_cache_model.L2.size != -1 && clo_cache_model.L2.line_size < min_line_size)
+      min_line_size = clo_cache_model.L2.line_size;
 
    Int largest_load_or_store_size
       = VG_(machine_get_size_of_largest_guest_register)();
@@ -1846,7 +2369,13 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   VG_(post_clo_init_configure_cache_model)(&I1c, &D1c, &LLc,
+                                            &clo_cache_model);
+
+   cachesim_initcaches(I1c, D1c, LLc, &clo_cache_model);
+
+   if (clo_cache_sim && n_cores > 1)
+      VG_(track_start_client_code)(cg_start_client_code);
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
@@ -36,6 +36,18 @@
       - both blocks hit                  --> one hit
       - one block hits, the other misses --> one miss
       - both blocks miss                 --> one miss (not two)
+  - the hierarchy is I1/D1, an optional unified L2, and LL.  By default
+    LL is neither inclusive nor exclusive: a level is only referenced
+    when the level above it misses, and evictions are not propagated.
+  - with --LL-policy=inclusive, lines evicted from LL are invalidated in
+    all upper levels.  With --LL-policy=exclusive, LL acts as a victim
+    cache for L2: a line that hits in LL moves to L2, and lines evicted
+    from L2 move into LL.  L1 evictions are never propagated.
+  - with --cores=N, each core has its own I1, D1 and L2, and all share
+    LL.  A write invalidates the line in the D1 and L2 of every other
+    core holding it, as a MESI protocol would; reads leave other copies
+    alone.  A D1 miss on a line that was last lost to such an
+    invalidation is a coherence miss.
 */
 
 typedef struct {
@@ -48,16 +60,48 @@ typedef struct {
    Int          tag_shift;
    HChar        desc_line[128];         /* large enough */
    UWord*       tags;
+   cache_repl_t repl;
+   Int          plru_leaves;            /* power of two >= assoc */
+   ULong*       plru;                   /* tree-PLRU bits, one per set */
+   UChar*       rrpv;                   /* RRIP values, one per line */
+   Bool         wide;                   /* see below */
+   Int          sets_bits;
+   Int          fp_words;               /* fingerprint words per set */
+   ULong*       fp;                     /* tag fingerprints */
+   UInt*        valid;                  /* valid lines, one per set */
 } cache_t2;
 
+/* With RRIP, lines stay where they are installed, and sets of highly
+ * associative caches are "wide": an 8-bit fingerprint of each tag is
+ * kept alongside the set, packed eight to a ULong, so that a lookup
+ * compares eight ways at once with a few word operations rather than
+ * scanning the tags one by one, and only checks the full tag of
+ * candidates.  The number of valid lines of each set is kept too, so
+ * that full sets need no search for an empty line.  This does not change
+ * which lines are evicted.
+ *
+ * LRU sets are not made wide: they are kept in MRU order, so a lookup
+ * mostly ends early, and shuffling the tags on a hit costs about as much
+ * as the scan.  Neither are PLRU sets: walking the tree on every hit
+ * dominates, and the extra fingerprint updates made misses slower.
+ */
+#define WIDE_MIN_ASSOC 12
+
+#define FP_ONES  0x0101010101010101ULL
+#define FP_HIGHS 0x8080808080808080ULL
+
+/* Largest re-reference prediction value of the 2-bit RRIP policy. */
+#define RRPV_MAX 3
+
 /* By this point, the size/assoc/line_size has been checked. */
-static void cachesim_initcache(cache_t config, cache_t2* c)
+static void cachesim_initcache(cache_t config, cache_t2* c, cache_repl_t repl)
 {
    Int i;
 
    c->size      = config.size;
    c->assoc     = config.assoc;
    c->line_size = config.line_size;
+   c->repl      = repl;
 
    c->sets           = (c->size / c->line_size) / c->assoc;
    c->sets_min_1     = c->sets - 1;
@@ -68,8 +112,10 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
       VG_(sprintf)(c->desc_line, "%d B, %d B, direct-mapped", 
                                  c->size, c->line_size);
    } else {
-      VG_(sprintf)(c->desc_line, "%d B, %d B, %d-way associative",
-                                 c->size, c->line_size, c->assoc);
+      VG_(sprintf)(c->desc_line, "%d B, %d B, %d-way associative%s",
+                                 c->size, c->line_size, c->assoc,
+                                 repl == CacheReplPLRU ? ", PLRU" :
+                                 repl == CacheReplRRIP ? ", RRIP" : "");
    }
 
    c->tags = VG_(malloc)("cg.sim.ci.1",
@@ -77,6 +123,255 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
 
    for (i = 0; i < c->sets * c->assoc; i++)
       c->tags[i] = 0;
+
+   c->plru = NULL;
+   c->rrpv = NULL;
+   for (c->plru_leaves = 1; c->plru_leaves < c->assoc; c->plru_leaves *= 2)
+      ;
+   c->sets_bits = VG_(log2)(c->sets);
+   c->wide      = repl == CacheReplRRIP && c->assoc >= WIDE_MIN_ASSOC;
+   c->fp_words  = (c->assoc + 7) / 8;
+   c->fp        = NULL;
+   c->valid     = NULL;
+   if (c->wide) {
+      c->fp = VG_(malloc)("cg.sim.ci.4",
+                          sizeof(ULong) * c->sets * c->fp_words);
+      for (i = 0; i < c->sets * c->fp_words; i++)
+         c->fp[i] = 0;
+      c->valid = VG_(malloc)("cg.sim.ci.5", sizeof(UInt) * c->sets);
+      for (i = 0; i < c->sets; i++)
+         c->valid[i] = 0;
+   }
+   if (repl == CacheReplPLRU) {
+      tl_assert(c->plru_leaves <= 64);
+      c->plru = VG_(malloc)("cg.sim.ci.2", sizeof(ULong) * c->sets);
+      for (i = 0; i < c->sets; i++)
+         c->plru[i] = 0;
+   } else if (repl == CacheReplRRIP) {
+      c->rrpv = VG_(malloc)("cg.sim.ci.3", c->sets * c->assoc);
+      for (i = 0; i < c->sets * c->assoc; i++)
+         c->rrpv[i] = RRPV_MAX;
+   }
+}
+
+/* Tree-PLRU: node n of the binary tree over the ways of a set is bit n
+ * of the set's word (the root is node 1).  A set bit means that the
+ * victim is to be found in the right subtree.  If the associativity is
+ * not a power of two, subtrees holding no existing ways are skipped.
+ */
+static UInt plru_victim(const cache_t2* c, UInt set_no)
+{
+   ULong bits = c->plru[set_no];
+   UInt  node = 1, lo = 0, n = c->plru_leaves;
+
+   while (n > 1) {
+      n /= 2;
+      if (((bits >> node) & 1) && lo + n < c->assoc) {
+         lo  += n;
+         node = 2 * node + 1;
+      } else {
+         node = 2 * node;
+      }
+   }
+   return lo;
+}
+
+/* Make all nodes on the path to way point away from it. */
+static void plru_touch(cache_t2* c, UInt set_no, UInt way)
+{
+   ULong bits = c->plru[set_no];
+   UInt  node = 1, lo = 0, n = c->plru_leaves;
+
+   while (n > 1) {
+      n /= 2;
+      if (way < lo + n) {
+         bits |= 1ULL << node;
+         node  = 2 * node;
+      } else {
+         bits &= ~(1ULL << node);
+         lo   += n;
+         node  = 2 * node + 1;
+      }
+   }
+   c->plru[set_no] = bits;
+}
+
+/* SRRIP: evict a line predicted to be re-referenced in the distant
+ * future, ageing the whole set until there is one.
+ */
+static UInt rrip_victim(cache_t2* c, UInt set_no)
+{
+   UChar* rrpv = &c->rrpv[set_no * c->assoc];
+   Int i;
+
+   for (;;) {
+      for (i = 0; i < c->assoc; i++) {
+         if (rrpv[i] >= RRPV_MAX)
+            return i;
+      }
+      for (i = 0; i < c->assoc; i++)
+         rrpv[i]++;
+   }
+}
+
+/* The fingerprint of a tag: the low tag bits above the set index. */
+static __inline__ UInt wide_fp(const cache_t2* c, UWord tag)
+{
+   return (tag >> c->sets_bits) & 0xFF;
+}
+
+static __inline__ void wide_set_fp(cache_t2* c, UInt set_no, Int way, UInt f)
+{
+   ULong* w  = &c->fp[set_no * c->fp_words + way / 8];
+   Int    sh = 8 * (way % 8);
+
+   *w = (*w & ~(0xFFULL << sh)) | ((ULong)f << sh);
+}
+
+/* Return the way of a wide set holding tag, or -1.  Looking up tag 0
+ * finds an empty line, as empty lines have tag and fingerprint 0. */
+static Int wide_find_way(const cache_t2* c, UInt set_no, UWord tag)
+{
+   const UWord* set = &(c->tags[set_no * c->assoc]);
+   const ULong* fp  = &c->fp[set_no * c->fp_words];
+   ULong pattern = FP_ONES * wide_fp(c, tag);
+   Int w;
+
+   for (w = 0; w < c->fp_words; w++) {
+      ULong x = fp[w] ^ pattern;
+      /* High bit of each zero byte of x, plus possibly some false
+       * positives above a zero byte, which the tag check discards. */
+      ULong m = (x - FP_ONES) & ~x & FP_HIGHS;
+
+      for (; m; m &= m - 1) {
+         Int way = w * 8 + __builtin_ctzll(m) / 8;
+         if (way < c->assoc && set[way] == tag)
+            return way;
+      }
+   }
+   return -1;
+}
+
+/* cachesim_setref_victim() for a wide set, which uses RRIP. */
+static Bool wide_setref_victim(cache_t2* c, UInt set_no, UWord tag,
+                               UWord* victim)
+{
+   UWord* set = &(c->tags[set_no * c->assoc]);
+   Int way = wide_find_way(c, set_no, tag);
+
+   if (way >= 0) {
+      c->rrpv[set_no * c->assoc + way] = 0;
+      *victim = 0;
+      return False;
+   }
+
+   /* A miss;  fill an empty line if there is one. */
+   if (c->valid[set_no] < c->assoc) {
+      way = wide_find_way(c, set_no, 0);
+      c->valid[set_no]++;
+   } else
+      way = rrip_victim(c, set_no);
+   *victim  = set[way];
+   set[way] = tag;
+   wide_set_fp(c, set_no, way, wide_fp(c, tag));
+   c->rrpv[set_no * c->assoc + way] = RRPV_MAX - 1;
+   return True;
+}
+
+/* Reference a set with any replacement policy.  Returns whether the
+ * reference missed, and in that case the tag of the line that was
+ * evicted in *victim (0 if an empty line was filled).
+ */
+static Bool cachesim_setref_victim(cache_t2* c, UInt set_no, UWord tag,
+                                   UWord* victim)
+{
+   UWord* set = &(c->tags[set_no * c->assoc]);
+   Int i, j, way, empty = -1;
+
+   if (c->wide)
+      return wide_setref_victim(c, set_no, tag, victim);
+
+   if (c->repl == CacheReplLRU) {
+      for (i = 0; i < c->assoc; i++) {
+         if (tag == set[i]) {
+            for (j = i; j > 0; j--)
+               set[j] = set[j - 1];
+            set[0]  = tag;
+            *victim = 0;
+            return False;
+         }
+      }
+      *victim = set[c->assoc - 1];
+      for (j = c->assoc - 1; j > 0; j--)
+         set[j] = set[j - 1];
+      set[0] = tag;
+      return True;
+   }
+
+   for (i = 0; i < c->assoc; i++) {
+      if (tag == set[i]) {
+         if (c->repl == CacheReplPLRU)
+            plru_touch(c, set_no, i);
+         else
+            c->rrpv[set_no * c->assoc + i] = 0;
+         *victim = 0;
+         return False;
+      }
+      if (set[i] == 0 && empty < 0)
+         empty = i;
+   }
+
+   /* A miss;  fill an empty line if there is one. */
+   if (empty >= 0)
+      way = empty;
+   else if (c->repl == CacheReplPLRU)
+      way = plru_victim(c, set_no);
+   else
+      way = rrip_victim(c, set_no);
+
+   *victim  = set[way];
+   set[way] = tag;
+   if (c->repl == CacheReplPLRU)
+      plru_touch(c, set_no, way);
+   else
+      c->rrpv[set_no * c->assoc + way] = RRPV_MAX - 1;
+   return True;
+}
+
+/* Remove the line holding block from c, if present.  Only meaningful if
+ * block numbers of c are those of the caller, ie. the line sizes match.
+ */
+static Bool cachesim_invalidate(cache_t2* c, UWord block)
+{
+   UInt   set_no = block & c->sets_min_1;
+   UWord* set = &(c->tags[set_no * c->assoc]);
+   Int i, j;
+
+   if (c->wide) {
+      i = wide_find_way(c, set_no, block);
+      if (i < 0)
+         return False;
+   } else {
+      for (i = 0; i < c->assoc && set[i] != block; i++)
+         ;
+      if (i == c->assoc)
+         return False;
+   }
+
+   if (c->repl == CacheReplLRU) {
+      /* Move the now empty line into the LRU position. */
+      for (j = i; j < c->assoc - 1; j++)
+         set[j] = set[j + 1];
+      i = c->assoc - 1;
+   }
+   set[i] = 0;
+   if (c->wide) {
+      wide_set_fp(c, set_no, i, 0);
+      c->valid[set_no]--;
+   }
+   if (c->repl == CacheReplRRIP)
+      c->rrpv[set_no * c->assoc + i] = RRPV_MAX;
+   return True;
 }
 
 /* This attribute forces GCC to inline the function, getting rid of a
@@ -91,6 +386,11 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
    int i, j;
    UWord *set;
 
+   if (c->repl != CacheReplLRU) {
+      UWord victim;
+      return cachesim_setref_victim(c, set_no, tag, &victim);
+   }
+
    set = &(c->tags[set_no * c->assoc]);
 
    /* This loop is unrolled for just the first case, which is the most */
@@ -164,23 +464,277 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
 
 
 static cache_t2 LL;
+static cache_t2 L2;
 static cache_t2 I1;
 static cache_t2 D1;
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+static Bool              have_L2;
+static cache_LL_policy_t LL_policy;
+static cache_prefetch_t  prefetch_kind;
+
+/* True if there is no L2, no prefetcher and LL is neither inclusive nor
+ * exclusive.  L1 misses are then handled inline. */
+static Bool simple_hierarchy = True;
+
+static ULong prefetch_count = 0;
+
+/* The private caches of each core.  I1, D1 and L2 above are copies of
+ * those of the current core.  All the state of a cache_t2 that changes
+ * is behind its pointers, so the copies need not be written back. */
+typedef struct {
+   cache_t2 I1;
+   cache_t2 D1;
+   cache_t2 L2;
+   /* D1 blocks lost to invalidations, direct mapped on the block number,
+    * so a later miss on them can be told to be a coherence miss. */
+   UWord*   lost;
+} core_t;
+
+static core_t* cores;
+static Int     n_cores  = 1;
+static Int     cur_core = 0;
+static UWord   lost_mask;
+
+/* Coherence misses since the caller last reset this. */
+static ULong   coherence_misses = 0;
+
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc,
+                                const cache_model_t* model)
+{
+   Int i, k;
+
+   cachesim_initcache(LLc, &LL, model->repl);
+
+   have_L2       = model->L2.size != -1;
+   LL_policy     = model->LL_policy;
+   prefetch_kind = model->prefetch;
+   n_cores       = model->cores;
+
+   cores = VG_(malloc)("cg.sim.ci.6", n_cores * sizeof(core_t));
+   for (i = 0; i < n_cores; i++) {
+      cachesim_initcache(I1c, &cores[i].I1, model->repl);
+      cachesim_initcache(D1c, &cores[i].D1, model->repl);
+      if (have_L2)
+         cachesim_initcache(model->L2, &cores[i].L2, model->repl);
+      cores[i].lost = NULL;
+   }
+   I1 = cores[0].I1;
+   D1 = cores[0].D1;
+   L2 = cores[0].L2;
+
+   if (n_cores > 1) {
+      /* Twice the number of D1 lines keeps collisions rare. */
+      lost_mask = 2 * D1.sets * D1.assoc - 1;
+      for (i = 0; i < n_cores; i++) {
+         cores[i].lost = VG_(malloc)("cg.sim.ci.7",
+                                     (lost_mask + 1) * sizeof(UWord));
+         for (k = 0; k <= lost_mask; k++)
+            cores[i].lost[k] = 0;
+      }
+   }
+
+   simple_hierarchy = !have_L2 && LL_policy == CacheLLNINE
+                      && prefetch_kind == CachePrefetchNone && n_cores == 1;
+}
+
+/* Make core the one whose private caches are referenced. */
+static void cachesim_switch_core(Int core)
+{
+   tl_assert(core >= 0 && core < n_cores);
+   I1 = cores[core].I1;
+   D1 = cores[core].D1;
+   L2 = cores[core].L2;
+   cur_core = core;
+}
+
+/* Invalidate D1 block in the private caches of every core but the
+ * current one.  Returns the number of cores that held it. */
+static UInt cachesim_invalidate_others(UWord block)
+{
+   UInt n = 0;
+   Int  i;
+
+   for (i = 0; i < n_cores; i++) {
+      Bool found;
+      if (i == cur_core)
+         continue;
+      found = cachesim_invalidate(&cores[i].D1, block);
+      if (have_L2
+          && cachesim_invalidate(&cores[i].L2,
+                                 (block << D1.line_size_bits)
+                                 >> L2.line_size_bits))
+         found = True;
+      if (found) {
+         cores[i].lost[block & lost_mask] = block;
+         n++;
+      }
+   }
+   return n;
+}
+
+/* A write by the current core.  Returns the number of lines invalidated
+ * in other cores. */
+static UInt cachesim_D1_write_invalidate(Addr a, UChar size)
+{
+   UWord block1 =  a         >> D1.line_size_bits;
+   UWord block2 = (a+size-1) >> D1.line_size_bits;
+   UInt  n;
+
+   n = cachesim_invalidate_others(block1);
+   if (block2 != block1)
+      n += cachesim_invalidate_others(block2);
+   return n;
+}
+
+/* A D1 miss of the current core.  Counts a coherence miss if a block it
+ * touches was lost to an invalidation. */
+static void cachesim_D1_coherence_miss(Addr a, UChar size)
+{
+   UWord* lost   = cores[cur_core].lost;
+   UWord  block1 =  a         >> D1.line_size_bits;
+   UWord  block2 = (a+size-1) >> D1.line_size_bits;
+   Bool   coh    = False;
+
+   if (lost[block1 & lost_mask] == block1) {
+      lost[block1 & lost_mask] = 0;
+      coh = True;
+   }
+   if (block2 != block1 && lost[block2 & lost_mask] == block2) {
+      lost[block2 & lost_mask] = 0;
+      coh = True;
+   }
+   if (coh)
+      coherence_misses++;
+}
+
+/* Reference a single block below L1 if LL is inclusive or exclusive.
+ * All levels have the same line size then, so block numbers are the
+ * same at every level. */
+static void cachesim_block_below_L1(UWord block, Bool* m2, Bool* mL)
+{
+   UWord victim, LL_victim;
+
+   if (have_L2) {
+      if (!cachesim_setref_victim(&L2, block & L2.sets_min_1, block, &victim))
+         return;
+      *m2 = True;
+      if (LL_policy == CacheLLExclusive) {
+         /* The line moves from LL to L2, and L2's victim moves to LL. */
+         if (!cachesim_invalidate(&LL, block))
+            *mL = True;
+         if (victim != 0)
+            cachesim_setref_victim(&LL, victim & LL.sets_min_1, victim,
+                                   &LL_victim);
+         return;
+      }
+   }
+
+   tl_assert(LL_policy == CacheLLInclusive);
+   if (cachesim_setref_victim(&LL, block & LL.sets_min_1, block, &victim)) {
+      *mL = True;
+      if (victim != 0) {
+         if (have_L2)
+            cachesim_invalidate(&L2, victim);
+         cachesim_invalidate(&I1, victim);
+         cachesim_invalidate(&D1, victim);
+      }
+   }
+}
+
+/* Reference the levels below L1.  *m2 and *mL are set if the reference
+ * missed in L2 and LL respectively. */
+static void cachesim_ref_below_L1(Addr a, UChar size, Bool* m2, Bool* mL)
+{
+   if (LL_policy == CacheLLNINE) {
+      if (have_L2) {
+         if (!cachesim_ref_is_miss(&L2, a, size))
+            return;
+         *m2 = True;
+      }
+      if (cachesim_ref_is_miss(&LL, a, size))
+         *mL = True;
+   } else {
+      UWord block1 =  a         >> LL.line_size_bits;
+      UWord block2 = (a+size-1) >> LL.line_size_bits;
+
+      cachesim_block_below_L1(block1, m2, mL);
+      if (block2 != block1)
+         cachesim_block_below_L1(block2, m2, mL);
+   }
+}
+
+/*
+ * Hardware prefetcher, trained on L1 misses.  Lines are fetched into L2,
+ * or into LL if there is no L2.  The stride prefetcher tracks one stream
+ * per 4k page and starts prefetching once the same stride has been seen
+ * twice in a row.
+ */
+#define PF_STREAMS   16
+#define PF_PAGE_BITS 12
+
+typedef struct {
+   UWord last;
+   Word  stride;
+   Int   conf;
+} pf_stream_t;
+
+static pf_stream_t pf_streams[PF_STREAMS];
+
+static void cachesim_prefetch(Addr a)
 {
-   cachesim_initcache(I1c, &I1);
-   cachesim_initcache(D1c, &D1);
-   cachesim_initcache(LLc, &LL);
+   Int   line_bits = have_L2 ? L2.line_size_bits : LL.line_size_bits;
+   UWord block     = a >> line_bits;
+   UWord target;
+   Bool  m2, mL;
+
+   if (prefetch_kind == CachePrefetchNextLine) {
+      target = block + 1;
+   } else {
+      pf_stream_t* s = &pf_streams[(a >> PF_PAGE_BITS) % PF_STREAMS];
+      Word stride = (Word)(block - s->last);
+
+      if (stride == 0)
+         return;
+      if (stride == s->stride) {
+         if (s->conf < 3)
+            s->conf++;
+      } else {
+         s->stride = stride;
+         s->conf   = 0;
+      }
+      s->last = block;
+      if (s->conf < 1)
+         return;
+      target = block + stride;
+   }
+
+   prefetch_count++;
+   m2 = mL = False;
+   cachesim_ref_below_L1(target << line_bits, 1, &m2, &mL);
+}
+
+/* An L1 miss for anything but the simple hierarchy. */
+static void cachesim_L1_miss(Addr a, UChar size, ULong* m2, ULong* mL)
+{
+   Bool miss2 = False, missL = False;
+
+   cachesim_ref_below_L1(a, size, &miss2, &missL);
+   if (miss2) (*m2)++;
+   if (missL) (*mL)++;
+   if (prefetch_kind != CachePrefetchNone)
+      cachesim_prefetch(a);
 }
 
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong* m2,
+                           ULong *mL)
 {
    if (cachesim_ref_is_miss(&I1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      if (!simple_hierarchy)
+         cachesim_L1_miss(a, size, m2, mL);
+      else if (cachesim_ref_is_miss(&LL, a, size))
          (*mL)++;
    }
 }
@@ -188,7 +742,8 @@ void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
 // common special case IrNoX
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong* m2,
+                           ULong *mL)
 {
    UWord block  = a >> I1.line_size_bits;
    UInt  I1_set = block & I1.sets_min_1;
@@ -197,19 +752,25 @@ void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
    if (cachesim_setref_is_miss(&I1, I1_set, block)) {
       UInt  LL_set = block & LL.sets_min_1;
       (*m1)++;
+      if (!simple_hierarchy)
+         cachesim_L1_miss(a, size, m2, mL);
       // can use block as tag as L1I and LL cache line sizes are equal
-      if (cachesim_setref_is_miss(&LL, LL_set, block))
+      else if (cachesim_setref_is_miss(&LL, LL_set, block))
          (*mL)++;
    }
 }
 
 __attribute__((always_inline))
 static __inline__
-void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong* m2, ULong *mL)
 {
    if (cachesim_ref_is_miss(&D1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      if (n_cores > 1)
+         cachesim_D1_coherence_miss(a, size);
+      if (!simple_hierarchy)
+         cachesim_L1_miss(a, size, m2, mL);
+      else if (cachesim_ref_is_miss(&LL, a, size))
          (*mL)++;
    }
 }
@@ -0,0 +1,127 @@
+// Access patterns whose miss counts depend on the replacement policy, the
+// prefetcher and the inclusion policy of the simulated caches.  Each one
+// is a function of its own, so that filter_fn_events can pick its counts
+// out of cachegrind.out.  The expected counts assume 64 B lines, a 32 KB
+// 8-way D1, and the L2 and LL caches given in the .vgtest files.
+
+#include <stdio.h>
+#include <string.h>
+
+#define LINE 64
+#define KB   1024
+
+static char buf[4096 * KB] __attribute__((aligned(4096)));
+static char hot_buf[4 * KB] __attribute__((aligned(4096)));
+static volatile char sink;
+
+// Per D1 set, read the same 4 lines twice, then 6 lines that are never
+// read again.  LRU evicts the 4 lines before the next round, RRIP keeps
+// them, and PLRU keeps some of them.
+__attribute__((noinline)) static void scan_mix(void)
+{
+   char* scan = buf + 16 * KB;
+   int i, j;
+
+   for (i = 0; i < 160; i++) {
+      for (j = 0; j < 2 * 16 * KB; j += LINE)
+         sink = buf[j % (16 * KB)];
+      for (j = 0; j < 24 * KB; j += LINE)
+         sink = scan[j];
+      scan += 24 * KB;
+   }
+}
+
+// Per D1 set, read the same 9 lines over and over, the first one again
+// after the fourth.  LRU misses 8 times in 10, tree-PLRU about 5 times.
+__attribute__((noinline)) static void reread(void)
+{
+   int i, j;
+
+   for (i = 0; i < 100; i++) {
+      for (j = 0; j < 16 * KB; j += LINE)
+         sink = buf[j];
+      for (j = 0; j < 4 * KB; j += LINE)
+         sink = buf[j];
+      for (j = 16 * KB; j < 36 * KB; j += LINE)
+         sink = buf[j];
+   }
+}
+
+// Read every line of 4 MB once, in order.
+__attribute__((noinline)) static void seq_read(void)
+{
+   int j;
+
+   for (j = 0; j < sizeof(buf); j += LINE)
+      sink = buf[j];
+}
+
+// Read every other line of 4 MB once, in order.  A next-line prefetcher
+// only fetches lines that are never read.
+__attribute__((noinline)) static void skip_read(void)
+{
+   int j;
+
+   for (j = 0; j < sizeof(buf); j += 2 * LINE)
+      sink = buf[j];
+}
+
+// Read 4 KB, which stays in D1 but is never referenced below it again.
+__attribute__((noinline)) static void hot(void)
+{
+   int j;
+
+   for (j = 0; j < sizeof(hot_buf); j += LINE)
+      sink = hot_buf[j];
+}
+
+// Read the next 8 lines of 4 MB.
+__attribute__((noinline)) static void stream(int i)
+{
+   int j;
+
+   for (j = 0; j < 8 * LINE; j += LINE)
+      sink = buf[i * 8 * LINE + j];
+}
+
+// A stream through the lower levels evicts the lines read by hot() from
+// them, which takes these lines out of D1 as well if LL is inclusive.
+static void hot_and_stream(void)
+{
+   int i;
+
+   for (i = 0; i < sizeof(buf) / (8 * LINE); i++) {
+      hot();
+      stream(i);
+   }
+}
+
+// Read 640 KB over and over.  That is more than LL and more than L2, but
+// less than both together, so only an exclusive LL holds all of it.
+__attribute__((noinline)) static void cyclic(void)
+{
+   int i, j;
+
+   for (i = 0; i < 10; i++) {
+      for (j = 0; j < 640 * KB; j += LINE)
+         sink = buf[j];
+   }
+}
+
+int main(int argc, char** argv)
+{
+   if (argc == 2 && strcmp(argv[1], "replacement") == 0) {
+      reread();
+      scan_mix();
+   } else if (argc == 2 && strcmp(argv[1], "prefetch") == 0) {
+      seq_read();
+      skip_read();
+   } else if (argc == 2 && strcmp(argv[1], "inclusion") == 0) {
+      hot_and_stream();
+      cyclic();
+   } else {
+      fprintf(stderr, "usage: %s replacement|prefetch|inclusion\n", argv[0]);
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,36 @@
+#include <pthread.h>
+#include <stdio.h>
+
+// Two threads write to different words of the same cache line.  With
+// --cores=2 each write invalidates the line in the other core's D1, and
+// the next access by that core is a coherence miss.
+
+#define N 100000
+
+static struct {
+   volatile int a;
+   volatile int b;
+} __attribute__((aligned(64))) counters;
+
+static void* thread_func(void* arg)
+{
+   int i;
+
+   for (i = 0; i < N; i++)
+      counters.b++;
+   return arg;
+}
+
+int main(void)
+{
+   pthread_t tid;
+   int i;
+
+   pthread_create(&tid, NULL, thread_func, NULL);
+   for (i = 0; i < N; i++)
+      counters.a++;
+   pthread_join(tid, NULL);
+   printf("%d %d\n", counters.a, counters.b);
+
+   return 0;
+}
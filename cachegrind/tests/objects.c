@@ -0,0 +1,24 @@
+#include <stdlib.h>
+
+// A global and a heap array, each bigger than D1, walked one line at a
+// time so that every access misses.
+struct node {
+   long hot;
+   char cold[120];
+};
+
+static struct node table[4096];
+
+int main(void)
+{
+   volatile struct node* heap = malloc(4096 * sizeof(struct node));
+   long sum = 0;
+   int i;
+
+   for (i = 0; i < 4096; i++) {
+      sum += table[i].hot;
+      heap[i].hot = i;
+   }
+   free((void*)heap);
+   return sum;
+}
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include "tests/malloc.h"
+
+// Heap blocks from each of the aligned allocation functions, of different
+// sizes, each walked one line at a time so that every access misses.
+
+static long walk(volatile char* p, size_t n)
+{
+   long sum = 0;
+   size_t i;
+
+   for (i = 0; i < n; i += 64)
+      sum += p[i];
+   return sum;
+}
+
+int main(void)
+{
+   char* a;
+   char* b;
+   char* c;
+   char* d;
+   long sum = 0;
+
+   a = memalign64(256 * 1024);
+   if (posix_memalign((void**)&b, 64, 320 * 1024) != 0)
+      return 1;
+   c = valloc(384 * 1024);
+#if defined(__GLIBC__) \
+    && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 16))
+   d = aligned_alloc(64, 448 * 1024);
+#else
+   // No aligned_alloc: allocate the same block another way.
+   if (posix_memalign((void**)&d, 64, 448 * 1024) != 0)
+      return 1;
+#endif
+   if (!c || !d)
+      return 1;
+
+   sum += walk(a, 256 * 1024);
+   sum += walk(b, 320 * 1024);
+   sum += walk(c, 384 * 1024);
+   sum += walk(d, 448 * 1024);
+
+   free(a);
+   free(b);
+   free(c);
+   free(d);
+   return sum;
+}
@@ -287,6 +287,8 @@ BBCC* new_bbcc(BB* bb)
        bbcc->jmp[i].jcc_list = 0;
    }
    bbcc->ecounter_sum = 0;
+   bbcc->snap_epoch = 0;
+   bbcc->snap_ir = 0;
 
    /* Init pointer caches (LRU) */
    bbcc->lru_next_bbcc = 0;
@@ -508,6 +510,8 @@ static void handleUnderflow(BB* bb)
   }
   else if (CLG_(current_state).collect)
     source_bbcc->ecounter_sum++;
+  if (source_bbcc->snap_epoch != CLG_(snap_epoch))
+    CLG_(snapshot_touch)(source_bbcc);
   
   /* Force a new top context, will be set active by push_cxt() */
   CLG_(current_fn_stack).top--;
@@ -605,6 +609,8 @@ void CLG_(setup_bbcc)(BB* bb)
 	if (!CLG_(current_state).nonskipped) {
 	  last_bbcc->ecounter_sum++;
 	  last_bbcc->jmp[passed].ecounter++;
+	  if (last_bbcc->snap_epoch != CLG_(snap_epoch))
+	      CLG_(snapshot_touch)(last_bbcc);
 	  if (!CLG_(clo).simulate_cache) {
 	      /* update Ir cost */              
               UInt instr_count = last_bb->jmp[passed].instr+1;
@@ -523,9 +523,21 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--dump-bb",    CLG_(clo).dump_bb) {}
 
    else if VG_INT_CLO( arg, "--dump-every-bb", CLG_(clo).dump_every_bb) {}
+   else if VG_BINT_CLO(arg, "--snapshot-every", CLG_(clo).snapshot_every,
+                       0, 1000000) {}
+   else if VG_BINT_CLO(arg, "--snapshot-ring", CLG_(clo).snapshot_ring,
+                       1, 1000000) {}
 
    else if VG_BOOL_CLO(arg, "--collect-alloc",   CLG_(clo).collect_alloc) {}
-   else if VG_BOOL_CLO(arg, "--collect-systime", CLG_(clo).collect_systime) {}
+   else if VG_XACT_CLO(arg, "--collect-systime=no",
+                       CLG_(clo).collect_systime, systime_no) {}
+   else if VG_XACT_CLO(arg, "--collect-systime=msec",
+                       CLG_(clo).collect_systime, systime_msec) {}
+   /* compatibility alias for msec */
+   else if VG_XACT_CLO(arg, "--collect-systime=yes",
+                       CLG_(clo).collect_systime, systime_msec) {}
+   else if VG_XACT_CLO(arg, "--collect-systime=usec",
+                       CLG_(clo).collect_systime, systime_usec) {}
    else if VG_BOOL_CLO(arg, "--collect-bus",     CLG_(clo).collect_bus) {}
    /* for option compatibility with cachegrind */
    else if VG_BOOL_CLO(arg, "--cache-sim",       CLG_(clo).simulate_cache) {}
@@ -566,6 +578,9 @@ void CLG_(print_usage)(void)
 
 "\n   activity options (for interactivity use callgrind_control):\n"
 "    --dump-every-bb=<count>   Dump every <count> basic blocks [0=never]\n"
+"    --snapshot-every=<ms>     Record per-function instruction counts every\n"
+"                              <ms> milliseconds, without dumping [0=never]\n"
+"    --snapshot-ring=<n>       Keep the last <n> snapshots [1000]\n"
 "    --dump-before=<func>      Dump when entering function\n"
 "    --zero-before=<func>      Zero all costs when entering function\n"
 "    --dump-after=<func>       Dump when leaving function\n"
@@ -582,7 +597,8 @@ void CLG_(print_usage)(void)
 #if CLG_EXPERIMENTAL
 "    --collect-alloc=no|yes    Collect memory allocation info? [no]\n"
 #endif
-"    --collect-systime=no|yes  Collect system call time info? [no]\n"
+"    --collect-systime=no|yes|msec|usec  Collect system call time info? [no]\n"
+"              yes|msec gives the time in milliseconds, usec in microseconds\n"
 
 "\n   cost entity separation options:\n"
 "    --separate-threads=no|yes Separate data per thread [no]\n"
@@ -642,13 +658,15 @@ void CLG_(set_clo_defaults)(void)
   CLG_(clo).dump_bbs         = False;
 
   CLG_(clo).dump_every_bb    = 0;
+  CLG_(clo).snapshot_every   = 0;
+  CLG_(clo).snapshot_ring    = 1000;
 
   /* Collection */
   CLG_(clo).separate_threads = False;
   CLG_(clo).collect_atstart  = True;
   CLG_(clo).collect_jumps    = False;
   CLG_(clo).collect_alloc    = False;
-  CLG_(clo).collect_systime  = False;
+  CLG_(clo).collect_systime  = systime_no;
   CLG_(clo).collect_bus      = False;
 
   CLG_(clo).skip_plt         = True;
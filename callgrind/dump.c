@@ -458,6 +458,42 @@ static void fprint_apos(VgFile *fp, AddrPos* curr, AddrPos* last,
 
 
 
+/**
+ * Print a relative subposition: "+diff", "-diff", or "*" if unchanged.
+ */
+static void fprint_subpos(VgFile *fp, Long diff)
+{
+    if (diff > 0)
+	VG_(fprintf)(fp, "+%lld ", diff);
+    else if (diff == 0)
+	VG_(fprintf)(fp, "* ");
+    else
+	VG_(fprintf)(fp, "%lld ", diff);
+}
+
+/* Number of digits of v in the given base */
+static Int num_digits(ULong v, UInt base)
+{
+    Int n = 1;
+
+    while (v >= base) {
+	v /= base;
+	n++;
+    }
+    return n;
+}
+
+/* Whether to write a subposition as diff from the last one rather than
+ * as an absolute value of abs_len characters: always for a step of less
+ * than 100, as relative numbers were limited to before, and otherwise
+ * only if that is shorter. */
+static Bool use_subpos(Long diff, Int abs_len)
+{
+    ULong d = diff < 0 ? -(ULong)diff : (ULong)diff;
+
+    return d < 100 || 1 + num_digits(d, 10) < abs_len;
+}
+
 /**
  * Print a position.
  * This prints out differences if allowed
@@ -471,47 +507,28 @@ void fprint_pos(VgFile *fp, const AddrPos* curr, const AddrPos* last)
 	VG_(fprintf)(fp, "%lu ", curr->addr - curr->bb_addr);
     else {
 	if (CLG_(clo).dump_instr) {
-	    int diff = curr->addr - last->addr;
+	    Long diff = (Long)curr->addr - (Long)last->addr;
 	    if ( CLG_(clo).compress_pos && (last->addr >0) && 
-		 (diff > -100) && (diff < 100)) {
-		if (diff >0)
-		    VG_(fprintf)(fp, "+%d ", diff);
-		else if (diff==0)
-		    VG_(fprintf)(fp, "* ");
-	        else
-		    VG_(fprintf)(fp, "%d ", diff);
-	    }
+		 use_subpos(diff, 2 + num_digits(curr->addr, 16)))
+		fprint_subpos(fp, diff);
 	    else
 		VG_(fprintf)(fp, "%#lx ", curr->addr);
 	}
 
 	if (CLG_(clo).dump_bb) {
-	    int diff = curr->bb_addr - last->bb_addr;
+	    Long diff = (Long)curr->bb_addr - (Long)last->bb_addr;
 	    if ( CLG_(clo).compress_pos && (last->bb_addr >0) && 
-		 (diff > -100) && (diff < 100)) {
-		if (diff >0)
-		    VG_(fprintf)(fp, "+%d ", diff);
-		else if (diff==0)
-		    VG_(fprintf)(fp, "* ");
-	        else
-		    VG_(fprintf)(fp, "%d ", diff);
-	    }
+		 use_subpos(diff, 2 + num_digits(curr->bb_addr, 16)))
+		fprint_subpos(fp, diff);
 	    else
 		VG_(fprintf)(fp, "%#lx ", curr->bb_addr);
 	}
 
 	if (CLG_(clo).dump_line) {
-	    int diff = curr->line - last->line;
-	    if ( CLG_(clo).compress_pos && (last->line >0) && 
-		 (diff > -100) && (diff < 100)) {
-
-		if (diff >0)
-		    VG_(fprintf)(fp, "+%d ", diff);
-		else if (diff==0)
-		    VG_(fprintf)(fp, "* ");
-	        else
-		    VG_(fprintf)(fp, "%d ", diff);
-	    }
+	    Long diff = (Long)curr->line - (Long)last->line;
+	    if ( CLG_(clo).compress_pos && (last->line >0) &&
+		 use_subpos(diff, num_digits(curr->line, 10)))
+		fprint_subpos(fp, diff);
 	    else
 		VG_(fprintf)(fp, "%u ", curr->line);
 	}
@@ -523,12 +540,63 @@ void fprint_pos(VgFile *fp, const AddrPos* curr, const AddrPos* last)
  * Print events.
  */
 
+/* Append the decimal digits of v at p; returns the end. */
+static HChar* put_ULong(HChar* p, ULong v)
+{
+  HChar tmp[20];
+  Int n = 0;
+
+  do {
+    tmp[n++] = '0' + (HChar)(v % 10);
+    v /= 10;
+  } while (v > 0);
+  while (n > 0)
+    *p++ = tmp[--n];
+  return p;
+}
+
+/* Buffer for a cost line, grown to fit the largest event mapping */
+static HChar* cost_buf = 0;
+static Int    cost_buf_size = 0;
+
+/* Same output as CLG_(mappingcost_as_string), but built in a buffer that
+ * is reused: this is called for every cost line of a dump, and the heap
+ * traffic of the XArray and string copies dominated large dumps. */
 static
 void fprint_cost(VgFile *fp, const EventMapping* es, const ULong* cost)
 {
-  HChar *mcost = CLG_(mappingcost_as_string)(es, cost);
-  VG_(fprintf)(fp, "%s\n", mcost);
-  CLG_FREE(mcost);
+  Int i, needed, skipped = 0;
+  HChar* p;
+
+  if (!cost || es->size == 0) {
+    VG_(fprintf)(fp, "\n");
+    return;
+  }
+
+  /* Up to 20 digits and a space per event, the newline and the 0 */
+  needed = es->size * 21 + 2;
+  if (needed > cost_buf_size) {
+    cost_buf = VG_(realloc)("cl.dump.fc.1", cost_buf, needed);
+    cost_buf_size = needed;
+  }
+  p = put_ULong(cost_buf, cost[es->entry[0].offset]);
+
+  for(i=1; i<es->size; i++) {
+    if (cost[es->entry[i].offset] == 0) {
+      skipped++;
+      continue;
+    }
+    while(skipped>0) {
+      *p++ = ' ';
+      *p++ = '0';
+      skipped--;
+    }
+    *p++ = ' ';
+    p = put_ULong(p, cost[es->entry[i].offset]);
+  }
+  *p++ = '\n';
+  *p = 0;
+  VG_(fprintf)(fp, "%s", cost_buf);
 }
 
 
@@ -1485,8 +1553,13 @@ void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 
    out_counter++;
 
+   /* The dump resets the counters snapshots are taken from */
+   CLG_(take_snapshot)();
+
    print_bbccs(trigger, only_current_thread);
 
+   CLG_(rebase_snapshots)();
+
    bbs_done = CLG_(stat).bb_executions++;
 
    if (VG_(clo_verbosity) > 1)
@@ -1545,6 +1618,64 @@ void init_cmdbuf(void)
   cmdbuf[size] = '\0';
 }
 
+/* Write the snapshots kept to <out_file>.snapshots, one part each.
+ * Every part only has the instructions executed per function in the
+ * snapshot interval, at line 0 of the function's file. */
+void CLG_(dump_snapshots)(void)
+{
+    Int i, n = CLG_(snapshot_count)();
+    UInt e;
+    VgFile *fp;
+
+    if (CLG_(clo).snapshot_every == 0) return;
+
+    VG_(sprintf)(filename, "%s.snapshots", out_file);
+    fp = VG_(fopen)(filename, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+		    VKI_S_IRUSR|VKI_S_IWUSR);
+    if (fp == NULL) {
+	file_err();
+	return;
+    }
+
+    init_dump_array();
+
+    VG_(fprintf)(fp, "version: 1\n");
+    VG_(fprintf)(fp, "creator: callgrind-" VERSION "\n");
+    VG_(fprintf)(fp, "pid: %d\n", VG_(getpid)());
+    VG_(fprintf)(fp, "cmd: %s\n", cmdbuf);
+
+    for(i=0; i<n; i++) {
+	Snapshot* s = CLG_(get_snapshot)(i);
+
+	VG_(fprintf)(fp, "\npart: %d\n", i+1);
+	VG_(fprintf)(fp, "desc: Timerange: Basic block %llu - %llu\n",
+		     s->bb_first, s->bb_last);
+	VG_(fprintf)(fp, "desc: Trigger: Snapshot at %u ms\n", s->time_ms);
+	if (i == 0 && CLG_(snapshots_dropped)() > 0)
+	    VG_(fprintf)(fp, "desc: Snapshots dropped before: %llu\n",
+			 CLG_(snapshots_dropped)());
+	VG_(fprintf)(fp, "\npositions: line\n");
+	VG_(fprintf)(fp, "events: Ir\n");
+	VG_(fprintf)(fp, "summary: %llu\n\n", s->ir);
+
+	for(e=0; e<s->entries; e++) {
+	    fn_node* fn = s->entry[e].fn;
+	    print_obj(fp, "ob=", fn->file->obj);
+	    print_file(fp, "fl=", fn->file);
+	    print_fn(fp, "fn", fn);
+	    VG_(fprintf)(fp, "0 %llu\n", s->entry[e].ir);
+	}
+	VG_(fprintf)(fp, "\ntotals: %llu\n", s->ir);
+    }
+
+    free_dump_array();
+    VG_(fclose)(fp);
+
+    if (VG_(clo_verbosity) > 1)
+	VG_(message)(Vg_DebugMsg, "%d snapshots written to %s\n",
+		     n, filename);
+}
+
 /*
  * Set up file names for dump output: <out_file>.
  * <out_file> is derived from the output format string, which defaults
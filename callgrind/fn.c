@@ -370,6 +370,8 @@ fn_node* new_fn_node(const HChar *fnname,
     fn->verbosity    = -1;
 #endif
 
+    fn->snap_sum     = 0;
+
     if (CLG_(stat).distinct_fns >= current_fn_active.size)
 	resize_fn_array();
 
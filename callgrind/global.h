@@ -60,10 +60,6 @@
 /* Enable experimental features? */
 #define CLG_EXPERIMENTAL 0
 
-/* Syscall Timing in microseconds? 
- * (define to 0 if you get compile errors) */
-#define CLG_MICROSYSTIME 0
-
 
 
 /*------------------------------------------------------------*/
@@ -72,6 +68,13 @@
 
 #define DEFAULT_OUTFORMAT   "callgrind.out.%p"
 
+/* Units of system call times with --collect-systime */
+typedef enum {
+  systime_no,
+  systime_msec,
+  systime_usec
+} Collect_Systime;
+
 typedef struct _CommandLineOptions CommandLineOptions;
 struct _CommandLineOptions {
 
@@ -90,6 +93,8 @@ struct _CommandLineOptions {
   
   /* Dump generation options */
   ULong dump_every_bb;     /* Dump every xxx BBs. */
+  Int   snapshot_every;    /* Snapshot every xxx ms (0: never) */
+  Int   snapshot_ring;     /* Number of snapshots kept */
   
   /* Collection options */
   Bool separate_threads; /* Separate threads in dump? */
@@ -102,7 +107,7 @@ struct _CommandLineOptions {
   Bool collect_jumps;    /* Collect (cond.) jumps in functions ? */
 
   Bool collect_alloc;    /* Collect size of allocated memory */
-  Bool collect_systime;  /* Collect time for system calls */
+  Collect_Systime collect_systime; /* Collect time for system calls */
 
   Bool collect_bus;      /* Collect global bus events */
 
@@ -380,6 +385,8 @@ struct _BBCC {
     BBCC*    next;         /* entry chain in hash */
     ULong*   cost;         /* start of 64bit costs for this BBCC */
     ULong    ecounter_sum; /* execution counter for first instruction of BB */
+    UInt     snap_epoch;   /* last snapshot interval this BBCC ran in */
+    ULong    snap_ir;      /* instructions executed at the last snapshot */
     JmpData  jmp[0];
 };
 
@@ -413,6 +420,9 @@ struct _fn_node {
 #if CLG_ENABLE_DEBUG
   Int  verbosity; /* Stores old verbosity level while in function */
 #endif
+
+  /* for snapshots: instructions in the interval being snapshotted */
+  ULong snap_sum;
 };
 
 /* Quite arbitrary fixed hash sizes */
@@ -617,6 +627,23 @@ struct _FnPos {
     UInt line;
 };
 
+/* Instructions executed by a function in a snapshot interval */
+typedef struct _SnapEntry SnapEntry;
+struct _SnapEntry {
+    fn_node* fn;
+    ULong ir;
+};
+
+/* A snapshot (--snapshot-every): only functions that ran have entries */
+typedef struct _Snapshot Snapshot;
+struct _Snapshot {
+    UInt time_ms;               /* millisecond timer when taken */
+    ULong bb_first, bb_last;    /* interval in executed BBs */
+    ULong ir;                   /* sum over the entries */
+    UInt entries;
+    SnapEntry* entry;
+};
+
 /*------------------------------------------------------------*/
 /*--- Cache simulator interface                            ---*/
 /*------------------------------------------------------------*/
@@ -772,6 +799,17 @@ void CLG_(run_post_signal_on_call_stack_bottom)(void);
 
 /* from dump.c */
 void CLG_(init_dumps)(void);
+void CLG_(dump_snapshots)(void);
+
+/* from snapshot.c */
+void CLG_(init_snapshots)(void);
+void CLG_(take_snapshot)(void);
+void CLG_(rebase_snapshots)(void);
+void CLG_(snapshot_touch)(BBCC* bbcc);
+void CLG_(check_snapshot)(void);
+Int CLG_(snapshot_count)(void);
+ULong CLG_(snapshots_dropped)(void);
+Snapshot* CLG_(get_snapshot)(Int i);
 
 /*------------------------------------------------------------*/
 /*--- Exported global variables                            ---*/
@@ -793,6 +831,8 @@ extern ThreadId   CLG_(current_tid);
 extern FullCost   CLG_(total_cost);
 extern struct cachesim_if CLG_(cachesim);
 extern struct event_sets  CLG_(sets);
+/* current snapshot interval, 0 without --snapshot-every */
+extern UInt   CLG_(snap_epoch);
 
 // set by setup_bbcc at start of every BB, and needed by log_* helpers
 extern Addr   CLG_(bb_base);
@@ -1406,7 +1406,10 @@ static void zero_thread_cost(thread_info* t)
     CLG_(current_call_stack).entry[i].jcc->call_counter = 0;
   }
 
-  CLG_(forall_bbccs)(CLG_(zero_bbcc));
+  /* Without --separate-threads, the BBCCs of all threads are the ones
+   * of thread 1: zero_all_cost() zeroes them only once */
+  if (CLG_(clo).separate_threads)
+    CLG_(forall_bbccs)(CLG_(zero_bbcc));
 
   /* set counter for last dump */
   CLG_(copy_cost)( CLG_(sets).full, 
@@ -1418,11 +1421,18 @@ void CLG_(zero_all_cost)(Bool only_current_thread)
   if (VG_(clo_verbosity) > 1)
     VG_(message)(Vg_DebugMsg, "  Zeroing costs...\n");
 
+  CLG_(take_snapshot)();
+
   if (only_current_thread)
     zero_thread_cost(CLG_(get_current_thread)());
   else
     CLG_(forall_threads)(zero_thread_cost);
 
+  if (!CLG_(clo).separate_threads)
+    CLG_(forall_bbccs)(CLG_(zero_bbcc));
+
+  CLG_(rebase_snapshots)();
+
   if (VG_(clo_verbosity) > 1)
     VG_(message)(Vg_DebugMsg, "  ...done\n");
 }
@@ -1701,50 +1711,44 @@ Bool CLG_(handle_client_request)(ThreadId tid, UWord *args, UWord *ret)
 
 /* Syscall Timing */
 
-/* struct timeval syscalltime[VG_N_THREADS]; */
-#if CLG_MICROSYSTIME
-ULong *syscalltime;
-#else
-UInt *syscalltime;
-#endif
+/* Wall clock time at start of the syscall running in a thread,
+ * in the unit given by --collect-systime */
+static ULong *syscalltime;
+
+static
+ULong collect_time(void)
+{
+  struct vki_timeval tv_now;
+
+  if (CLG_(clo).collect_systime == systime_msec)
+    return VG_(read_millisecond_timer)();
+
+  VG_(gettimeofday)(&tv_now, NULL);
+  return tv_now.tv_sec * 1000000ULL + tv_now.tv_usec;
+}
 
 static
 void CLG_(pre_syscalltime)(ThreadId tid, UInt syscallno,
                            UWord* args, UInt nArgs)
 {
-  if (CLG_(clo).collect_systime) {
-#if CLG_MICROSYSTIME
-    struct vki_timeval tv_now;
-    VG_(gettimeofday)(&tv_now, NULL);
-    syscalltime[tid] = tv_now.tv_sec * 1000000ULL + tv_now.tv_usec;
-#else
-    syscalltime[tid] = VG_(read_millisecond_timer)();
-#endif
-  }
+  if (CLG_(clo).collect_systime != systime_no)
+    syscalltime[tid] = collect_time();
 }
 
 static
 void CLG_(post_syscalltime)(ThreadId tid, UInt syscallno,
                             UWord* args, UInt nArgs, SysRes res)
 {
-  if (CLG_(clo).collect_systime &&
+  if (CLG_(clo).collect_systime != systime_no &&
       CLG_(current_state).bbcc) {
-      Int o;
-#if CLG_MICROSYSTIME
-    struct vki_timeval tv_now;
-    ULong diff;
-    
-    VG_(gettimeofday)(&tv_now, NULL);
-    diff = (tv_now.tv_sec * 1000000ULL + tv_now.tv_usec) - syscalltime[tid];
-#else
-    UInt diff = VG_(read_millisecond_timer)() - syscalltime[tid];
-#endif  
+    Int o;
+    ULong diff = collect_time() - syscalltime[tid];
 
     /* offset o is for "SysCount", o+1 for "SysTime" */
     o = fullOffset(EG_SYS);
     CLG_ASSERT(o>=0);
     CLG_DEBUG(0,"   Time (Off %d) for Syscall %u: %llu\n", o, syscallno,
-              (ULong)diff);
+              diff);
     
     CLG_(current_state).cost[o] ++;
     CLG_(current_state).cost[o+1] += diff;
@@ -1891,6 +1895,7 @@ void finish(void)
   CLG_(forall_threads)(unwind_thread);
 
   CLG_(dump_profile)(0, False);
+  CLG_(dump_snapshots)();
 
   if (VG_(clo_verbosity) == 0) return;
   
@@ -2020,6 +2025,7 @@ void CLG_(post_clo_init)(void)
    CLG_(init_bb_hash)();
 
    CLG_(init_threads)();
+   CLG_(init_snapshots)();
    CLG_(run_thread)(1);
 
    CLG_(instrument_state) = CLG_(clo).instrument_atstart;
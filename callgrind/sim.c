@@ -1627,7 +1627,7 @@ void CLG_(init_eventsets)()
     if (CLG_(clo).collect_alloc)
 	CLG_(register_event_group2)(EG_ALLOC, "allocCount", "allocSize");
 
-    if (CLG_(clo).collect_systime)
+    if (CLG_(clo).collect_systime != systime_no)
 	CLG_(register_event_group2)(EG_SYS, "sysCount", "sysTime");
 
     // event set used as base for instruction self cost
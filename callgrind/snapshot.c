@@ -0,0 +1,227 @@
+/*--------------------------------------------------------------------*/
+/*--- Callgrind                                                    ---*/
+/*---                                                   snapshot.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Callgrind, a Valgrind tool for call tracing.
+
+   Copyright (C) 2002-2015, Josef Weidendorfer (Josef.Weidendorfer@gmx.de)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+#include "pub_tool_libcproc.h"
+
+/* Interval snapshots (--snapshot-every=<ms>)
+ *
+ * A snapshot holds the instructions executed by each function since
+ * the previous snapshot.  Unlike a dump, taking one neither writes nor
+ * resets anything.  Each BBCC keeps the instructions it had executed at
+ * the previous snapshot in snap_ir, so that its contribution to a
+ * snapshot is the difference to what its execution counters give now.
+ *
+ * Only the BBCCs that ran since the previous snapshot need to be looked
+ * at.  The first time a BBCC runs in a snapshot interval, setup_bbcc
+ * finds that its snap_epoch is not the current one, and adds it to the
+ * list of touched BBCCs.  So the cost of a snapshot is proportional to
+ * the code that ran in the interval, not to all code ever run.  Only
+ * functions that ran get an entry.  The last --snapshot-ring snapshots
+ * are kept, and written at program termination by CLG_(dump_snapshots).
+ *
+ * Dumps and zeroing reset the execution counters, so a snapshot is
+ * taken before them and snap_ir is taken anew afterwards.
+ */
+
+UInt CLG_(snap_epoch) = 0;
+
+static Snapshot* ring = 0;
+static Int       ring_next = 0;    /* slot for the next snapshot */
+static Int       ring_used = 0;
+static ULong     snapshots_dropped = 0;
+
+static UInt  last_time = 0;
+static ULong last_bb   = 0;
+
+/* BBCCs that ran in the current snapshot interval */
+static XArray* touched_bbccs = 0;
+/* BBCCs with a nonzero snap_ir */
+static XArray* based_bbccs = 0;
+/* Functions with a nonzero snap_sum while taking a snapshot */
+static XArray* walked_fns = 0;
+
+/* Instructions executed in a BBCC, from its execution counters */
+static ULong bbcc_ir(BBCC* bbcc)
+{
+    BB* bb = bbcc->bb;
+    ULong ecounter = bbcc->ecounter_sum;
+    ULong ir = 0;
+    UInt instr, jmp = 0;
+
+    for(instr=0; instr<bb->instr_count; instr++) {
+	ir += ecounter;
+	if (jmp < bb->cjmp_count && bb->jmp[jmp].instr == instr) {
+	    ecounter -= bbcc->jmp[jmp].ecounter;
+	    jmp++;
+	}
+    }
+    return ir;
+}
+
+static void set_base(BBCC* bbcc, ULong ir)
+{
+    if (bbcc->snap_ir == 0 && ir > 0)
+	VG_(addToXA)(based_bbccs, &bbcc);
+    bbcc->snap_ir = ir;
+}
+
+/* Called from setup_bbcc the first time a BBCC runs in an interval */
+void CLG_(snapshot_touch)(BBCC* bbcc)
+{
+    bbcc->snap_epoch = CLG_(snap_epoch);
+    VG_(addToXA)(touched_bbccs, &bbcc);
+}
+
+/* Sum the instructions of each function over the touched BBCCs */
+static void sum_touched_bbccs(void)
+{
+    Word i;
+
+    VG_(dropTailXA)(walked_fns, VG_(sizeXA)(walked_fns));
+
+    for(i=0; i<VG_(sizeXA)(touched_bbccs); i++) {
+	BBCC* bbcc = *(BBCC**)VG_(indexXA)(touched_bbccs, i);
+	fn_node* fn = bbcc->cxt->fn[0];
+	ULong ir = bbcc_ir(bbcc);
+
+	CLG_ASSERT(ir >= bbcc->snap_ir);
+	if (ir == bbcc->snap_ir) continue;
+	if (fn->snap_sum == 0)
+	    VG_(addToXA)(walked_fns, &fn);
+	fn->snap_sum += ir - bbcc->snap_ir;
+	set_base(bbcc, ir);
+    }
+    VG_(dropTailXA)(touched_bbccs, VG_(sizeXA)(touched_bbccs));
+
+    /* A new interval starts; 0 is never a valid one */
+    CLG_(snap_epoch)++;
+    if (CLG_(snap_epoch) == 0)
+	CLG_(snap_epoch) = 1;
+}
+
+void CLG_(init_snapshots)(void)
+{
+    if (CLG_(clo).snapshot_every == 0) return;
+
+    ring = (Snapshot*) CLG_MALLOC("cl.snapshot.is.1",
+				  CLG_(clo).snapshot_ring * sizeof(Snapshot));
+    walked_fns = VG_(newXA)(VG_(malloc), "cl.snapshot.is.2", VG_(free),
+			    sizeof(fn_node*));
+    touched_bbccs = VG_(newXA)(VG_(malloc), "cl.snapshot.is.3", VG_(free),
+			       sizeof(BBCC*));
+    based_bbccs = VG_(newXA)(VG_(malloc), "cl.snapshot.is.4", VG_(free),
+			     sizeof(BBCC*));
+    CLG_(snap_epoch) = 1;
+    last_time = VG_(read_millisecond_timer)();
+}
+
+void CLG_(take_snapshot)(void)
+{
+    Snapshot* s;
+    Word i, n;
+
+    if (!ring) return;
+
+    sum_touched_bbccs();
+
+    /* Reuse the oldest slot when the ring is full */
+    s = &ring[ring_next];
+    if (ring_used == CLG_(clo).snapshot_ring) {
+	VG_(free)(s->entry);
+	snapshots_dropped++;
+    }
+    else
+	ring_used++;
+    ring_next = (ring_next + 1) % CLG_(clo).snapshot_ring;
+
+    n = VG_(sizeXA)(walked_fns);
+    s->time_ms  = VG_(read_millisecond_timer)();
+    s->bb_first = last_bb;
+    s->bb_last  = CLG_(stat).bb_executions;
+    s->ir       = 0;
+    s->entries  = 0;
+    s->entry    = (n == 0) ? 0 :
+	(SnapEntry*) CLG_MALLOC("cl.snapshot.ts.1", n * sizeof(SnapEntry));
+
+    for(i=0; i<n; i++) {
+	fn_node* fn = *(fn_node**)VG_(indexXA)(walked_fns, i);
+	s->entry[s->entries].fn = fn;
+	s->entry[s->entries].ir = fn->snap_sum;
+	s->ir += fn->snap_sum;
+	s->entries++;
+	fn->snap_sum = 0;
+    }
+
+    last_time = s->time_ms;
+    last_bb   = s->bb_last;
+}
+
+/* Take snap_ir anew after execution counters were reset.  A snapshot
+ * was taken just before, so no BBCC has run since. */
+void CLG_(rebase_snapshots)(void)
+{
+    Word i, n = 0;
+
+    if (!ring) return;
+
+    CLG_ASSERT(VG_(sizeXA)(touched_bbccs) == 0);
+    for(i=0; i<VG_(sizeXA)(based_bbccs); i++) {
+	BBCC* bbcc = *(BBCC**)VG_(indexXA)(based_bbccs, i);
+	bbcc->snap_ir = bbcc_ir(bbcc);
+	if (bbcc->snap_ir > 0)
+	    *(BBCC**)VG_(indexXA)(based_bbccs, n++) = bbcc;
+    }
+    VG_(dropTailXA)(based_bbccs, VG_(sizeXA)(based_bbccs) - n);
+}
+
+/* Called from CLG_(run_thread), ie. when the scheduler runs */
+void CLG_(check_snapshot)(void)
+{
+    if (VG_(read_millisecond_timer)() - last_time >= CLG_(clo).snapshot_every)
+	CLG_(take_snapshot)();
+}
+
+Int CLG_(snapshot_count)(void)
+{
+    return ring_used;
+}
+
+ULong CLG_(snapshots_dropped)(void)
+{
+    return snapshots_dropped;
+}
+
+/* The i-th snapshot kept, the oldest first */
+Snapshot* CLG_(get_snapshot)(Int i)
+{
+    CLG_ASSERT(i >= 0 && i < ring_used);
+    return &ring[(ring_next - ring_used + i + CLG_(clo).snapshot_ring)
+		 % CLG_(clo).snapshot_ring];
+}
@@ -192,6 +192,9 @@ void CLG_(run_thread)(ThreadId tid)
        }
     }
 
+    if (CLG_(clo).snapshot_every >0)
+       CLG_(check_snapshot)();
+
     /* now check for thread switch */
     CLG_(switch_thread)(tid);
 }
@@ -203,6 +203,13 @@ SysRes ML_(am_do_munmap_NO_NOTIFY)(Addr start, SizeT length)
    return VG_(do_syscall2)(__NR_munmap, (UWord)start, length );
 }
 
+#if defined(VGO_linux)
+SysRes ML_(am_do_madvise_NO_NOTIFY)(Addr start, SizeT length, Int advice)
+{
+   return VG_(do_syscall3)(__NR_madvise, (UWord)start, length, advice );
+}
+#endif
+
 #if HAVE_MREMAP
 /* The following are used only to implement mremap(). */
 
@@ -319,6 +319,58 @@ Addr VG_(clo_aspacem_minAddr)
 #else
 #endif
 
+Bool VG_(clo_hugepages) = False;
+
+#if defined(VGO_linux)
+// With --hugepages=yes, the anonymous mappings of V of at least the
+// size of a transparent huge page are aligned on it and marked as worth
+// backing with huge pages.  The size depends on the platform (2MB on
+// amd64 and on arm64 with 4K pages, 16MB on ppc64 with the hash MMU,
+// 512MB on arm64 with 64K pages), so it is read from the kernel on
+// first use.  Huge pages bigger than AM_HUGEPAGE_MAX_SZB are not used,
+// as aligning the mappings on them would waste too much address space.
+#define AM_HUGEPAGE_MAX_SZB (32 * 1024 * 1024)
+
+// The transparent huge page size, or 0 if huge pages are not used.
+static SizeT am_hugepage_szB ( void )
+{
+   static Bool  done = False;
+   static SizeT szB  = 0;
+   HChar  buf[32];
+   Int    fd, n, i;
+   SysRes res;
+
+   if (done)
+      return szB;
+   done = True;
+   if (!VG_(clo_hugepages))
+      return 0;
+
+   res = ML_(am_open)( "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size",
+                       VKI_O_RDONLY, 0 );
+   if (sr_isError(res)) {
+      VG_(debugLog)(1, "aspacem", "--hugepages=yes: no transparent "
+                    "huge pages, ignored\n");
+      return 0;
+   }
+   fd = sr_Res(res);
+   n = ML_(am_read)( fd, buf, sizeof(buf) - 1 );
+   ML_(am_close)( fd );
+
+   for (i = 0; i < n && buf[i] >= '0' && buf[i] <= '9'; i++)
+      szB = szB * 10 + (buf[i] - '0');
+   if (szB < VKI_PAGE_SIZE || (szB & (szB - 1)) != 0
+       || szB > AM_HUGEPAGE_MAX_SZB) {
+      VG_(debugLog)(1, "aspacem", "--hugepages=yes: huge page size %lu "
+                    "not used\n", szB);
+      szB = 0;
+   } else {
+      VG_(debugLog)(1, "aspacem", "huge page size %lu\n", szB);
+   }
+   return szB;
+}
+#endif
+
 
 // The smallest address that aspacem will try to allocate
 static Addr aspacem_minAddr = 0;
@@ -2559,18 +2611,32 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
    Addr       advised;
    Bool       ok;
    MapRequest req;
+   SizeT      hp_szB;
+   Bool       huge;
  
    /* Not allowable. */
    if (length == 0)
       return VG_(mk_SysRes_Error)( VKI_EINVAL );
 
-   /* Ask for an advisory.  If it's negative, fail immediately. */
+#  if defined(VGO_linux)
+   hp_szB = am_hugepage_szB();
+#  else
+   hp_szB = 0;
+#  endif
+   huge = hp_szB > 0 && length >= hp_szB;
+
+   /* Ask for an advisory.  If it's negative, fail immediately.
+      For a huge page backed mapping, ask for a hole big enough to
+      place the mapping at the next huge page boundary: the kernel
+      can only use huge pages for the aligned parts of a mapping. */
    req.rkind = MAny;
    req.start = 0;
-   req.len   = length;
+   req.len   = huge ? length + hp_szB : length;
    advised = VG_(am_get_advisory)( &req, False/*forClient*/, &ok );
    if (!ok)
       return VG_(mk_SysRes_Error)( VKI_EINVAL );
+   if (huge)
+      advised = VG_ROUNDUP(advised, hp_szB);
 
 // On Darwin, for anonymous maps you can pass in a tag which is used by
 // programs like vmmap for statistical purposes.
@@ -2641,15 +2707,48 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
    seg.hasX  = True;
    add_segment( &seg );
 
+#  if defined(VGO_linux)
+   /* Only advice: kernels without transparent huge pages fail it,
+      and the mapping is then backed by normal pages. */
+   if (huge)
+      (void)ML_(am_do_madvise_NO_NOTIFY)( seg.start, seg.end - seg.start + 1,
+                                          VKI_MADV_HUGEPAGE );
+#  endif
+
    AM_SANITY_CHECK;
    return sres;
 }
 
-/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
+/* Really just a wrapper around VG_(am_mmap_anon_float_valgrind).
+   With --hugepages=yes, small areas are carved out of huge page
+   backed chunks, as a mapping smaller than a huge page can't be backed
+   by one.  A part of a chunk can still be given back with
+   VG_(am_munmap_valgrind). */
 
 void* VG_(am_shadow_alloc)(SizeT size)
 {
-   SysRes sres = VG_(am_mmap_anon_float_valgrind)( size );
+   SysRes sres;
+
+#  if defined(VGO_linux)
+   static Addr chunk_next = 0;
+   static Addr chunk_end  = 0;
+   SizeT hp_szB = am_hugepage_szB();
+
+   if (hp_szB > 0 && size < hp_szB) {
+      size = VG_PGROUNDUP(size);
+      if (chunk_end - chunk_next < size) {
+         sres = VG_(am_mmap_anon_float_valgrind)( hp_szB );
+         if (sr_isError(sres))
+            return NULL;
+         chunk_next = sr_Res(sres);
+         chunk_end  = chunk_next + hp_szB;
+      }
+      chunk_next += size;
+      return (void*)(chunk_next - size);
+   }
+#  endif
+
+   sres = VG_(am_mmap_anon_float_valgrind)( size );
    return sr_isError(sres) ? NULL : (void*)sr_Res(sres);
 }
 
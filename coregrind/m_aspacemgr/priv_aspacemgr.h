@@ -94,6 +94,12 @@ extern UInt   ML_(am_sprintf) ( HChar* buf, const HChar *format, ... );
 /* wrapper for munmap */
 extern SysRes ML_(am_do_munmap_NO_NOTIFY)(Addr start, SizeT length);
 
+#if defined(VGO_linux)
+/* wrapper for madvise */
+extern SysRes ML_(am_do_madvise_NO_NOTIFY)(Addr start, SizeT length,
+                                            Int advice);
+#endif
+
 /* wrapper for the ghastly 'mremap' syscall */
 extern SysRes ML_(am_do_extend_mapping_NO_NOTIFY)( 
                  Addr  old_addr, 
@@ -940,6 +940,64 @@ UInt VG_(random)( /*MOD*/UInt* pSeed )
    return *pSeed;
 }
 
+// ln(x) for x > 0, and exp(-x) for x >= 0, precise enough for sampling.
+static double sample_ln ( double x )
+{
+   Int    e = 0, i;
+   double y, y2, term, sum = 0.0;
+
+   while (x >= 2.0) { x /= 2.0; e++; }
+   while (x <  1.0) { x *= 2.0; e--; }
+   // ln(x) = 2 atanh(y) for y = (x-1)/(x+1), and here 0 <= y < 1/3.
+   y  = (x - 1.0) / (x + 1.0);
+   y2 = y * y;
+   term = y;
+   for (i = 1; i < 30; i += 2) {
+      sum  += term / i;
+      term *= y2;
+   }
+   return 2.0 * sum + e * 0.69314718055994530942;
+}
+
+static double sample_exp_neg ( double x )
+{
+   Int    k = 0, i;
+   double term = 1.0, sum = 1.0;
+
+   if (x > 700.0)
+      return 0.0;
+   // exp(-x) = exp(-x/2^k) ^ (2^k), with x/2^k <= 1/2.
+   while (x > 0.5) { x /= 2.0; k++; }
+   for (i = 1; i < 14; i++) {
+      term *= -x / i;
+      sum  += term;
+   }
+   while (k-- > 0)
+      sum *= sum;
+   return sum;
+}
+
+SizeT VG_(heap_sample_gap) ( /*MOD*/UInt* pSeed, SizeT mean_szB )
+{
+   // u is uniform in (0, 1].
+   double u   = ((double)VG_(random)(pSeed) + 1.0) / 4294967296.0;
+   double gap = -sample_ln(u) * (double)mean_szB;
+
+   return (SizeT)gap + 1;
+}
+
+ULong VG_(heap_sample_weight) ( SizeT szB, SizeT mean_szB )
+{
+   double p;
+
+   if (szB == 0)
+      return VG_HEAP_SAMPLE_WEIGHT_ONE;
+   p = 1.0 - sample_exp_neg((double)szB / (double)mean_szB);
+   if (p <= 0.0)
+      return VG_HEAP_SAMPLE_WEIGHT_ONE;
+   return (ULong)((double)VG_HEAP_SAMPLE_WEIGHT_ONE / p + 0.5);
+}
+
 
 /* The following Adler-32 checksum code is taken from zlib-1.2.3, which
    has the following copyright notice. */
@@ -301,7 +301,9 @@ void VG_(vcbprintf)( void(*char_sink)(HChar, void* opaque),
 /* This is like [v]fprintf, except it writes to a file handle using
    VG_(write). */
 
-#define VGFILE_BUFSIZE  8192
+// Large enough that the multi-megabyte profiles written by the tools
+// take few write syscalls.
+#define VGFILE_BUFSIZE  65536
 
 struct _VgFile {
    HChar buf[VGFILE_BUFSIZE];
@@ -353,6 +355,13 @@ UInt VG_(fprintf) ( VgFile *fp, const HChar *format, ... )
    return ret;
 }
 
+void VG_(fflush)( VgFile *fp )
+{
+   if (fp->num_chars)
+      VG_(write)(fp->fd, fp->buf, fp->num_chars);
+   fp->num_chars = 0;
+}
+
 void VG_(fclose)( VgFile *fp )
 {
    // Flush the buffer.
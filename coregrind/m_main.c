@@ -196,6 +196,8 @@ static void usage_NORETURN ( Bool debug_help )
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
 "           basic block [0, meaning use tool provided default]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
+"    --hugepages=no|yes        back Valgrind's large mappings and shadow\n"
+"                              memory with huge pages (Linux only) [no]\n"
 "    --valgrind-stacksize=<number> size of valgrind (host) thread's stack\n"
 "                               (in bytes) ["
                                 VG_STRINGIFY(VG_DEFAULT_STACK_ACTIVE_SZB) 
@@ -558,6 +560,7 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
       else if VG_STREQN(20, arg, "--core-redzone-size=") {}
       else if VG_STREQN(15, arg, "--redzone-size=")      {}
       else if VG_STREQN(17, arg, "--aspace-minaddr=")    {}
+      else if VG_STREQN(12, arg, "--hugepages=")         {}
 
       else if VG_BINT_CLO(arg, "--valgrind-stacksize",
                           VG_(clo_valgrind_stacksize), 
@@ -1662,8 +1665,8 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
    /* Start the debugging-log system ASAP.  First find out how many 
       "-d"s were specified.  This is a pre-scan of the command line.  Also
       get --profile-heap=yes, --core-redzone-size, --redzone-size
-      --aspace-minaddr which are needed by the time we start up dynamic
-      memory management.  */
+      --aspace-minaddr --hugepages which are needed by the time we start
+      up dynamic memory management.  */
    loglevel = 0;
    for (i = 1; i < argc; i++) {
       const HChar* tmp_str;
@@ -1675,6 +1678,7 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
                      0, MAX_CLO_REDZONE_SZB) {}
       if VG_BINT_CLO(argv[i], "--redzone-size", VG_(clo_redzone_size),
                      0, MAX_CLO_REDZONE_SZB) {}
+      if VG_BOOL_CLO(argv[i], "--hugepages", VG_(clo_hugepages)) {}
       if VG_STR_CLO(argv[i], "--aspace-minaddr", tmp_str) {
          Bool ok = VG_(parse_Addr) (&tmp_str, &VG_(clo_aspacem_minAddr));
          if (!ok)
@@ -187,6 +187,25 @@ typedef
    }
    Superblock;
 
+// Blocks of the non-client arenas freed recently are kept in a cache
+// of TCACHE_DEPTH blocks per payload size (one class per
+// VG_MIN_MALLOC_SZB multiple up to TCACHE_MAX_PSZB), and given out again
+// by a malloc of the same size, without touching the freelists, nor
+// looking for the superblock of the block on free.  A cached block stays
+// an in-use Block (with the "admin.tcache" cost centre); its payload
+// holds the link to the next cached block of its class, so blocks with
+// a payload smaller than the link (class 0) are never cached.  When a
+// class is full, freed blocks spill back to the freelists.  Freeing a
+// block which is already in the cache is caught on free: the rest of a
+// cached payload keeps the 0xDD fill, and only then the class is searched.
+// All threads share the cache, as the big lock serialises all the
+// (de)allocations: per-thread caches would only make sense once
+// threads run concurrently.  The client arena is left out, so that
+// the layout of the client heap is unchanged.
+#define TCACHE_MAX_PSZB   256
+#define N_TCACHE_CLASSES  (TCACHE_MAX_PSZB / VG_MIN_MALLOC_SZB + 1)
+#define TCACHE_DEPTH      16
+
 // An arena. 'freelist' is a circular, doubly-linked list.  'rz_szB' is
 // elastic, in that it can be bigger than asked-for to ensure alignment.
 typedef
@@ -219,6 +238,12 @@ typedef
       Superblock*  sblocks_initial[SBLOCKS_SIZE_INITIAL];
       Superblock*  deferred_reclaimed_sb;
 
+      // Recently freed blocks, per size class (see above).  Requests of up
+      // to tcache_max_pszB bytes use the cache; 0 if the arena has none.
+      SizeT        tcache_max_pszB;
+      Block*       tcache[N_TCACHE_CLASSES];
+      UInt         tcache_n[N_TCACHE_CLASSES];
+
       // VG_(arena_perm_malloc) returns memory from superblocks
       // only used for permanent blocks. No overhead. These superblocks
       // are not stored in sblocks array above.
@@ -242,6 +267,8 @@ typedef
       // (in terms of stats__bytes_on_loan_max) ?
       SizeT        next_profile_at;
       SizeT        stats__bytes_mmaped_max;
+      ULong        stats__tcache_hits;
+      SizeT        stats__tcache_bytes; /* payload of cached blocks */
    }
    Arena;
 
@@ -600,6 +627,18 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->sblocks_size             = SBLOCKS_SIZE_INITIAL;
    a->sblocks_used             = 0;
    a->deferred_reclaimed_sb    = 0;
+   // A cached block must not be in an unsplittable superblock, as the
+   // superblock is not looked for when freeing the block to the cache.
+   if (VG_AR_CLIENT != aid
+       && pszB_to_bszB(a, TCACHE_MAX_PSZB) + sizeof(Superblock)
+          < min_unsplittable_sblock_szB)
+      a->tcache_max_pszB       = TCACHE_MAX_PSZB;
+   else
+      a->tcache_max_pszB       = 0;
+   for (i = 0; i < N_TCACHE_CLASSES; i++) {
+      a->tcache[i]   = NULL;
+      a->tcache_n[i] = 0;
+   }
    a->perm_malloc_current      = 0;
    a->perm_malloc_limit        = 0;
    a->stats__perm_bytes_on_loan= 0;
@@ -613,6 +652,8 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->stats__tot_blocks        = 0;
    a->stats__tot_bytes         = 0;
    a->stats__nsearches         = 0;
+   a->stats__tcache_hits       = 0;
+   a->stats__tcache_bytes      = 0;
    a->next_profile_at          = 25 * 1000 * 1000;
    vg_assert(sizeof(a->sblocks_initial) 
              == SBLOCKS_SIZE_INITIAL * sizeof(Superblock*));
@@ -629,7 +670,7 @@ void VG_(print_all_arena_stats) ( void )
                    "%llu/%llu unsplit/split sb unmmap'd,  "
                    "%'13lu/%'13lu max/curr,  "
                    "%10llu/%10llu totalloc-blocks/bytes,"
-                   "  %10llu searches %lu rzB\n",
+                   "  %10llu searches %10llu tcache-hits %lu rzB\n",
                    a->name,
                    a->stats__bytes_mmaped_max, a->stats__bytes_mmaped,
                    a->stats__nreclaim_unsplit, a->stats__nreclaim_split,
@@ -637,6 +678,7 @@ void VG_(print_all_arena_stats) ( void )
                    a->stats__bytes_on_loan,
                    a->stats__tot_blocks, a->stats__tot_bytes,
                    a->stats__nsearches,
+                   a->stats__tcache_hits,
                    a->rz_szB
       );
    }
@@ -1303,7 +1345,7 @@ static void sanity_check_malloc_arena ( ArenaId aid )
    Bool        thisFree, lastWasFree, sblockarrOK;
    Block*      b;
    Block*      b_prev;
-   SizeT       arena_bytes_on_loan;
+   SizeT       arena_bytes_on_loan, tcache_bytes;
    Arena*      a;
 
 #  define BOMB VG_(core_panic)("sanity_check_malloc_arena")
@@ -1359,6 +1401,36 @@ static void sanity_check_malloc_arena ( ArenaId aid )
 
    arena_bytes_on_loan += a->stats__perm_bytes_on_loan;
 
+   // Check the cached blocks, which the walk above counted as in use.
+   tcache_bytes = 0;
+   for (listno = 0; listno < N_TCACHE_CLASSES; listno++) {
+      j = 0;
+      for (b = a->tcache[listno]; b != NULL;
+           b = *(Block**)get_block_payload(a, b)) {
+         if (!is_inuse_block(b) || !blockSane(a, b)
+             || get_pszB(a, b) != listno * VG_MIN_MALLOC_SZB
+             || get_pszB(a, b) < sizeof(Block*)) {
+            VG_(printf)( "sanity_check_malloc_arena: tcache %u: "
+                         "BAD BLOCK %p\n", listno, b );
+            BOMB;
+         }
+         tcache_bytes += get_pszB(a, b);
+         j++;
+      }
+      if (j != a->tcache_n[listno] || j > TCACHE_DEPTH) {
+         VG_(printf)( "sanity_check_malloc_arena: tcache %u: "
+                      "%u blocks, %u expected\n", listno, j,
+                      a->tcache_n[listno] );
+         BOMB;
+      }
+   }
+   if (tcache_bytes != a->stats__tcache_bytes) {
+      VG_(printf)( "sanity_check_malloc_arena: tcache holds %lu bytes, "
+                   "%lu expected\n", tcache_bytes, a->stats__tcache_bytes );
+      BOMB;
+   }
+   arena_bytes_on_loan -= tcache_bytes;
+
    if (arena_bytes_on_loan != a->stats__bytes_on_loan) {
 #     ifdef VERBOSE_MALLOC
       VG_(printf)( "sanity_check_malloc_arena: a->bytes_on_loan %lu, "
@@ -1751,6 +1823,22 @@ void* VG_(arena_malloc) ( ArenaId aid, const HChar* cc, SizeT req_pszB )
    // this allocation; it isn't optional.
    vg_assert(cc);
 
+   // Reuse a recently freed block of the same size if there is one.
+   if (req_pszB <= a->tcache_max_pszB
+       && req_pszB >= sizeof(Block*)
+       && a->tcache[req_pszB / VG_MIN_MALLOC_SZB] != NULL) {
+      UInt cls = req_pszB / VG_MIN_MALLOC_SZB;
+      b = a->tcache[cls];
+      a->tcache[cls] = *(Block**)get_block_payload(a, b);
+      a->tcache_n[cls]--;
+      a->stats__tcache_bytes -= req_pszB;
+      a->stats__tcache_hits++;
+      if (VG_(clo_profile_heap))
+         set_cc(b, cc);
+      b_bszB = get_bszB(b);
+      goto allocated_block;
+   }
+
    // Scan through all the big-enough freelists for a block.
    //
    // Nb: this scanning might be expensive in some cases.  Eg. if you
@@ -1883,6 +1971,7 @@ void* VG_(arena_malloc) ( ArenaId aid, const HChar* cc, SizeT req_pszB )
          set_cc(b, cc);
    }
 
+  allocated_block:
    // Update stats
    SizeT loaned = bszB_to_pszB(a, b_bszB);
    add_one_block_to_stats (a, loaned);
@@ -2078,6 +2167,22 @@ static void mergeWithFreeNeighbours (Arena* a, Superblock* sb,
    }
 }
  
+// Is b, with payload ptr of b_pszB bytes, already in the cache of
+// class cls?  Blocks given out again have lost their 0xDD fill after
+// the link, so the class is only searched if the fill is still there.
+static
+Bool tcache_holds ( Arena* a, UInt cls, Block* b, UByte* ptr, SizeT b_pszB )
+{
+   Block* c;
+
+   if (b_pszB > sizeof(Block*) && ptr[b_pszB - 1] != 0xDD)
+      return False;
+   for (c = a->tcache[cls]; c != NULL; c = *(Block**)get_block_payload(a, c))
+      if (c == b)
+         return True;
+   return False;
+}
+
 void VG_(arena_free) ( ArenaId aid, void* ptr )
 {
    Superblock* sb;
@@ -2102,6 +2207,27 @@ void VG_(arena_free) ( ArenaId aid, void* ptr )
 
    b_bszB   = get_bszB(b);
    b_pszB   = bszB_to_pszB(a, b_bszB);
+
+   if (b_pszB <= a->tcache_max_pszB && b_pszB >= sizeof(Block*)) {
+      UInt cls = b_pszB / VG_MIN_MALLOC_SZB;
+      vg_assert2(!tcache_holds(a, cls, b, (UByte*)ptr, b_pszB),
+                 "VG_(arena_free): block %p of arena `%s' freed twice\n",
+                 ptr, a->name);
+      if (a->tcache_n[cls] < TCACHE_DEPTH) {
+         a->stats__bytes_on_loan -= b_pszB;
+         VG_(memset)(ptr, 0xDD, (SizeT)b_pszB);
+         INNER_REQUEST(VALGRIND_FREELIKE_BLOCK(ptr, 0));
+         INNER_REQUEST(VALGRIND_MAKE_MEM_UNDEFINED(ptr, sizeof(Block*)));
+         *(Block**)ptr = a->tcache[cls];
+         a->tcache[cls] = b;
+         a->tcache_n[cls]++;
+         a->stats__tcache_bytes += b_pszB;
+         if (VG_(clo_profile_heap))
+            set_cc(b, "admin.tcache");
+         return;
+      }
+   }
+
    sb       = findSb( a, b );
 
    a->stats__bytes_on_loan -= b_pszB;
@@ -32,6 +32,9 @@
 #include "pub_core_libcbase.h"
 #include "pub_core_libcprint.h"
 #include "pub_core_libcassert.h"
+#include "pub_core_clreq.h"           // VG_USERREQ__CLIENT_CALL*
+#include "pub_core_threadstate.h"     // VG_(threads), VG_(get_running_tid)
+#include "pub_core_machine.h"         // VG_CLREQ_RET
 #include "pub_core_tooliface.h"       // VG_(needs)
 #include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
@@ -112,6 +115,83 @@ Bool VG_(addr_is_in_block)( Addr a, Addr start, SizeT size, SizeT rz_szB )
    return ( start - rz_szB <= a  &&  a < start + size + rz_szB );
 }
 
+/*------------------------------------------------------------*/
+/*--- Calling the replacements from translated code        ---*/
+/*------------------------------------------------------------*/
+
+/* The replacements in vg_replace_malloc.c get to the tool with
+   VG_USERREQ__CLIENT_CALL[0-3] requests.  Handing each one to the
+   scheduler means leaving translated code, and costs far more than
+   the tool's allocator itself does.  So a block that ends in a client
+   request first calls VG_(client_call_fast_path), and only leaves for
+   the scheduler if that declines the request.
+
+   This is only done for tools which ask for it with
+   VG_(needs_direct_malloc_calls). */
+
+// Number of requests handled by VG_(client_call_fast_path)
+static ULong n_client_calls_fast = 0;
+
+static Bool is_malloc_replacement ( UWord f )
+{
+   return f == (UWord)VG_(tdict).tool_malloc
+       || f == (UWord)VG_(tdict).tool_calloc
+       || f == (UWord)VG_(tdict).tool_realloc
+       || f == (UWord)VG_(tdict).tool_memalign
+       || f == (UWord)VG_(tdict).tool___builtin_new
+       || f == (UWord)VG_(tdict).tool___builtin_vec_new
+       || f == (UWord)VG_(tdict).tool_free
+       || f == (UWord)VG_(tdict).tool___builtin_delete
+       || f == (UWord)VG_(tdict).tool___builtin_vec_delete
+       || f == (UWord)VG_(tdict).tool_malloc_usable_size;
+}
+
+/* 'arg' is the request's argument block.  If the request is a call of
+   one of the tool's malloc replacements, make the call as the
+   scheduler would, put the result in the thread's client request
+   return register, and return 1.  Otherwise return 0 and leave the
+   request alone. */
+VG_REGPARM(1)
+UWord VG_(client_call_fast_path) ( UWord* arg )
+{
+   ThreadId tid;
+   UWord    f = arg[1];
+   UWord    ret;
+
+   if (f == 0 || !is_malloc_replacement(f))
+      return 0;
+
+   tid = VG_(get_running_tid)();
+   vg_assert(VG_(is_running_thread)(tid));
+
+   switch (arg[0]) {
+      case VG_USERREQ__CLIENT_CALL1:
+         ret = ((UWord(*)(ThreadId, UWord))f)( tid, arg[2] );
+         break;
+      case VG_USERREQ__CLIENT_CALL2:
+         ret = ((UWord(*)(ThreadId, UWord, UWord))f)( tid, arg[2], arg[3] );
+         break;
+      case VG_USERREQ__CLIENT_CALL3:
+         ret = ((UWord(*)(ThreadId, UWord, UWord, UWord))f)
+                  ( tid, arg[2], arg[3], arg[4] );
+         break;
+      default:
+         return 0;
+   }
+
+   VG_(threads)[tid].arch.vex.VG_CLREQ_RET = ret;
+   n_client_calls_fast++;
+   return 1;
+}
+
+void VG_(print_replacemalloc_stats) ( void )
+{
+   if (VG_(needs).direct_malloc_calls)
+      VG_(message)(Vg_DebugMsg,
+                   "replacemalloc: %'llu direct calls of the replacements\n",
+                   n_client_calls_fast);
+}
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                          ---*/
 /*--------------------------------------------------------------------*/
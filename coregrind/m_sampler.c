@@ -0,0 +1,136 @@
+/*--------------------------------------------------------------------*/
+/*--- Sampling of superblock executions.               m_sampler.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2026 The Valgrind Developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_core_basics.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_machine.h"     // VG_(fnptr_to_fnentry)
+#include "pub_core_sampler.h"     /* self */
+
+
+/* See pub_tool_sampler.h for details of what this is all about. */
+
+#define SAMPLE_TAB_BITS  14
+#define SAMPLE_BURST_LEN 16
+
+typedef
+   struct {
+      UInt countdown;
+      UInt period;
+      UInt burst;
+   }
+   Sampler;
+
+static Sampler sampler_tab[1 << SAMPLE_TAB_BITS];
+
+static UInt  sample_rate = 1;
+static ULong stats__sample_yes = 0;
+static ULong stats__sample_no  = 0;
+
+void VG_(sampler_set_rate) ( UInt n )
+{
+   vg_assert(n >= 1);
+   sample_rate = n;
+}
+
+void VG_(sampler_stats) ( /*OUT*/ULong* sampled, /*OUT*/ULong* skipped )
+{
+   *sampled = stats__sample_yes;
+   *skipped = stats__sample_no;
+}
+
+/* Called from generated code at the start of each execution of a
+   sampled superblock.  Returns 1 if this execution is sampled and 0 if
+   not. */
+static VG_REGPARM(1)
+UWord sample_sb ( UWord ix )
+{
+   Sampler* s = &sampler_tab[ix];
+   if (s->countdown > 0) {
+      s->countdown--;
+      stats__sample_no++;
+      return 0;
+   }
+   if (++s->burst >= SAMPLE_BURST_LEN && s->period + 1 < sample_rate) {
+      s->burst  = 0;
+      s->period = 2 * s->period + 1;
+      if (s->period >= sample_rate)
+         s->period = sample_rate - 1;
+   }
+   s->countdown = s->period;
+   stats__sample_yes++;
+   return 1;
+}
+
+Bool VG_(sb_accesses_memory) ( const IRSB* bb )
+{
+   Int i;
+   for (i = 0; i < bb->stmts_used; i++) {
+      const IRStmt* st = bb->stmts[i];
+      switch (st->tag) {
+         case Ist_Store: case Ist_StoreG: case Ist_LoadG:
+         case Ist_CAS: case Ist_LLSC:
+            return True;
+         case Ist_WrTmp:
+            if (st->Ist.WrTmp.data->tag == Iex_Load)
+               return True;
+            break;
+         case Ist_Dirty:
+            if (st->Ist.Dirty.details->mFx != Ifx_None)
+               return True;
+            break;
+         default:
+            break;
+      }
+   }
+   return False;
+}
+
+IRExpr* VG_(mk_sample_guard) ( IRSB* sbOut, Addr ga )
+{
+   UWord    ix   = ((ga >> 2) ^ (ga >> (2 + SAMPLE_TAB_BITS)))
+                   & ((1 << SAMPLE_TAB_BITS) - 1);
+   IRType   tyW  = sizeof(HWord) == 4 ? Ity_I32 : Ity_I64;
+   IRTemp   res  = newIRTemp(sbOut->tyenv, tyW);
+   IRTemp   yes  = newIRTemp(sbOut->tyenv, Ity_I1);
+   IRDirty* di   = unsafeIRDirty_1_N( res, 1/*regparms*/,
+                                      "sample_sb",
+                                      VG_(fnptr_to_fnentry)(sample_sb),
+                                      mkIRExprVec_1( mkIRExpr_HWord(ix) ) );
+   addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
+   addStmtToIRSB( sbOut,
+                  IRStmt_WrTmp(yes,
+                               IRExpr_Binop(tyW == Ity_I32 ? Iop_CmpNE32
+                                                           : Iop_CmpNE64,
+                                            IRExpr_RdTmp(res),
+                                            mkIRExpr_HWord(0))) );
+   return IRExpr_RdTmp(yes);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -1684,37 +1684,9 @@ void VG_(nuke_all_threads_except) ( ThreadId me, VgSchedReturnCode src )
    Specifying shadow register values
    ------------------------------------------------------------------ */
 
-#if defined(VGA_x86)
-#  define VG_CLREQ_ARGS       guest_EAX
-#  define VG_CLREQ_RET        guest_EDX
-#elif defined(VGA_amd64)
-#  define VG_CLREQ_ARGS       guest_RAX
-#  define VG_CLREQ_RET        guest_RDX
-#elif defined(VGA_ppc32) || defined(VGA_ppc64be) || defined(VGA_ppc64le)
-#  define VG_CLREQ_ARGS       guest_GPR4
-#  define VG_CLREQ_RET        guest_GPR3
-#elif defined(VGA_arm)
-#  define VG_CLREQ_ARGS       guest_R4
-#  define VG_CLREQ_RET        guest_R3
-#elif defined(VGA_arm64)
-#  define VG_CLREQ_ARGS       guest_X4
-#  define VG_CLREQ_RET        guest_X3
-#elif defined (VGA_s390x)
-#  define VG_CLREQ_ARGS       guest_r2
-#  define VG_CLREQ_RET        guest_r3
-#elif defined(VGA_mips32) || defined(VGA_mips64)
-#  define VG_CLREQ_ARGS       guest_r12
-#  define VG_CLREQ_RET        guest_r11
-#elif defined(VGA_tilegx)
-#  define VG_CLREQ_ARGS       guest_r12
-#  define VG_CLREQ_RET        guest_r11
-#else
-#  error Unknown arch
-#endif
-
 #define CLREQ_ARGS(regs)   ((regs).vex.VG_CLREQ_ARGS)
 #define CLREQ_RET(regs)    ((regs).vex.VG_CLREQ_RET)
-#define O_CLREQ_RET        (offsetof(VexGuestArchState, VG_CLREQ_RET))
+#define O_CLREQ_RET        VG_O_CLREQ_RET
 
 // These macros write a value to a client's thread register, and tell the
 // tool that it's happened (if necessary).
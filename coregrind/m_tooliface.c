@@ -99,7 +99,8 @@ VgNeeds VG_(needs) = {
    .var_info	         = False,
    .malloc_replacement   = False,
    .xml_output           = False,
-   .final_IR_tidy_pass   = False
+   .final_IR_tidy_pass   = False,
+   .direct_malloc_calls  = False
 };
 
 /* static */
@@ -203,6 +204,17 @@ Bool VG_(sanity_check_needs)(const HChar** failmsg)
       return False;
    }
 
+   /* Direct calls of the malloc replacements bypass the scheduler, which
+      is what reports post_reg_write_clientcall_return. */
+   if (VG_(needs).direct_malloc_calls
+       && (! VG_(needs).malloc_replacement
+           || VG_(tdict).track_post_reg_write_clientcall_return)) {
+      *failmsg = "Tool error: 'direct_malloc_calls' needed, but either\n"
+                 "   'malloc_replacement' is not, or\n"
+                 "   'post_reg_write_clientcall_return' is tracked\n";
+      return False;
+   }
+
    return True;
 
 #undef CHECK_NOT
@@ -220,6 +232,7 @@ NEEDS(libc_freeres)
 NEEDS(cxx_freeres)
 NEEDS(core_errors)
 NEEDS(var_info)
+NEEDS(direct_malloc_calls)
 
 void VG_(needs_superblock_discards)(
    void (*discard)(Addr, VexGuestExtents)
@@ -43,6 +43,7 @@
 
 #include "pub_core_debuginfo.h"  // VG_(get_fnname_w_offset)
 #include "pub_core_redir.h"      // VG_(redir_do_lookup)
+#include "pub_core_replacemalloc.h" // VG_(client_call_fast_path)
 
 #include "pub_core_signals.h"    // VG_(synth_fault_{perms,mapping}
 #include "pub_core_stacks.h"     // VG_(unknown_SP_update*)()
@@ -664,6 +665,103 @@ IRSB* vg_SP_update_pass ( void*             closureV,
 #undef DO_DIE
 }
 
+/*------------------------------------------------------------*/
+/*--- Client-call fast path pass                           ---*/
+/*------------------------------------------------------------*/
+
+/* A block ending in a client request normally goes back to the
+   scheduler, which services the request and then resumes the client at
+   sb->next.  For tools which replace malloc, nearly all the requests
+   that are made are calls of their replacements, and the round trip
+   costs much more than the call.  So, if the tool needs
+   direct_malloc_calls, give such blocks a call of
+   VG_(client_call_fast_path) followed by a side exit to sb->next, taken
+   if it has dealt with the request; otherwise the block ends as it did
+   before.
+
+   The helper may take a stack trace, or look at any other register, so
+   the whole guest state is made up to date before it is called, with
+   the IP at sb->next as the scheduler would have it.  It writes the
+   request's result in the return register, and may read and write
+   client memory. */
+static
+IRSB* vg_client_call_fast_path_pass ( IRSB*                 sb,
+                                      const VexGuestLayout* layout,
+                                      IRType                gWordTy,
+                                      IRType                hWordTy )
+{
+   IRTemp   t_args, t_done, t_taken;
+   IRDirty* di;
+
+   if (sb->jumpkind != Ijk_ClientReq || sb->next->tag != Iex_Const)
+      return sb;
+
+   vg_assert(gWordTy == hWordTy);
+   vg_assert(layout->total_sizeB <= 0xFFFF);
+
+   t_args  = newIRTemp(sb->tyenv, gWordTy);
+   t_done  = newIRTemp(sb->tyenv, hWordTy);
+   t_taken = newIRTemp(sb->tyenv, Ity_I1);
+
+   addStmtToIRSB( sb, IRStmt_Put(layout->offset_IP,
+                                 deepCopyIRExpr(sb->next)) );
+   addStmtToIRSB( sb, IRStmt_WrTmp(t_args,
+                                   IRExpr_Get(VG_O_CLREQ_ARGS, gWordTy)) );
+
+   di = unsafeIRDirty_1_N(
+           t_done, 1/*regparms*/,
+           "client_call_fast_path",
+           VG_(fnptr_to_fnentry)( &VG_(client_call_fast_path) ),
+           mkIRExprVec_1( IRExpr_RdTmp(t_args) )
+        );
+   di->mFx   = Ifx_Modify;
+   di->mAddr = IRExpr_RdTmp(t_args);
+   di->mSize = 6 * sizeof(UWord);   /* the request's argument block */
+   di->nFxState = 2;
+   di->fxState[0].fx        = Ifx_Read;
+   di->fxState[0].offset    = 0;
+   di->fxState[0].size      = layout->total_sizeB;
+   di->fxState[0].nRepeats  = 0;
+   di->fxState[0].repeatLen = 0;
+   di->fxState[1].fx        = Ifx_Modify;
+   di->fxState[1].offset    = VG_O_CLREQ_RET;
+   di->fxState[1].size      = sizeof(UWord);
+   di->fxState[1].nRepeats  = 0;
+   di->fxState[1].repeatLen = 0;
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+
+   addStmtToIRSB( sb, IRStmt_WrTmp(t_taken,
+                         IRExpr_Binop(hWordTy == Ity_I64
+                                         ? Iop_CmpNE64 : Iop_CmpNE32,
+                                      IRExpr_RdTmp(t_done),
+                                      mkIRExpr_HWord(0))) );
+   addStmtToIRSB( sb, IRStmt_Exit(IRExpr_RdTmp(t_taken), Ijk_Boring,
+                                  deepCopyIRConst(sb->next->Iex.Const.con),
+                                  layout->offset_IP) );
+   return sb;
+}
+
+/* Vex's second instrumentation pass: the %SP-update pass and the
+   client-call fast path pass, as needed. */
+static
+IRSB* vg_instrument2_pass ( void*                   closureV,
+                            IRSB*                   sb_in,
+                            const VexGuestLayout*   layout,
+                            const VexGuestExtents*  vge,
+                            const VexArchInfo*      vai,
+                            IRType                  gWordTy,
+                            IRType                  hWordTy )
+{
+   IRSB* sb = sb_in;
+
+   if (need_to_handle_SP_assignment())
+      sb = vg_SP_update_pass(closureV, sb, layout, vge, vai,
+                             gWordTy, hWordTy);
+   if (VG_(needs).direct_malloc_calls)
+      sb = vg_client_call_fast_path_pass(sb, layout, gWordTy, hWordTy);
+   return sb;
+}
+
 /*------------------------------------------------------------*/
 /*--- Main entry point for the JITter.                     ---*/
 /*------------------------------------------------------------*/
@@ -1727,7 +1825,8 @@ Bool VG_(translate) ( ThreadId tid,
    }
    /* No need for type kludgery here. */
    vta.instrument2       = need_to_handle_SP_assignment()
-                              ? vg_SP_update_pass
+                           || VG_(needs).direct_malloc_calls
+                              ? vg_instrument2_pass
                               : NULL;
    vta.finaltidy         = VG_(needs).final_IR_tidy_pass
                               ? VG_(tdict).tool_final_IR_tidy_pass
@@ -166,11 +166,43 @@
 #endif
 
 
+// The registers through which client requests pass the address of
+// their argument block, and get their result.
+#if defined(VGA_x86)
+#  define VG_CLREQ_ARGS       guest_EAX
+#  define VG_CLREQ_RET        guest_EDX
+#elif defined(VGA_amd64)
+#  define VG_CLREQ_ARGS       guest_RAX
+#  define VG_CLREQ_RET        guest_RDX
+#elif defined(VGA_ppc32) || defined(VGA_ppc64be) || defined(VGA_ppc64le)
+#  define VG_CLREQ_ARGS       guest_GPR4
+#  define VG_CLREQ_RET        guest_GPR3
+#elif defined(VGA_arm)
+#  define VG_CLREQ_ARGS       guest_R4
+#  define VG_CLREQ_RET        guest_R3
+#elif defined(VGA_arm64)
+#  define VG_CLREQ_ARGS       guest_X4
+#  define VG_CLREQ_RET        guest_X3
+#elif defined (VGA_s390x)
+#  define VG_CLREQ_ARGS       guest_r2
+#  define VG_CLREQ_RET        guest_r3
+#elif defined(VGA_mips32) || defined(VGA_mips64)
+#  define VG_CLREQ_ARGS       guest_r12
+#  define VG_CLREQ_RET        guest_r11
+#elif defined(VGA_tilegx)
+#  define VG_CLREQ_ARGS       guest_r12
+#  define VG_CLREQ_RET        guest_r11
+#else
+#  error Unknown arch
+#endif
+
 // Offsets for the Vex state
 #define VG_O_STACK_PTR        (offsetof(VexGuestArchState, VG_STACK_PTR))
 #define VG_O_INSTR_PTR        (offsetof(VexGuestArchState, VG_INSTR_PTR))
 #define VG_O_FRAME_PTR        (offsetof(VexGuestArchState, VG_FRAME_PTR))
 #define VG_O_FPC_REG          (offsetof(VexGuestArchState, VG_FPC_REG))
+#define VG_O_CLREQ_ARGS       (offsetof(VexGuestArchState, VG_CLREQ_ARGS))
+#define VG_O_CLREQ_RET        (offsetof(VexGuestArchState, VG_CLREQ_RET))
 
 
 //-------------------------------------------------------------
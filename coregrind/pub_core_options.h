@@ -322,6 +322,11 @@ extern UInt VG_(clo_avg_transtab_entry_size);
    VG_(clo_aspacem_minAddr). */
 extern Addr VG_(clo_aspacem_minAddr);
 
+/* Back V's large anonymous mappings (arena superblocks, translation
+   cache, shadow memory) with transparent huge pages?  Linux only.
+   Default: NO */
+extern Bool VG_(clo_hugepages);
+
 /* How large the Valgrind thread stacks should be. 
    Will be rounded up to a page.. */
 extern Word VG_(clo_valgrind_stacksize);
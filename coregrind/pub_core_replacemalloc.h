@@ -55,6 +55,14 @@ struct vg_mallocfunc_info {
    Bool	clo_trace_malloc;
 };
 
+// Called from translated code at a client request.  Returns 1 if it
+// handled the request, 0 if the scheduler must.
+extern VG_REGPARM(1) UWord VG_(client_call_fast_path) ( UWord* arg );
+
+// With --stats=yes, and if the tool needs direct_malloc_calls, shows
+// how many requests VG_(client_call_fast_path) handled.
+extern void VG_(print_replacemalloc_stats) ( void );
+
 #endif   // __PUB_CORE_REPLACEMALLOC_H
 
 /*--------------------------------------------------------------------*/
@@ -95,6 +95,7 @@ typedef
       Bool malloc_replacement;
       Bool xml_output;
       Bool final_IR_tidy_pass;
+      Bool direct_malloc_calls;
    } 
    VgNeeds;
 
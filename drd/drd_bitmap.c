@@ -38,25 +38,487 @@
 
 static void bm2_merge(struct bitmap2* const bm2l,
                       const struct bitmap2* const bm2r);
-static void bm2_print(const struct bitmap2* const bm2);
+static void bm1_print(const UWord a1, const struct bitmap1* const bm1);
 
 
 /* Local variables. */
 
 static OSet* s_bm2_set_template;
+static OSet* s_run_set_template;
+/**
+ * Shared second-level bitmaps for the pages that are part of a run, indexed
+ * by (part of a load run ? 1 : 0) | (part of a store run ? 2 : 0).
+ */
+static struct bitmap2 s_bm2_run[4];
+static ULong s_run_page_count;
 static ULong s_bitmap_creation_count;
 static ULong s_bitmap_merge_count;
 static ULong s_bitmap2_merge_count;
 
 
+/* Bulk operations on struct bitmap1. */
+
+/*
+ * If at most this many summary bits are set, only process the bm0 elements
+ * covered by these summary bits instead of all bm0 elements.
+ */
+#define BM1_SPARSE_SUMMARY_BITS (BITS_PER_UWORD / 4)
+
+#if defined(VGA_amd64)
+/*
+ * Process 128 bits at a time on amd64. The alignment attribute reduces the
+ * alignment requirement such that unaligned (SSE2) loads and stores are
+ * generated.
+ */
+typedef UWord bm_vec_t __attribute__((vector_size(16), aligned(sizeof(UWord))));
+#define BM_VEC_UWORDS (sizeof(bm_vec_t) / sizeof(UWord))
+#endif
+
+/** Iterate over the indices of the summary bits set in s. */
+#define FOR_EACH_SUMMARY_BIT(i, s, t)                                   \
+   for ((t) = (s); (t) && ((i) = __builtin_ctzl(t), True); (t) &= (t) - 1)
+
+/** Whether to process all bm0 elements instead of only the summarized ones. */
+static __inline__ Bool bm1_process_densely(const UWord summary)
+{
+   return __builtin_popcountl(summary) > BM1_SPARSE_SUMMARY_BITS;
+}
+
+/** Compute l[k] |= r[k] for all bm0 elements. */
+static __inline__ void bm0_merge_dense(UWord* const l, const UWord* const r)
+{
+   unsigned k;
+
+#if defined(BM_VEC_UWORDS)
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k += BM_VEC_UWORDS)
+      *(bm_vec_t*)&l[k] |= *(const bm_vec_t*)&r[k];
+#else
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+      l[k] |= r[k];
+#endif
+}
+
+/** Compute the bitwise or of (l[k] ^ r[k]) for all bm0 elements. */
+static __inline__ UWord bm0_diff_dense(const UWord* const l,
+                                       const UWord* const r)
+{
+   unsigned k;
+#if defined(BM_VEC_UWORDS)
+   union { bm_vec_t v; UWord w[BM_VEC_UWORDS]; } acc;
+   UWord result = 0;
+
+   VG_(memset)(&acc, 0, sizeof(acc));
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k += BM_VEC_UWORDS)
+      acc.v |= *(const bm_vec_t*)&l[k] ^ *(const bm_vec_t*)&r[k];
+   for (k = 0; k < BM_VEC_UWORDS; k++)
+      result |= acc.w[k];
+   return result;
+#else
+   UWord result = 0;
+
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+      result |= l[k] ^ r[k];
+   return result;
+#endif
+}
+
+/** Compute *bm1l |= *bm1r. */
+static __inline__ void bm1_merge(struct bitmap1* const bm1l,
+                                 const struct bitmap1* const bm1r)
+{
+   if (bm1_process_densely(bm1r->summary))
+   {
+      bm0_merge_dense(bm1l->bm0_r, bm1r->bm0_r);
+      bm0_merge_dense(bm1l->bm0_w, bm1r->bm0_w);
+   }
+   else
+   {
+      UWord i, t, k;
+
+      FOR_EACH_SUMMARY_BIT(i, bm1r->summary, t)
+      {
+         for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT;
+              k++)
+         {
+            bm1l->bm0_r[k] |= bm1r->bm0_r[k];
+            bm1l->bm0_w[k] |= bm1r->bm0_w[k];
+         }
+      }
+   }
+   bm1l->summary |= bm1r->summary;
+}
+
+/** Return True if no access has been recorded in *bm1. */
+static __inline__ Bool bm1_is_empty(const struct bitmap1* const bm1)
+{
+   UWord i, t, k;
+   UWord any = 0;
+
+   FOR_EACH_SUMMARY_BIT(i, bm1->summary, t)
+   {
+      for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT; k++)
+         any |= bm1->bm0_r[k] | bm1->bm0_w[k];
+   }
+   return any == 0;
+}
+
+/** Return True if a store has been recorded in *bm1. */
+static __inline__ Bool bm1_has_any_store(const struct bitmap1* const bm1)
+{
+   UWord i, t, k;
+   UWord any = 0;
+
+   FOR_EACH_SUMMARY_BIT(i, bm1->summary, t)
+   {
+      for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT; k++)
+         any |= bm1->bm0_w[k];
+   }
+   return any != 0;
+}
+
+/** Return True if a load has been recorded in *bm1. */
+static __inline__ Bool bm1_has_any_load(const struct bitmap1* const bm1)
+{
+   UWord i, t, k;
+   UWord any = 0;
+
+   FOR_EACH_SUMMARY_BIT(i, bm1->summary, t)
+   {
+      for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT; k++)
+         any |= bm1->bm0_r[k];
+   }
+   return any != 0;
+}
+
+/**
+ * Return True if the same accesses have been recorded in *bm1l and *bm1r.
+ * The summary bits are not compared since these are conservative.
+ */
+static __inline__ Bool bm1_equal(const struct bitmap1* const bm1l,
+                                 const struct bitmap1* const bm1r)
+{
+   const UWord summary = bm1l->summary | bm1r->summary;
+
+   if (bm1_process_densely(summary))
+   {
+      return (bm0_diff_dense(bm1l->bm0_r, bm1r->bm0_r)
+              | bm0_diff_dense(bm1l->bm0_w, bm1r->bm0_w)) == 0;
+   }
+   else
+   {
+      UWord i, t, k;
+      UWord diff = 0;
+
+      FOR_EACH_SUMMARY_BIT(i, summary, t)
+      {
+         for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT;
+              k++)
+         {
+            diff |= (bm1l->bm0_r[k] ^ bm1r->bm0_r[k])
+               | (bm1l->bm0_w[k] ^ bm1r->bm0_w[k]);
+         }
+      }
+      return diff == 0;
+   }
+}
+
+/** Record a load and / or a store for all addresses covered by *bm1. */
+static __inline__ void bm1_set_all(struct bitmap1* const bm1,
+                                   const Bool r, const Bool w)
+{
+   if (r)
+      VG_(memset)(bm1->bm0_r, 0xff, sizeof(bm1->bm0_r));
+   if (w)
+      VG_(memset)(bm1->bm0_w, 0xff, sizeof(bm1->bm0_w));
+   if (r || w)
+      bm1->summary = ~(UWord)0;
+}
+
+/**
+ * Return True if for each of loads and stores either all or none of the
+ * addresses covered by *bm1 have been accessed, and if so, which.
+ */
+static Bool bm1_is_uniform(const struct bitmap1* const bm1,
+                           Bool* const r, Bool* const w)
+{
+   UWord and_r = ~(UWord)0, or_r = 0, and_w = ~(UWord)0, or_w = 0;
+   unsigned k;
+
+   if (bm1->summary != ~(UWord)0)
+   {
+      /* Not all addresses can have been accessed, but none may have been. */
+      *r = *w = False;
+      return bm1_is_empty(bm1);
+   }
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   {
+      and_r &= bm1->bm0_r[k];
+      or_r  |= bm1->bm0_r[k];
+      and_w &= bm1->bm0_w[k];
+      or_w  |= bm1->bm0_w[k];
+   }
+   *r = and_r == ~(UWord)0;
+   *w = and_w == ~(UWord)0;
+   return (*r || or_r == 0) && (*w || or_w == 0);
+}
+
+/** Report whether any of the bits set in both *bm1l and *bm1r is a race. */
+static __inline__ Bool bm1_has_races(const UWord a1,
+                                     const struct bitmap1* const bm1l,
+                                     const struct bitmap1* const bm1r)
+{
+   UWord i, t, k;
+
+   /*
+    * Only the bm0 elements for which the summary bit has been set in both
+    * bitmaps can contain conflicting accesses. For each such element,
+    * compute the HAS_RACE() predicate for all its bits at once.
+    */
+   FOR_EACH_SUMMARY_BIT(i, bm1l->summary & bm1r->summary, t)
+   {
+      for (k = i << BM0_SUMMARY_SHIFT; k < (i + 1) << BM0_SUMMARY_SHIFT; k++)
+      {
+         UWord races
+            = (bm1r->bm0_w[k] & (bm1l->bm0_r[k] | bm1l->bm0_w[k]))
+            | (bm1l->bm0_w[k] & (bm1r->bm0_r[k] | bm1r->bm0_w[k]));
+
+         for ( ; races; races &= races - 1)
+         {
+            const UWord b = __builtin_ctzl(races);
+            Addr const a = make_address(a1, k * BITS_PER_UWORD | b);
+            if (! DRD_(is_suppressed)(a, a + 1))
+            {
+               return True;
+            }
+         }
+      }
+   }
+   return False;
+}
+
+
+/* Run sets. */
+
+/*
+ * Second-level bitmaps in which every address has been loaded from, stored
+ * to or both are represented by runs of consecutive address_msb() values
+ * instead of by a struct bitmap2 each. This saves both memory and merge time
+ * for segments in which wide address ranges have been accessed, e.g. by
+ * memset() or read() or by a loop that traverses a large array.
+ */
+
+/** Run of second-level bitmap addresses [ first .. last ]. */
+struct bitmap_run
+{
+   UWord first;
+   UWord last;
+};
+
+/** Compare address_msb() value *key with a run. */
+static Word bm_run_cmp(const void* key, const void* elem)
+{
+   const UWord a1 = *(const UWord*)key;
+   const struct bitmap_run* const run = elem;
+
+   if (a1 < run->first)
+      return -1;
+   if (a1 > run->last)
+      return 1;
+   return 0;
+}
+
+static void bm_run_insert(OSet* const runs, const UWord first, const UWord last)
+{
+   struct bitmap_run* run;
+
+   tl_assert(first <= last);
+
+   run = VG_(OSetGen_AllocNode)(runs, sizeof(*run));
+   run->first = first;
+   run->last  = last;
+   VG_(OSetGen_Insert)(runs, run);
+}
+
+/** Remove and free the run that contains a1. */
+static void bm_run_free(OSet* const runs, const UWord a1)
+{
+   struct bitmap_run* const run = VG_(OSetGen_Remove)(runs, &a1);
+
+   tl_assert(run);
+   VG_(OSetGen_FreeNode)(runs, run);
+}
+
+/** Add [ first .. last ] to runs and coalesce adjacent runs. */
+static void bm_run_add(OSet* const runs, UWord first, UWord last)
+{
+   const struct bitmap_run* run;
+
+   for (;;)
+   {
+      const UWord key = first > 0 ? first - 1 : 0;
+
+      VG_(OSetGen_ResetIterAt)(runs, &key);
+      run = VG_(OSetGen_Next)(runs);
+      if (run == NULL || run->first > last + 1)
+         break;
+      if (run->first < first)
+         first = run->first;
+      if (run->last > last)
+         last = run->last;
+      bm_run_free(runs, run->first);
+   }
+   bm_run_insert(runs, first, last);
+}
+
+/** Remove [ first .. last ] from runs. */
+static void bm_run_remove(OSet* const runs, const UWord first, const UWord last)
+{
+   const struct bitmap_run* run;
+
+   if (VG_(OSetGen_Size)(runs) == 0)
+      return;
+
+   for (;;)
+   {
+      UWord run_first, run_last;
+
+      VG_(OSetGen_ResetIterAt)(runs, &first);
+      run = VG_(OSetGen_Next)(runs);
+      if (run == NULL || run->first > last)
+         break;
+      run_first = run->first;
+      run_last  = run->last;
+      bm_run_free(runs, run_first);
+      if (run_first < first)
+         bm_run_insert(runs, run_first, first - 1);
+      if (run_last > last)
+         bm_run_insert(runs, last + 1, run_last);
+   }
+}
+
+static Bool bm_run_contains(OSet* const runs, const UWord a1)
+{
+   return VG_(OSetGen_Size)(runs) && VG_(OSetGen_Lookup)(runs, &a1);
+}
+
+/**
+ * Look up a1 in the run sets of bm and return a pointer to a shared read-only
+ * second-level bitmap if a1 is part of a run, or NULL if it is not.
+ */
+struct bitmap2* DRD_(bm2_lookup_run)(struct bitmap* const bm, const UWord a1)
+{
+   const unsigned i = (bm_run_contains(bm->runs_r, a1) ? 1 : 0)
+                    | (bm_run_contains(bm->runs_w, a1) ? 2 : 0);
+
+   return i ? &s_bm2_run[i] : NULL;
+}
+
+/**
+ * Remove a1 from the run sets of bm and insert a second-level bitmap with the
+ * same content instead.
+ */
+struct bitmap2* DRD_(bm2_materialize_run)(struct bitmap* const bm,
+                                          const UWord a1)
+{
+   const Bool r = bm_run_contains(bm->runs_r, a1);
+   const Bool w = bm_run_contains(bm->runs_w, a1);
+   struct bitmap2* bm2;
+
+   tl_assert(r || w);
+   tl_assert(! VG_(OSetGen_Lookup)(bm->oset, &a1));
+
+   if (r)
+      bm_run_remove(bm->runs_r, a1, a1);
+   if (w)
+      bm_run_remove(bm->runs_w, a1, a1);
+   bm_cache_invalidate(bm);
+
+   bm2 = bm2_insert(bm, a1);
+   bm2->recalc = False;
+   bm2_clear(bm2);
+   bm1_set_all(&bm2->bm1, r, w);
+   return bm2;
+}
+
+/**
+ * Record a load or store for all addresses covered by the second-level
+ * bitmaps [ first .. last ]. Second-level bitmaps that already exist are
+ * updated and the remaining addresses are added to the run set.
+ */
+static void bm_access_pages(struct bitmap* const bm,
+                            const UWord first, const UWord last,
+                            const BmAccessTypeT access_type)
+{
+   OSet* const runs = access_type == eLoad ? bm->runs_r : bm->runs_w;
+   struct bitmap2* bm2;
+   UWord a1 = first;
+
+   tl_assert(access_type == eLoad || access_type == eStore);
+   tl_assert(first <= last);
+
+   VG_(OSetGen_ResetIterAt)(bm->oset, &first);
+   while ((bm2 = VG_(OSetGen_Next)(bm->oset)) != NULL && bm2->addr <= last)
+   {
+      bm1_set_all(&bm2->bm1, access_type == eLoad, access_type == eStore);
+      if (a1 < bm2->addr)
+      {
+         s_run_page_count += bm2->addr - a1;
+         bm_run_add(runs, a1, bm2->addr - 1);
+      }
+      a1 = bm2->addr + 1;
+   }
+   if (a1 <= last)
+   {
+      s_run_page_count += last - a1 + 1;
+      bm_run_add(runs, a1, last);
+   }
+   bm_cache_invalidate(bm);
+}
+
+/**
+ * Remove [ a1, a2 [ from the run sets selected by r and w. Only pages that
+ * are entirely covered by [ a1, a2 [ are removed; callers must handle the
+ * partially covered pages at the start and the end of the range.
+ */
+static void bm_clear_runs(struct bitmap* const bm, const Addr a1,
+                          const Addr a2, const Bool r, const Bool w)
+{
+   const UWord first = address_msb(a1) + (address_lsb(a1) != 0);
+   const UWord end   = address_msb(a2);
+
+   if (first < end)
+   {
+      if (r)
+         bm_run_remove(bm->runs_r, first, end - 1);
+      if (w)
+         bm_run_remove(bm->runs_w, first, end - 1);
+      bm_cache_invalidate(bm);
+   }
+}
+
+
 /* Function definitions. */
 
 void DRD_(bm_module_init)(void)
 {
+   unsigned i;
+
    tl_assert(!s_bm2_set_template);
    s_bm2_set_template
       = VG_(OSetGen_Create_With_Pool)(0, 0, VG_(malloc), "drd.bitmap.bn.2",
                                       VG_(free), 512, sizeof(struct bitmap2));
+   tl_assert(!s_run_set_template);
+   s_run_set_template
+      = VG_(OSetGen_Create_With_Pool)(0, bm_run_cmp, VG_(malloc),
+                                      "drd.bitmap.bn.3", VG_(free), 512,
+                                      sizeof(struct bitmap_run));
+   for (i = 1; i < sizeof(s_bm2_run) / sizeof(s_bm2_run[0]); i++)
+   {
+      s_bm2_run[i].addr = BM2_RUN_ADDR;
+      s_bm2_run[i].recalc = False;
+      bm2_clear(&s_bm2_run[i]);
+      bm1_set_all(&s_bm2_run[i].bm1, (i & 1) != 0, (i & 2) != 0);
+   }
 }
 
 void DRD_(bm_module_cleanup)(void)
@@ -64,6 +526,9 @@ void DRD_(bm_module_cleanup)(void)
    tl_assert(s_bm2_set_template);
    VG_(OSetGen_Destroy)(s_bm2_set_template);
    s_bm2_set_template = NULL;
+   tl_assert(s_run_set_template);
+   VG_(OSetGen_Destroy)(s_run_set_template);
+   s_run_set_template = NULL;
 }
 
 struct bitmap* DRD_(bm_new)()
@@ -73,6 +538,9 @@ struct bitmap* DRD_(bm_new)()
    /* If this assert fails, fix the definition of BITS_PER_BITS_PER_UWORD */
    /* in drd_bitmap.h.                                                    */
    tl_assert((1 << BITS_PER_BITS_PER_UWORD) == BITS_PER_UWORD);
+   /* Each bit of bitmap1::summary must correspond to BM0_SUMMARY_UWORDS   */
+   /* bm0 elements.                                                       */
+   tl_assert((BITMAP1_UWORD_COUNT >> BM0_SUMMARY_SHIFT) == BITS_PER_UWORD);
 
    bm = VG_(malloc)("drd.bitmap.bn.1", sizeof(*bm));
    DRD_(bm_init)(bm);
@@ -91,20 +559,12 @@ void DRD_(bm_delete)(struct bitmap* const bm)
 /** Initialize *bm. */
 void DRD_(bm_init)(struct bitmap* const bm)
 {
-   unsigned i;
-
    tl_assert(bm);
-   /*
-    * Cache initialization. a1 is initialized with a value that never can
-    * match any valid address: the upper (ADDR_LSB_BITS + ADDR_IGNORED_BITS)
-    * bits of a1 are always zero for a valid cache entry.
-    */
-   for (i = 0; i < DRD_BITMAP_N_CACHE_ELEM; i++)
-   {
-      bm->cache[i].a1  = ~(UWord)1;
-      bm->cache[i].bm2 = 0;
-   }
+   bm_cache_invalidate(bm);
    bm->oset = VG_(OSetGen_EmptyClone)(s_bm2_set_template);
+   bm->runs_r = VG_(OSetGen_EmptyClone)(s_run_set_template);
+   bm->runs_w = VG_(OSetGen_EmptyClone)(s_run_set_template);
+   bm->runs_m = VG_(OSetGen_EmptyClone)(s_run_set_template);
 
    s_bitmap_creation_count++;
 }
@@ -113,6 +573,9 @@ void DRD_(bm_init)(struct bitmap* const bm)
 void DRD_(bm_cleanup)(struct bitmap* const bm)
 {
    VG_(OSetGen_Destroy)(bm->oset);
+   VG_(OSetGen_Destroy)(bm->runs_r);
+   VG_(OSetGen_Destroy)(bm->runs_w);
+   VG_(OSetGen_Destroy)(bm->runs_m);
 }
 
 /**
@@ -151,7 +614,14 @@ void DRD_(bm_access_range_load)(struct bitmap* const bm, Addr a1, Addr a2)
       Addr b_start;
       Addr b_end;
       struct bitmap2* bm2;
-      UWord b0;
+
+      if (address_lsb(b) == 0 && address_msb(b) < address_msb(a2))
+      {
+         /* Record the second-level bitmaps covered entirely at once. */
+         bm_access_pages(bm, address_msb(b), address_msb(a2) - 1, eLoad);
+         b_next = make_address(address_msb(a2), 0);
+         continue;
+      }
 
       b_next = first_address_with_higher_msb(b);
       if (b_next > a2)
@@ -179,22 +649,10 @@ void DRD_(bm_access_range_load)(struct bitmap* const bm, Addr a1, Addr a2)
       tl_assert(address_msb(b_start) == address_msb(b_end - 1));
       tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-      if (address_lsb(b_start) == 0 && address_lsb(b_end) == 0)
-      {
-         unsigned k;
-
-         for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
-         {
-            bm2->bm1.bm0_r[k] = ~(UWord)0;
-         }
-      }
-      else
-      {
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         {
-            bm0_set(bm2->bm1.bm0_r, b0);
-         }
-      }
+      bm0_set_range_any(bm2->bm1.bm0_r,
+                        address_lsb(b_start), address_lsb(b_end - 1));
+      bm2->bm1.summary |= bm0_summary_range_mask(address_lsb(b_start),
+                                                 address_lsb(b_end - 1));
    }
 }
 
@@ -248,7 +706,14 @@ void DRD_(bm_access_range_store)(struct bitmap* const bm,
       Addr b_start;
       Addr b_end;
       struct bitmap2* bm2;
-      UWord b0;
+
+      if (address_lsb(b) == 0 && address_msb(b) < address_msb(a2))
+      {
+         /* Record the second-level bitmaps covered entirely at once. */
+         bm_access_pages(bm, address_msb(b), address_msb(a2) - 1, eStore);
+         b_next = make_address(address_msb(a2), 0);
+         continue;
+      }
 
       b_next = first_address_with_higher_msb(b);
       if (b_next > a2)
@@ -276,22 +741,10 @@ void DRD_(bm_access_range_store)(struct bitmap* const bm,
       tl_assert(address_msb(b_start) == address_msb(b_end - 1));
       tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-      if (address_lsb(b_start) == 0 && address_lsb(b_end) == 0)
-      {
-         unsigned k;
-
-         for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
-         {
-            bm2->bm1.bm0_w[k] = ~(UWord)0;
-         }
-      }
-      else
-      {
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         {
-            bm0_set(bm2->bm1.bm0_w, b0);
-         }
-      }
+      bm0_set_range_any(bm2->bm1.bm0_w,
+                        address_lsb(b_start), address_lsb(b_end - 1));
+      bm2->bm1.summary |= bm0_summary_range_mask(address_lsb(b_start),
+                                                 address_lsb(b_end - 1));
    }
 }
 
@@ -346,19 +799,13 @@ Bool DRD_(bm_has_any_load_g)(struct bitmap* const bm)
 
    tl_assert(bm);
 
+   if (VG_(OSetGen_Size)(bm->runs_r))
+      return True;
+
    VG_(OSetGen_ResetIter)(bm->oset);
    for ( ; (bm2 = VG_(OSetGen_Next)(bm->oset)) != NULL; ) {
-      Addr b_start;
-      Addr b_end;
-      UWord b0;
-      const struct bitmap1* const p1 = &bm2->bm1;
-
-      b_start = make_address(bm2->addr, 0);
-      b_end = make_address(bm2->addr + 1, 0);
-
-      for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
-         if (bm0_is_set(p1->bm0_r, b0))
-            return True;
+      if (bm1_has_any_load(&bm2->bm1))
+         return True;
    }
    return False;
 }
@@ -384,32 +831,29 @@ DRD_(bm_has_any_load)(struct bitmap* const bm, const Addr a1, const Addr a2)
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
-         if (make_address(bm2->addr, 0) < a1)
+         if (make_address(address_msb(b), 0) < a1)
             b_start = a1;
          else
-            if (make_address(bm2->addr, 0) < a2)
-               b_start = make_address(bm2->addr, 0);
+            if (make_address(address_msb(b), 0) < a2)
+               b_start = make_address(address_msb(b), 0);
             else
                break;
          tl_assert(a1 <= b_start && b_start <= a2);
 
-         if (make_address(bm2->addr + 1, 0) < a2)
-            b_end = make_address(bm2->addr + 1, 0);
+         if (make_address(address_msb(b) + 1, 0) < a2)
+            b_end = make_address(address_msb(b) + 1, 0);
          else
             b_end = a2;
          tl_assert(a1 <= b_end && b_end <= a2);
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if (bm0_is_any_set_in_range(p1->bm0_r, address_lsb(b_start),
+                                     address_lsb(b_end - 1)))
          {
-            if (bm0_is_set(p1->bm0_r, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -437,32 +881,29 @@ Bool DRD_(bm_has_any_store)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
-         if (make_address(bm2->addr, 0) < a1)
+         if (make_address(address_msb(b), 0) < a1)
             b_start = a1;
          else
-            if (make_address(bm2->addr, 0) < a2)
-               b_start = make_address(bm2->addr, 0);
+            if (make_address(address_msb(b), 0) < a2)
+               b_start = make_address(address_msb(b), 0);
             else
                break;
          tl_assert(a1 <= b_start && b_start <= a2);
 
-         if (make_address(bm2->addr + 1, 0) < a2)
-            b_end = make_address(bm2->addr + 1, 0);
+         if (make_address(address_msb(b) + 1, 0) < a2)
+            b_end = make_address(address_msb(b) + 1, 0);
          else
             b_end = a2;
          tl_assert(a1 <= b_end && b_end <= a2);
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if (bm0_is_any_set_in_range(p1->bm0_w, address_lsb(b_start),
+                                     address_lsb(b_end - 1)))
          {
-            if (bm0_is_set(p1->bm0_w, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -492,36 +933,35 @@ Bool DRD_(bm_has_any_access)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
-         if (make_address(bm2->addr, 0) < a1)
+         if (make_address(address_msb(b), 0) < a1)
             b_start = a1;
          else
-            if (make_address(bm2->addr, 0) < a2)
-               b_start = make_address(bm2->addr, 0);
+            if (make_address(address_msb(b), 0) < a2)
+               b_start = make_address(address_msb(b), 0);
             else
                break;
          tl_assert(a1 <= b_start && b_start <= a2);
 
-         if (make_address(bm2->addr + 1, 0) < a2)
-            b_end = make_address(bm2->addr + 1, 0);
+         if (make_address(address_msb(b) + 1, 0) < a2)
+            b_end = make_address(address_msb(b) + 1, 0);
          else
             b_end = a2;
          tl_assert(a1 <= b_end && b_end <= a2);
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         /*
+          * Note: the statement below uses a binary or instead of a logical
+          * or on purpose.
+          */
+         if (bm0_is_any_set_in_range(p1->bm0_r, address_lsb(b_start),
+                                     address_lsb(b_end - 1))
+             | bm0_is_any_set_in_range(p1->bm0_w, address_lsb(b_start),
+                                       address_lsb(b_end - 1)))
          {
-            /*
-             * Note: the statement below uses a binary or instead of a logical
-             * or on purpose.
-             */
-            if (bm0_is_set(p1->bm0_r, b0) | bm0_is_set(p1->bm0_w, b0))
-            {
-               return True;
-            }
+            return True;
          }
       }
    }
@@ -562,6 +1002,8 @@ void DRD_(bm_clear)(struct bitmap* const bm, Addr a1, Addr a2)
    tl_assert(a1 == first_address_with_same_lsb(a1));
    tl_assert(a2 == first_address_with_same_lsb(a2));
 
+   bm_clear_runs(bm, a1, a2, True, True);
+
    for (b = a1; b < a2; b = b_next)
    {
       struct bitmap2* p2;
@@ -639,6 +1081,8 @@ void DRD_(bm_clear_load)(struct bitmap* const bm, Addr a1, Addr a2)
    tl_assert(a1 == first_address_with_same_lsb(a1));
    tl_assert(a2 == first_address_with_same_lsb(a2));
 
+   bm_clear_runs(bm, a1, a2, True, False);
+
    for (b = a1; b < a2; b = b_next)
    {
       struct bitmap2* p2;
@@ -721,6 +1165,8 @@ void DRD_(bm_clear_store)(struct bitmap* const bm,
    tl_assert(a1 == first_address_with_same_lsb(a1));
    tl_assert(a2 == first_address_with_same_lsb(a2));
 
+   bm_clear_runs(bm, a1, a2, False, True);
+
    for (b = a1; b < a2; b = b_next)
    {
       struct bitmap2* p2;
@@ -825,43 +1271,42 @@ Bool DRD_(bm_has_conflict_with)(struct bitmap* const bm,
       {
          Addr b_start;
          Addr b_end;
-         UWord b0;
          const struct bitmap1* const p1 = &bm2->bm1;
 
-         if (make_address(bm2->addr, 0) < a1)
+         if (make_address(address_msb(b), 0) < a1)
             b_start = a1;
          else
-            if (make_address(bm2->addr, 0) < a2)
-               b_start = make_address(bm2->addr, 0);
+            if (make_address(address_msb(b), 0) < a2)
+               b_start = make_address(address_msb(b), 0);
             else
                break;
          tl_assert(a1 <= b_start && b_start <= a2);
 
-         if (make_address(bm2->addr + 1, 0) < a2)
-            b_end = make_address(bm2->addr + 1, 0);
+         if (make_address(address_msb(b) + 1, 0) < a2)
+            b_end = make_address(address_msb(b) + 1, 0);
          else
             b_end = a2;
          tl_assert(a1 <= b_end && b_end <= a2);
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         if (access_type == eLoad)
          {
-            if (access_type == eLoad)
+            if (bm0_is_any_set_in_range(p1->bm0_w, address_lsb(b_start),
+                                        address_lsb(b_end - 1)))
             {
-               if (bm0_is_set(p1->bm0_w, b0))
-               {
-                  return True;
-               }
+               return True;
             }
-            else
+         }
+         else
+         {
+            tl_assert(access_type == eStore);
+            if (bm0_is_any_set_in_range(p1->bm0_r, address_lsb(b_start),
+                                        address_lsb(b_end - 1))
+                | bm0_is_any_set_in_range(p1->bm0_w, address_lsb(b_start),
+                                          address_lsb(b_end - 1)))
             {
-               tl_assert(access_type == eStore);
-               if (bm0_is_set(p1->bm0_r, b0)
-                   | bm0_is_set(p1->bm0_w, b0))
-               {
-                  return True;
-               }
+               return True;
             }
          }
       }
@@ -940,78 +1385,111 @@ Bool DRD_(bm_store_has_conflict_with)(struct bitmap* const bm,
 }
 
 /**
- * Return True if the two bitmaps *lhs and *rhs are identical, and false
- * if not.
+ * Return True if every page [ first .. last ] of *rhs has the same content as
+ * in *lhs, where these pages are part of a run of *lhs and rhs_runs is the
+ * run set of *rhs of the same access type as that run. Pages of *rhs that are
+ * stored as a second-level bitmap are compared one by one and all other pages
+ * must be covered by rhs_runs, so the cost is proportional to the number of
+ * second-level bitmaps and runs of *rhs in the range and not to its length.
  */
-Bool DRD_(bm_equal)(struct bitmap* const lhs, struct bitmap* const rhs)
+static Bool bm_run_matches(struct bitmap* const lhs, struct bitmap* const rhs,
+                           OSet* const rhs_runs,
+                           const UWord first, const UWord last)
 {
-   struct bitmap2* bm2l;
-   struct bitmap2* bm2r;
-
-   /* It's not possible to have two independent iterators over the same OSet, */
-   /* so complain if lhs == rhs.                                              */
-   tl_assert(lhs != rhs);
-
-   VG_(OSetGen_ResetIter)(lhs->oset);
-   VG_(OSetGen_ResetIter)(rhs->oset);
+   const struct bitmap2* bm2r;
+   const struct bitmap_run* run;
+   UWord a1 = first;
 
-   for ( ; (bm2l = VG_(OSetGen_Next)(lhs->oset)) != 0; )
+   VG_(OSetGen_ResetIterAt)(rhs->oset, &first);
+   bm2r = VG_(OSetGen_Next)(rhs->oset);
+   for (;;)
    {
-      while (bm2l
-             && ! DRD_(bm_has_any_access)(lhs,
-                                          make_address(bm2l->addr, 0),
-                                          make_address(bm2l->addr + 1, 0)))
-      {
-         bm2l = VG_(OSetGen_Next)(lhs->oset);
-      }
-      if (bm2l == 0)
-         break;
-      tl_assert(bm2l);
-
-      do
+      if (bm2r && bm2r->addr == a1)
       {
-         bm2r = VG_(OSetGen_Next)(rhs->oset);
-         if (bm2r == 0)
+         if (! bm1_equal(&DRD_(bm2_lookup_run)(lhs, a1)->bm1, &bm2r->bm1))
             return False;
+         bm2r = VG_(OSetGen_Next)(rhs->oset);
       }
-      while (! DRD_(bm_has_any_access)(rhs,
-                                       make_address(bm2r->addr, 0),
-                                       make_address(bm2r->addr + 1, 0)));
-
-      tl_assert(bm2r);
-      tl_assert(DRD_(bm_has_any_access)(rhs,
-                                        make_address(bm2r->addr, 0),
-                                        make_address(bm2r->addr + 1, 0)));
-
-      if (bm2l != bm2r
-          && (bm2l->addr != bm2r->addr
-              || VG_(memcmp)(&bm2l->bm1, &bm2r->bm1, sizeof(bm2l->bm1)) != 0))
+      else
       {
-         return False;
+         /* A page is never both in rhs->oset and in a run set of rhs. */
+         run = VG_(OSetGen_Lookup)(rhs_runs, &a1);
+         if (run == 0)
+            return False;
+         a1 = run->last;
       }
+      if (a1 >= last)
+         return True;
+      a1++;
    }
+}
 
-   do
+/**
+ * Return True if every nonempty second-level bitmap in *lhs, including the
+ * pages that are part of a run, has an identical counterpart in *rhs.
+ */
+static Bool bm_pages_match(struct bitmap* const lhs, struct bitmap* const rhs)
+{
+   OSet* const lhs_runs[] = { lhs->runs_r, lhs->runs_w };
+   OSet* const rhs_runs[] = { rhs->runs_r, rhs->runs_w };
+   const struct bitmap2* bm2l;
+   const struct bitmap2* bm2r;
+   const struct bitmap_run* run;
+   unsigned i;
+
+   VG_(OSetGen_ResetIter)(lhs->oset);
+   for ( ; (bm2l = VG_(OSetGen_Next)(lhs->oset)) != 0; )
    {
-      bm2r = VG_(OSetGen_Next)(rhs->oset);
-   } while (bm2r && ! DRD_(bm_has_any_access)(rhs,
-                                              make_address(bm2r->addr, 0),
-                                              make_address(bm2r->addr + 1, 0)));
-   if (bm2r)
+      if (bm1_is_empty(&bm2l->bm1))
+         continue;
+      bm2r = bm2_lookup(rhs, bm2l->addr);
+      if (bm2r == 0 || ! bm1_equal(&bm2l->bm1, &bm2r->bm1))
+         return False;
+   }
+
+   for (i = 0; i < sizeof(lhs_runs) / sizeof(lhs_runs[0]); i++)
    {
-      tl_assert(DRD_(bm_has_any_access)(rhs,
-                                        make_address(bm2r->addr, 0),
-                                        make_address(bm2r->addr + 1, 0)));
-      return False;
+      VG_(OSetGen_ResetIter)(lhs_runs[i]);
+      while ((run = VG_(OSetGen_Next)(lhs_runs[i])) != 0)
+      {
+         if (! bm_run_matches(lhs, rhs, rhs_runs[i], run->first, run->last))
+            return False;
+      }
    }
+
    return True;
 }
 
+/**
+ * Return True if the two bitmaps *lhs and *rhs are identical, and false
+ * if not. Second-level bitmaps are compared by content, so it does not matter
+ * whether a page is represented by a struct bitmap2 or by a run.
+ */
+Bool DRD_(bm_equal)(struct bitmap* const lhs, struct bitmap* const rhs)
+{
+   tl_assert(lhs != rhs);
+
+   return bm_pages_match(lhs, rhs) && bm_pages_match(rhs, lhs);
+}
+
 void DRD_(bm_swap)(struct bitmap* const bm1, struct bitmap* const bm2)
 {
-   OSet* const tmp = bm1->oset;
+   OSet* tmp;
+
+   tmp = bm1->oset;
    bm1->oset = bm2->oset;
    bm2->oset = tmp;
+   tmp = bm1->runs_r;
+   bm1->runs_r = bm2->runs_r;
+   bm2->runs_r = tmp;
+   tmp = bm1->runs_w;
+   bm1->runs_w = bm2->runs_w;
+   bm2->runs_w = tmp;
+   tmp = bm1->runs_m;
+   bm1->runs_m = bm2->runs_m;
+   bm2->runs_m = tmp;
+   bm_cache_invalidate(bm1);
+   bm_cache_invalidate(bm2);
 }
 
 /** Merge bitmaps *lhs and *rhs into *lhs. */
@@ -1019,6 +1497,7 @@ void DRD_(bm_merge2)(struct bitmap* const lhs, struct bitmap* const rhs)
 {
    struct bitmap2* bm2l;
    struct bitmap2* bm2r;
+   const struct bitmap_run* run;
 
    /*
     * It's not possible to have two independent iterators over the same OSet,
@@ -1038,14 +1517,31 @@ void DRD_(bm_merge2)(struct bitmap* const lhs, struct bitmap* const rhs)
          tl_assert(bm2l != bm2r);
          bm2_merge(bm2l, bm2r);
       }
+      else if ((bm2l = DRD_(bm2_lookup_run)(lhs, bm2r->addr)) != 0)
+      {
+         /* Only convert the run page if it does not yet cover *bm2r. */
+         if (! (bm2l == &s_bm2_run[3]
+                || (bm2l == &s_bm2_run[1] && ! bm1_has_any_store(&bm2r->bm1))
+                || (bm2l == &s_bm2_run[2] && ! bm1_has_any_load(&bm2r->bm1))))
+         {
+            bm2_merge(DRD_(bm2_materialize_run)(lhs, bm2r->addr), bm2r);
+         }
+      }
       else
       {
          bm2_insert_copy(lhs, bm2r);
       }
    }
+
+   VG_(OSetGen_ResetIter)(rhs->runs_r);
+   while ((run = VG_(OSetGen_Next)(rhs->runs_r)) != 0)
+      bm_access_pages(lhs, run->first, run->last, eLoad);
+   VG_(OSetGen_ResetIter)(rhs->runs_w);
+   while ((run = VG_(OSetGen_Next)(rhs->runs_w)) != 0)
+      bm_access_pages(lhs, run->first, run->last, eStore);
 }
 
-/** Clear bitmap2::recalc. */
+/** Clear bitmap2::recalc and the marked runs. */
 void DRD_(bm_unmark)(struct bitmap* bm)
 {
    struct bitmap2* bm2;
@@ -1056,6 +1552,12 @@ void DRD_(bm_unmark)(struct bitmap* bm)
    {
       bm2->recalc = False;
    }
+
+   if (VG_(OSetGen_Size)(bm->runs_m))
+   {
+      VG_(OSetGen_Destroy)(bm->runs_m);
+      bm->runs_m = VG_(OSetGen_EmptyClone)(s_run_set_template);
+   }
 }
 
 /**
@@ -1067,12 +1569,14 @@ Bool DRD_(bm_is_marked)(struct bitmap* bm, const Addr a)
    const struct bitmap2* bm2;
 
    bm2 = bm2_lookup(bm, a);
-   return bm2 && bm2->recalc;
+   return (bm2 && bm2->recalc) || bm_run_contains(bm->runs_m, a);
 }
 
 /**
  * Set bitmap2::recalc in bml for each second level bitmap in bmr that contains
- * at least one access.
+ * at least one access. The runs of bmr are added as a whole to the marked runs
+ * of bml, and only the second-level bitmaps that bml already has within these
+ * runs are marked individually.
  *
  * @note Any new second-level bitmaps inserted in bml by this function are
  *       uninitialized.
@@ -1082,6 +1586,10 @@ void DRD_(bm_mark)(struct bitmap* bml, struct bitmap* bmr)
    struct bitmap2* bm2l;
    struct bitmap2* bm2r;
 
+   OSet* const bmr_runs[] = { bmr->runs_r, bmr->runs_w };
+   const struct bitmap_run* run;
+   unsigned i;
+
    for (VG_(OSetGen_ResetIter)(bmr->oset);
         (bm2r = VG_(OSetGen_Next)(bmr->oset)) != 0;
         )
@@ -1089,12 +1597,31 @@ void DRD_(bm_mark)(struct bitmap* bml, struct bitmap* bmr)
       bm2l = bm2_lookup_or_insert(bml, bm2r->addr);
       bm2l->recalc = True;
    }
+
+   for (i = 0; i < sizeof(bmr_runs) / sizeof(bmr_runs[0]); i++)
+   {
+      VG_(OSetGen_ResetIter)(bmr_runs[i]);
+      while ((run = VG_(OSetGen_Next)(bmr_runs[i])) != 0)
+      {
+         bm_run_add(bml->runs_m, run->first, run->last);
+         VG_(OSetGen_ResetIterAt)(bml->oset, &run->first);
+         while ((bm2l = VG_(OSetGen_Next)(bml->oset)) != 0
+                && bm2l->addr <= run->last)
+         {
+            bm2l->recalc = True;
+         }
+      }
+   }
 }
 
-/** Clear all second-level bitmaps for which bitmap2::recalc == True. */
+/**
+ * Clear all second-level bitmaps for which bitmap2::recalc == True and remove
+ * the marked runs from the run sets.
+ */
 void DRD_(bm_clear_marked)(struct bitmap* bm)
 {
    struct bitmap2* bm2;
+   const struct bitmap_run* run;
 
    for (VG_(OSetGen_ResetIter)(bm->oset);
         (bm2 = VG_(OSetGen_Next)(bm->oset)) != 0;
@@ -1103,6 +1630,32 @@ void DRD_(bm_clear_marked)(struct bitmap* bm)
       if (bm2->recalc)
          bm2_clear(bm2);
    }
+
+   VG_(OSetGen_ResetIter)(bm->runs_m);
+   while ((run = VG_(OSetGen_Next)(bm->runs_m)) != 0)
+   {
+      bm_run_remove(bm->runs_r, run->first, run->last);
+      bm_run_remove(bm->runs_w, run->first, run->last);
+   }
+   bm_cache_invalidate(bm);
+}
+
+/**
+ * Record the run [ first .. last ] of rhs in lhs as far as it overlaps with
+ * the marked runs of lhs.
+ */
+static void bm_access_marked_pages(struct bitmap* const lhs,
+                                   const UWord first, const UWord last,
+                                   const BmAccessTypeT access_type)
+{
+   const struct bitmap_run* run;
+
+   VG_(OSetGen_ResetIterAt)(lhs->runs_m, &first);
+   while ((run = VG_(OSetGen_Next)(lhs->runs_m)) != 0 && run->first <= last)
+   {
+      bm_access_pages(lhs, run->first > first ? run->first : first,
+                      run->last < last ? run->last : last, access_type);
+   }
 }
 
 /** Merge the second level bitmaps from *rhs into *lhs for which recalc == True. */
@@ -1110,6 +1663,7 @@ void DRD_(bm_merge2_marked)(struct bitmap* const lhs, struct bitmap* const rhs)
 {
    struct bitmap2* bm2l;
    struct bitmap2* bm2r;
+   const struct bitmap_run* run;
 
    /*
     * It's not possible to have two independent iterators over the same OSet,
@@ -1124,11 +1678,67 @@ void DRD_(bm_merge2_marked)(struct bitmap* const lhs, struct bitmap* const rhs)
    for ( ; (bm2r = VG_(OSetGen_Next)(rhs->oset)) != 0; )
    {
       bm2l = VG_(OSetGen_Lookup)(lhs->oset, &bm2r->addr);
-      if (bm2l && bm2l->recalc)
+      if (bm2l)
       {
-         tl_assert(bm2l != bm2r);
-         bm2_merge(bm2l, bm2r);
+         if (bm2l->recalc)
+         {
+            tl_assert(bm2l != bm2r);
+            bm2_merge(bm2l, bm2r);
+         }
       }
+      else if (bm_run_contains(lhs->runs_m, bm2r->addr))
+      {
+         /*
+          * A marked page without second-level bitmap has either been cleared
+          * or has become part of a run while merging an earlier bitmap.
+          */
+         if ((bm2l = DRD_(bm2_lookup_run)(lhs, bm2r->addr)) != 0)
+         {
+            if (! (bm2l == &s_bm2_run[3]
+                   || (bm2l == &s_bm2_run[1] && ! bm1_has_any_store(&bm2r->bm1))
+                   || (bm2l == &s_bm2_run[2] && ! bm1_has_any_load(&bm2r->bm1))))
+            {
+               bm2l = DRD_(bm2_materialize_run)(lhs, bm2r->addr);
+               bm2_merge(bm2l, bm2r);
+               bm2l->recalc = True;
+            }
+         }
+         else
+         {
+            bm2l = bm2_insert_copy(lhs, bm2r);
+            bm2l->recalc = True;
+         }
+      }
+   }
+
+   /*
+    * Individually marked second-level bitmaps covered by a run of rhs are
+    * updated one by one, and the part of a run that overlaps with the marked
+    * runs of lhs is recorded as a whole.
+    */
+   VG_(OSetGen_ResetIter)(rhs->runs_r);
+   while ((run = VG_(OSetGen_Next)(rhs->runs_r)) != 0)
+   {
+      VG_(OSetGen_ResetIterAt)(lhs->oset, &run->first);
+      while ((bm2l = VG_(OSetGen_Next)(lhs->oset)) != 0
+             && bm2l->addr <= run->last)
+      {
+         if (bm2l->recalc)
+            bm1_set_all(&bm2l->bm1, True, False);
+      }
+      bm_access_marked_pages(lhs, run->first, run->last, eLoad);
+   }
+   VG_(OSetGen_ResetIter)(rhs->runs_w);
+   while ((run = VG_(OSetGen_Next)(rhs->runs_w)) != 0)
+   {
+      VG_(OSetGen_ResetIterAt)(lhs->oset, &run->first);
+      while ((bm2l = VG_(OSetGen_Next)(lhs->oset)) != 0
+             && bm2l->addr <= run->last)
+      {
+         if (bm2l->recalc)
+            bm1_set_all(&bm2l->bm1, False, True);
+      }
+      bm_access_marked_pages(lhs, run->first, run->last, eStore);
    }
 }
 
@@ -1151,6 +1761,68 @@ void DRD_(bm_remove_cleared_marked)(struct bitmap* bm)
    }
 }
 
+/**
+ * Remove the second-level bitmaps of bm that are empty and replace those in
+ * which all addresses have been loaded from and / or stored to by runs. Meant
+ * to be called for segments to which no further accesses will be recorded.
+ */
+void DRD_(bm_compress)(struct bitmap* const bm)
+{
+   struct bitmap2* bm2;
+
+   VG_(OSetGen_ResetIter)(bm->oset);
+   for ( ; (bm2 = VG_(OSetGen_Next)(bm->oset)) != 0; )
+   {
+      const UWord a1 = bm2->addr;
+      Bool r, w;
+
+      if (bm1_is_uniform(&bm2->bm1, &r, &w))
+      {
+         bm2_remove(bm, a1);
+         if (r)
+            bm_run_add(bm->runs_r, a1, a1);
+         if (w)
+            bm_run_add(bm->runs_w, a1, a1);
+         s_run_page_count += r || w;
+         VG_(OSetGen_ResetIterAt)(bm->oset, &a1);
+      }
+   }
+   bm_cache_invalidate(bm);
+}
+
+/**
+ * Report whether any of the pages that are part of a run of x and also part of
+ * a run of y contain an address for which races are not suppressed, where at
+ * least one of x and y is a run set of stores.
+ */
+static Bool bm_runs_have_races(OSet* const x, OSet* const y)
+{
+   const struct bitmap_run* rx;
+   const struct bitmap_run* ry;
+
+   VG_(OSetGen_ResetIter)(x);
+   VG_(OSetGen_ResetIter)(y);
+   rx = VG_(OSetGen_Next)(x);
+   ry = VG_(OSetGen_Next)(y);
+   while (rx && ry)
+   {
+      const UWord first = rx->first > ry->first ? rx->first : ry->first;
+      const UWord last  = rx->last  < ry->last  ? rx->last  : ry->last;
+
+      if (first <= last
+          && ! DRD_(is_suppressed)(make_address(first, 0),
+                                   make_address(last + 1, 0)))
+      {
+         return True;
+      }
+      if (rx->last < ry->last)
+         rx = VG_(OSetGen_Next)(x);
+      else
+         ry = VG_(OSetGen_Next)(y);
+   }
+   return False;
+}
+
 /**
  * Report whether there are any RW / WR / WW patterns in lhs and rhs.
  * @param lhs First bitmap.
@@ -1159,17 +1831,19 @@ void DRD_(bm_remove_cleared_marked)(struct bitmap* bm)
  */
 int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
 {
+   OSet* const lhs_runs[] = { lhs->runs_r, lhs->runs_w };
+   OSet* const rhs_runs[] = { rhs->runs_r, rhs->runs_w };
+   const struct bitmap2* bm2l;
+   const struct bitmap2* bm2r;
+   const struct bitmap_run* run;
+   unsigned i;
+
+   /* Second-level bitmaps present in both lhs->oset and rhs->oset. */
    VG_(OSetGen_ResetIter)(lhs->oset);
    VG_(OSetGen_ResetIter)(rhs->oset);
 
    for (;;)
    {
-      const struct bitmap2* bm2l;
-      const struct bitmap2* bm2r;
-      const struct bitmap1* bm1l;
-      const struct bitmap1* bm1r;
-      unsigned k;
-
       bm2l = VG_(OSetGen_Next)(lhs->oset);
       bm2r = VG_(OSetGen_Next)(rhs->oset);
       while (bm2l && bm2r && bm2l->addr != bm2r->addr)
@@ -1182,52 +1856,90 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
       if (bm2l == 0 || bm2r == 0)
          break;
 
-      bm1l = &bm2l->bm1;
-      bm1r = &bm2r->bm1;
+      if (bm1_has_races(bm2l->addr, &bm2l->bm1, &bm2r->bm1))
+         return 1;
+   }
 
-      for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   /* Second-level bitmaps of one bitmap that overlap with runs of the other. */
+   for (i = 0; i < sizeof(rhs_runs) / sizeof(rhs_runs[0]); i++)
+   {
+      VG_(OSetGen_ResetIter)(rhs_runs[i]);
+      while ((run = VG_(OSetGen_Next)(rhs_runs[i])) != 0)
       {
-         unsigned b;
-         for (b = 0; b < BITS_PER_UWORD; b++)
+         VG_(OSetGen_ResetIterAt)(lhs->oset, &run->first);
+         while ((bm2l = VG_(OSetGen_Next)(lhs->oset)) != 0
+                && bm2l->addr <= run->last)
          {
-            UWord const access_mask
-               = ((bm1l->bm0_r[k] & bm0_mask(b)) ? LHS_R : 0)
-               | ((bm1l->bm0_w[k] & bm0_mask(b)) ? LHS_W : 0)
-               | ((bm1r->bm0_r[k] & bm0_mask(b)) ? RHS_R : 0)
-               | ((bm1r->bm0_w[k] & bm0_mask(b)) ? RHS_W : 0);
-            Addr const a = make_address(bm2l->addr, k * BITS_PER_UWORD | b);
-            if (HAS_RACE(access_mask) && ! DRD_(is_suppressed)(a, a + 1))
-            {
+            bm2r = DRD_(bm2_lookup_run)(rhs, bm2l->addr);
+            if (bm1_has_races(bm2l->addr, &bm2l->bm1, &bm2r->bm1))
+               return 1;
+         }
+      }
+   }
+   for (i = 0; i < sizeof(lhs_runs) / sizeof(lhs_runs[0]); i++)
+   {
+      VG_(OSetGen_ResetIter)(lhs_runs[i]);
+      while ((run = VG_(OSetGen_Next)(lhs_runs[i])) != 0)
+      {
+         VG_(OSetGen_ResetIterAt)(rhs->oset, &run->first);
+         while ((bm2r = VG_(OSetGen_Next)(rhs->oset)) != 0
+                && bm2r->addr <= run->last)
+         {
+            bm2l = DRD_(bm2_lookup_run)(lhs, bm2r->addr);
+            if (bm1_has_races(bm2r->addr, &bm2l->bm1, &bm2r->bm1))
                return 1;
-            }
          }
       }
    }
+
+   /* Pages that are part of a run in both bitmaps. */
+   if (bm_runs_have_races(lhs->runs_w, rhs->runs_r)
+       || bm_runs_have_races(lhs->runs_w, rhs->runs_w)
+       || bm_runs_have_races(lhs->runs_r, rhs->runs_w))
+   {
+      return 1;
+   }
+
    return 0;
 }
 
 void DRD_(bm_print)(struct bitmap* const bm)
 {
    struct bitmap2* bm2;
+   const struct bitmap_run* run;
+   UWord a1;
 
    for (VG_(OSetGen_ResetIter)(bm->oset);
         (bm2 = VG_(OSetGen_Next)(bm->oset)) != 0;
         )
    {
-      bm2_print(bm2);
+      bm1_print(bm2->addr, &bm2->bm1);
+   }
+   /* Pages that are part of both a load and a store run are printed twice. */
+   for (VG_(OSetGen_ResetIter)(bm->runs_r);
+        (run = VG_(OSetGen_Next)(bm->runs_r)) != 0;
+        )
+   {
+      for (a1 = run->first; a1 <= run->last; a1++)
+         bm1_print(a1, &DRD_(bm2_lookup_run)(bm, a1)->bm1);
+   }
+   for (VG_(OSetGen_ResetIter)(bm->runs_w);
+        (run = VG_(OSetGen_Next)(bm->runs_w)) != 0;
+        )
+   {
+      for (a1 = run->first; a1 <= run->last; a1++)
+         bm1_print(a1, &DRD_(bm2_lookup_run)(bm, a1)->bm1);
    }
 }
 
-static void bm2_print(const struct bitmap2* const bm2)
+static void bm1_print(const UWord a1, const struct bitmap1* const bm1)
 {
-   const struct bitmap1* bm1;
    Addr a;
 
-   tl_assert(bm2);
+   tl_assert(bm1);
 
-   bm1 = &bm2->bm1;
-   for (a = make_address(bm2->addr, 0);
-        a <= make_address(bm2->addr + 1, 0) - 1;
+   for (a = make_address(a1, 0);
+        a <= make_address(a1 + 1, 0) - 1;
         a++)
    {
       const Bool r = bm0_is_set(bm1->bm0_r, address_lsb(a)) != 0;
@@ -1257,24 +1969,20 @@ ULong DRD_(bm_get_bitmap2_merge_count)(void)
    return s_bitmap2_merge_count;
 }
 
+ULong DRD_(bm_get_run_page_count)(void)
+{
+   return s_run_page_count;
+}
+
 /** Compute *bm2l |= *bm2r. */
 static
 void bm2_merge(struct bitmap2* const bm2l, const struct bitmap2* const bm2r)
 {
-   unsigned k;
-
    tl_assert(bm2l);
    tl_assert(bm2r);
    tl_assert(bm2l->addr == bm2r->addr);
 
    s_bitmap2_merge_count++;
 
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
-   {
-      bm2l->bm1.bm0_r[k] |= bm2r->bm1.bm0_r[k];
-   }
-   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
-   {
-      bm2l->bm1.bm0_w[k] |= bm2r->bm1.bm0_w[k];
-   }
+   bm1_merge(&bm2l->bm1, &bm2r->bm1);
 }
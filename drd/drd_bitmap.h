@@ -221,13 +221,55 @@ static ULong s_bitmap2_creation_count;
 /*********************************************************************/
 
 
+/**
+ * Log2 of the number of bm0_r[] / bm0_w[] elements that correspond to a
+ * single bit in bitmap1::summary.
+ */
+#define BM0_SUMMARY_SHIFT (ADDR_LSB_BITS - 2 * BITS_PER_BITS_PER_UWORD)
+
+/** Number of bm0_r[] / bm0_w[] elements per bit in bitmap1::summary. */
+#define BM0_SUMMARY_UWORDS (1U << BM0_SUMMARY_SHIFT)
+
 /* Lowest level, corresponding to the lowest ADDR_LSB_BITS of an address. */
 struct bitmap1
 {
    UWord bm0_r[BITMAP1_UWORD_COUNT];
    UWord bm0_w[BITMAP1_UWORD_COUNT];
+   /**
+    * Bit i is set if any of the elements
+    * [ i << BM0_SUMMARY_SHIFT .. (i + 1) << BM0_SUMMARY_SHIFT [ of bm0_r[] or
+    * bm0_w[] may be nonzero. Summary bits are set when an access is recorded
+    * and are only reset when the whole bitmap1 is cleared, so a summary bit
+    * that is zero guarantees that the corresponding elements are zero.
+    */
+   UWord summary;
 };
 
+/** Summary bit for the bm0 element that holds the bit for address a. */
+static __inline__ UWord bm0_summary_mask(const UWord a)
+{
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(address_msb(make_address(0, a)) == 0);
+#endif
+   return (UWord)1 << (uword_msb(a) >> BM0_SUMMARY_SHIFT);
+}
+
+/**
+ * Summary bits for the bm0 elements that hold the bits for the addresses
+ * in the range [ a1 << ADDR_IGNORED_BITS .. a2 << ADDR_IGNORED_BITS ].
+ */
+static __inline__ UWord bm0_summary_range_mask(const UWord a1, const UWord a2)
+{
+   const UWord s1 = uword_msb(a1) >> BM0_SUMMARY_SHIFT;
+   const UWord s2 = uword_msb(a2) >> BM0_SUMMARY_SHIFT;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a1 <= a2);
+   tl_assert(address_msb(make_address(0, a2)) == 0);
+#endif
+   return (~(UWord)0 << s1) & (~(UWord)0 >> (BITS_PER_UWORD - 1 - s2));
+}
+
 static __inline__ UWord bm0_mask(const UWord a)
 {
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
@@ -323,6 +365,65 @@ static __inline__ UWord bm0_is_any_set(const UWord* bm0,
    return (bm0[uword_msb(a)] & ((((UWord)1 << size) - 1) << uword_lsb(a)));
 }
 
+/**
+ * Set the bits corresponding to all of the addresses in range
+ * [ a1 << ADDR_IGNORED_BITS .. a2 << ADDR_IGNORED_BITS ] in bm0. In contrast
+ * to bm0_set_range() the range may span multiple bm0 elements.
+ */
+static __inline__ void bm0_set_range_any(UWord* bm0,
+                                         const UWord a1, const UWord a2)
+{
+   const UWord k1 = uword_msb(a1);
+   const UWord k2 = uword_msb(a2);
+   const UWord m1 = ~(UWord)0 << uword_lsb(a1);
+   const UWord m2 = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a2));
+   UWord k;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a1 <= a2);
+   tl_assert(address_msb(make_address(0, a2)) == 0);
+#endif
+   if (k1 == k2)
+   {
+      bm0[k1] |= m1 & m2;
+      return;
+   }
+   bm0[k1] |= m1;
+   for (k = k1 + 1; k < k2; k++)
+      bm0[k] = ~(UWord)0;
+   bm0[k2] |= m2;
+}
+
+/**
+ * Return true if a bit corresponding to any of the addresses in range
+ * [ a1 << ADDR_IGNORED_BITS .. a2 << ADDR_IGNORED_BITS ] is set in bm0. In
+ * contrast to bm0_is_any_set() the range may span multiple bm0 elements.
+ */
+static __inline__ UWord bm0_is_any_set_in_range(const UWord* bm0,
+                                                const UWord a1, const UWord a2)
+{
+   const UWord k1 = uword_msb(a1);
+   const UWord k2 = uword_msb(a2);
+   const UWord m1 = ~(UWord)0 << uword_lsb(a1);
+   const UWord m2 = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a2));
+   UWord k;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a1 <= a2);
+   tl_assert(address_msb(make_address(0, a2)) == 0);
+#endif
+   if (k1 == k2)
+      return bm0[k1] & m1 & m2;
+   if (bm0[k1] & m1)
+      return 1;
+   for (k = k1 + 1; k < k2; k++)
+   {
+      if (bm0[k])
+         return 1;
+   }
+   return bm0[k2] & m2;
+}
+
 
 
 /*********************************************************************/
@@ -338,10 +439,19 @@ struct bitmap2
    struct bitmap1 bm1;
 };
 
+/**
+ * Value of bitmap2::addr for the shared read-only second-level bitmaps that
+ * represent a page that is part of a run. See also DRD_(bm2_lookup_run)().
+ */
+#define BM2_RUN_ADDR (~(Addr)0)
+
 
 static void bm2_clear(struct bitmap2* const bm2);
 static __inline__
 struct bitmap2* bm2_insert(struct bitmap* const bm, const UWord a1);
+struct bitmap2* DRD_(bm2_lookup_run)(struct bitmap* const bm, const UWord a1);
+struct bitmap2* DRD_(bm2_materialize_run)(struct bitmap* const bm,
+                                          const UWord a1);
 
 
 
@@ -454,6 +564,35 @@ Bool bm_cache_lookup(struct bitmap* const bm, const UWord a1,
    return False;
 }
 
+/**
+ * Invalidate all cache entries. Must be called after the run sets of a bitmap
+ * have been modified since cache entries may refer to the shared second-level
+ * bitmaps that represent runs.
+ */
+static __inline__
+void bm_cache_invalidate(struct bitmap* const bm)
+{
+   unsigned i;
+
+   /*
+    * a1 is set to a value that never can match any valid address: the upper
+    * (ADDR_LSB_BITS + ADDR_IGNORED_BITS) bits of a1 are always zero for a
+    * valid cache entry.
+    */
+   for (i = 0; i < DRD_BITMAP_N_CACHE_ELEM; i++)
+   {
+      bm->cache[i].a1  = ~(UWord)1;
+      bm->cache[i].bm2 = 0;
+   }
+}
+
+/** Whether bm2 is one of the shared second-level bitmaps for run pages. */
+static __inline__
+Bool bm2_is_run(const struct bitmap2* const bm2)
+{
+   return bm2->addr == BM2_RUN_ADDR;
+}
+
 static __inline__
 void bm_update_cache(struct bitmap* const bm,
                      const UWord a1,
@@ -494,7 +633,8 @@ void bm_update_cache(struct bitmap* const bm,
 /**
  * Look up the address a1 in bitmap bm and return a pointer to a potentially
  * shared second level bitmap. The bitmap where the returned pointer points
- * at may not be modified by the caller.
+ * at may not be modified by the caller. If a1 is part of a run, the returned
+ * pointer points at a shared bitmap for which bitmap2::addr == BM2_RUN_ADDR.
  *
  * @param a1 client address shifted right by ADDR_LSB_BITS.
  * @param bm bitmap pointer.
@@ -511,6 +651,8 @@ const struct bitmap2* bm2_lookup(struct bitmap* const bm, const UWord a1)
    if (! bm_cache_lookup(bm, a1, &bm2))
    {
       bm2 = VG_(OSetGen_Lookup)(bm->oset, &a1);
+      if (! bm2)
+         bm2 = DRD_(bm2_lookup_run)(bm, a1);
       bm_update_cache(bm, a1, bm2);
    }
    return bm2;
@@ -536,7 +678,11 @@ bm2_lookup_exclusive(struct bitmap* const bm, const UWord a1)
    if (! bm_cache_lookup(bm, a1, &bm2))
    {
       bm2 = VG_(OSetGen_Lookup)(bm->oset, &a1);
+      if (! bm2)
+         bm2 = DRD_(bm2_lookup_run)(bm, a1);
    }
+   if (bm2 && bm2_is_run(bm2))
+      bm2 = DRD_(bm2_materialize_run)(bm, a1);
 
    return bm2;
 }
@@ -613,14 +759,25 @@ struct bitmap2* bm2_lookup_or_insert(struct bitmap* const bm, const UWord a1)
          bm2 = bm2_insert(bm, a1);
          bm2_clear(bm2);
       }
+      else if (bm2_is_run(bm2))
+      {
+         bm2 = DRD_(bm2_materialize_run)(bm, a1);
+      }
    }
    else
    {
       bm2 = VG_(OSetGen_Lookup)(bm->oset, &a1);
       if (! bm2)
       {
-         bm2 = bm2_insert(bm, a1);
-         bm2_clear(bm2);
+         if (DRD_(bm2_lookup_run)(bm, a1))
+         {
+            bm2 = DRD_(bm2_materialize_run)(bm, a1);
+         }
+         else
+         {
+            bm2 = bm2_insert(bm, a1);
+            bm2_clear(bm2);
+         }
       }
       bm_update_cache(bm, a1, bm2);
    }
@@ -670,6 +827,7 @@ void bm_access_aligned_load(struct bitmap* const bm,
    bm0_set_range(bm2->bm1.bm0_r,
                  (a1 >> ADDR_IGNORED_BITS) & ADDR_LSB_MASK,
                  SCALED_SIZE(size));
+   bm2->bm1.summary |= bm0_summary_mask(address_lsb(a1));
 }
 
 static __inline__
@@ -686,6 +844,7 @@ void bm_access_aligned_store(struct bitmap* const bm,
    bm0_set_range(bm2->bm1.bm0_w,
                  (a1 >> ADDR_IGNORED_BITS) & ADDR_LSB_MASK,
                  SCALED_SIZE(size));
+   bm2->bm1.summary |= bm0_summary_mask(address_lsb(a1));
 }
 
 static __inline__
@@ -34,6 +34,7 @@
 #include "drd_thread.c"
 #include "drd_vc.c"
 #include "libvex_guest_offsets.h"
+#include "pub_tool_sampler.h"     /* VG_(mk_sample_guard)() */
 
 
 /* STACK_POINTER_OFFSET: VEX register offset for the stack pointer register. */
@@ -66,6 +67,7 @@
 
 static Bool s_check_stack_accesses = False;
 static Bool s_first_race_only      = False;
+static UInt s_sample_accesses      = 1;
 
 
 /* Function definitions. */
@@ -92,6 +94,18 @@ void DRD_(set_first_race_only)(const Bool fro)
    s_first_race_only = fro;
 }
 
+UInt DRD_(get_sample_accesses)(void)
+{
+   return s_sample_accesses;
+}
+
+void DRD_(set_sample_accesses)(const UInt n)
+{
+   tl_assert(n >= 1);
+   s_sample_accesses = n;
+   VG_(sampler_set_rate)(n);
+}
+
 void DRD_(trace_mem_access)(const Addr addr, const SizeT size,
                             const BmAccessTypeT access_type,
                             const HWord stored_value_hi,
@@ -472,9 +486,38 @@ static void instr_trace_mem_store(IRSB* const bb, IRExpr* const addr_expr,
    addStmtToIRSB(bb, IRStmt_Dirty(di) );
 }
 
+/**
+ * Return an atom that is the logical and of two guards. NULL means true.
+ */
+static IRExpr* instr_and_guard(IRSB* const bb, IRExpr* const g1,
+                               IRExpr* const g2)
+{
+   IRTemp w1, w2, w, res;
+
+   if (!g1)
+      return g2;
+   if (!g2)
+      return g1;
+   tl_assert(isIRAtom(g1));
+   tl_assert(isIRAtom(g2));
+   w1 = newIRTemp(bb->tyenv, Ity_I32);
+   w2 = newIRTemp(bb->tyenv, Ity_I32);
+   w = newIRTemp(bb->tyenv, Ity_I32);
+   res = newIRTemp(bb->tyenv, Ity_I1);
+   addStmtToIRSB(bb, IRStmt_WrTmp(w1, IRExpr_Unop(Iop_1Uto32, g1)));
+   addStmtToIRSB(bb, IRStmt_WrTmp(w2, IRExpr_Unop(Iop_1Uto32, g2)));
+   addStmtToIRSB(bb, IRStmt_WrTmp(w, IRExpr_Binop(Iop_And32,
+                                                  IRExpr_RdTmp(w1),
+                                                  IRExpr_RdTmp(w2))));
+   addStmtToIRSB(bb, IRStmt_WrTmp(res, IRExpr_Unop(Iop_32to1,
+                                                   IRExpr_RdTmp(w))));
+   return IRExpr_RdTmp(res);
+}
+
 static void instrument_load(IRSB* const bb, IRExpr* const addr_expr,
                             const HWord size,
-                            IRExpr* const guard/* NULL => True */)
+                            IRExpr* guard/* NULL => True */,
+                            IRExpr* const sampled/* NULL => True */)
 {
    IRExpr* size_expr;
    IRExpr** argv;
@@ -522,13 +565,15 @@ static void instrument_load(IRSB* const bb, IRExpr* const addr_expr,
                              argv);
       break;
    }
+   guard = instr_and_guard(bb, guard, sampled);
    if (guard) di->guard = guard;
    addStmtToIRSB(bb, IRStmt_Dirty(di));
 }
 
 static void instrument_store(IRSB* const bb, IRExpr* addr_expr,
                              IRExpr* const data_expr,
-                             IRExpr* const guard_expr/* NULL => True */)
+                             IRExpr* guard_expr/* NULL => True */,
+                             IRExpr* const sampled/* NULL => True */)
 {
    IRExpr* size_expr;
    IRExpr** argv;
@@ -586,6 +631,7 @@ static void instrument_store(IRSB* const bb, IRExpr* addr_expr,
                              argv);
       break;
    }
+   guard_expr = instr_and_guard(bb, guard_expr, sampled);
    if (guard_expr) di->guard = guard_expr;
    addStmtToIRSB(bb, IRStmt_Dirty(di));
 }
@@ -603,6 +649,8 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
    IRSB*    bb;
    IRExpr** argv;
    Bool     instrument = True;
+   Bool     sample;
+   IRExpr*  sampled = NULL;
 
    /* Set up BB */
    bb           = emptyIRSB();
@@ -611,6 +659,8 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
    bb->jumpkind = bb_in->jumpkind;
    bb->offsIP   = bb_in->offsIP;
 
+   sample = s_sample_accesses > 1 && VG_(sb_accesses_memory)(bb_in);
+
    for (i = 0; i < bb_in->stmts_used; i++)
    {
       IRStmt* const st = bb_in->stmts[i];
@@ -629,6 +679,13 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
          instrument = VG_(DebugInfo_sect_kind)(NULL, st->Ist.IMark.addr)
             != Vg_SectPLT;
          addStmtToIRSB(bb, st);
+         /*
+          * With --sample-accesses, decide once per superblock execution
+          * whether its memory accesses are checked. Synchronization
+          * operations are intercepted elsewhere and are always processed.
+          */
+         if (sample && !sampled)
+            sampled = VG_(mk_sample_guard)(bb, vge->base[0]);
          break;
 
       case Ist_MBE:
@@ -647,7 +704,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
       case Ist_Store:
          if (instrument)
             instrument_store(bb, st->Ist.Store.addr, st->Ist.Store.data,
-                             NULL/* no guard */);
+                             NULL/* no guard */, sampled);
          addStmtToIRSB(bb, st);
          break;
 
@@ -656,7 +713,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
          IRExpr*   data = sg->data;
          IRExpr*   addr = sg->addr;
          if (instrument)
-            instrument_store(bb, addr, data, sg->guard);
+            instrument_store(bb, addr, data, sg->guard, sampled);
          addStmtToIRSB(bb, st);
          break;
       }
@@ -673,7 +730,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                                              sizeofIRType(type), lg->guard);
          }
          instrument_load(bb, lg->addr,
-                         sizeofIRType(type), lg->guard);
+                         sizeofIRType(type), lg->guard, sampled);
          addStmtToIRSB(bb, st);
          break;
       }
@@ -689,7 +746,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                                        NULL/* no guard */);
                }
                instrument_load(bb, addr_expr, sizeofIRType(data->Iex.Load.ty),
-                               NULL/* no guard */);
+                               NULL/* no guard */, sampled);
             }
          }
          addStmtToIRSB(bb, st);
@@ -714,6 +771,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                           "drd_trace_load",
                           VG_(fnptr_to_fnentry)(DRD_(trace_load)),
                           argv);
+                  if (sampled) di->guard = sampled;
                   addStmtToIRSB(bb, IRStmt_Dirty(di));
                }
                if (mFx == Ifx_Write || mFx == Ifx_Modify)
@@ -723,6 +781,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                           "drd_trace_store",
                           VG_(fnptr_to_fnentry)(DRD_(trace_store)),
                           argv);
+                  if (sampled) di->guard = sampled;
                   addStmtToIRSB(bb, IRStmt_Dirty(di));
                }
                break;
@@ -756,7 +815,8 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                instr_trace_mem_store(bb, cas->addr, cas->dataHi, cas->dataLo,
                                      NULL/* no guard */);
 
-            instrument_load(bb, cas->addr, dataSize, NULL/*no guard*/);
+            instrument_load(bb, cas->addr, dataSize, NULL/*no guard*/,
+                            sampled);
          }
          addStmtToIRSB(bb, st);
          break;
@@ -779,7 +839,7 @@ IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                                                    NULL /* no guard */);
 
                instrument_load(bb, addr_expr, sizeofIRType(dataTy),
-                               NULL/*no guard*/);
+                               NULL/*no guard*/, sampled);
             }
          } else {
             /* SC */
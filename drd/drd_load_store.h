@@ -39,6 +39,8 @@ Bool DRD_(get_check_stack_accesses)(void);
 void DRD_(set_check_stack_accesses)(const Bool c);
 Bool DRD_(get_first_race_only)(void);
 void DRD_(set_first_race_only)(const Bool fro);
+UInt DRD_(get_sample_accesses)(void);
+void DRD_(set_sample_accesses)(const UInt n);
 IRSB* DRD_(instrument)(VgCallbackClosure* const closure,
                        IRSB* const bb_in,
                        const VexGuestLayout* const layout,
@@ -48,6 +48,7 @@
 #include "pub_tool_mallocfree.h"  // VG_(malloc)(), VG_(free)()
 #include "pub_tool_options.h"     // command line options
 #include "pub_tool_replacemalloc.h"
+#include "pub_tool_sampler.h"     // VG_(sampler_stats)()
 #include "pub_tool_threadstate.h" // VG_(get_running_tid)()
 #include "pub_tool_tooliface.h"
 #include "pub_tool_aspacemgr.h"   // VG_(am_is_valid_for_client)
@@ -72,6 +73,7 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    int exclusive_threshold_ms = -1;
    int first_race_only        = -1;
    int report_signal_unlocked = -1;
+   int sample_accesses        = -1;
    int segment_merging        = -1;
    int segment_merge_interval = -1;
    int shared_threshold_ms    = -1;
@@ -99,6 +101,8 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--free-is-write",       DRD_(g_free_is_write)) {}
    else if VG_BOOL_CLO(arg,"--report-signal-unlocked",report_signal_unlocked)
    {}
+   else if VG_BINT_CLO(arg, "--sample-accesses",     sample_accesses,
+                       1, 1 << 20) {}
    else if VG_BOOL_CLO(arg, "--segment-merging",     segment_merging) {}
    else if VG_INT_CLO (arg, "--segment-merging-interval", segment_merge_interval)
    {}
@@ -148,6 +152,8 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    {
       DRD_(cond_set_report_signal_unlocked)(report_signal_unlocked);
    }
+   if (sample_accesses != -1)
+      DRD_(set_sample_accesses)(sample_accesses);
    if (shared_threshold_ms != -1)
    {
       DRD_(rwlock_set_shared_threshold)(shared_threshold_ms);
@@ -218,6 +224,11 @@ static void DRD_(print_usage)(void)
 "                              pthread_cond_signal() where the mutex associated\n"
 "                              with the signal via pthread_cond_wait() is not\n"
 "                              locked at the time the signal is sent [yes].\n"
+"    --sample-accesses=<n>     Only check the memory accesses of about one out\n"
+"        of every n executions of a code block. Rarely executed code is\n"
+"        checked every time it runs and synchronization operations are always\n"
+"        tracked, so most races on cold paths are still found at a fraction\n"
+"        of the cost [1].\n"
 "    --segment-merging=yes|no  Controls segment merging [yes].\n"
 "        Segment merging is an algorithm to limit memory usage of the\n"
 "        data race detection algorithm. Disabling segment merging may\n"
@@ -772,6 +783,7 @@ static void DRD_(fini)(Int exitcode)
       ULong pu_seg_cr = DRD_(thread_get_update_conflict_set_new_sg_count)();
       ULong pu_mtx_cv = DRD_(thread_get_update_conflict_set_sync_count)();
       ULong pu_join   = DRD_(thread_get_update_conflict_set_join_count)();
+      ULong pu_switch = DRD_(thread_get_update_conflict_set_switch_count)();
 
       VG_(message)(Vg_UserMsg,
                    "   thread: %llu context switches.\n",
@@ -787,8 +799,11 @@ static void DRD_(fini)(Int exitcode)
                    "           %llu because of mutex/sema/cond.var. operations,\n",
                    pu_mtx_cv);
       VG_(message)(Vg_UserMsg,
-                   "           %llu because of barrier/rwlock operations and\n",
-		   pu - pu_seg_cr - pu_mtx_cv - pu_join);
+                   "           %llu because of barrier/rwlock operations,\n",
+		   pu - pu_seg_cr - pu_mtx_cv - pu_join - pu_switch);
+      VG_(message)(Vg_UserMsg,
+                   "           %llu because of context switches and\n",
+                   pu_switch);
       VG_(message)(Vg_UserMsg,
                    "           %llu partial updates because of thread join"
                    " operations.\n",
@@ -813,6 +828,22 @@ static void DRD_(fini)(Int exitcode)
                    " and %llu level two bitmaps were allocated.\n",
                    DRD_(bm_get_bitmap_creation_count)(),
                    DRD_(bm_get_bitmap2_creation_count)());
+      VG_(message)(Vg_UserMsg,
+                   "           %llu level two bitmaps were stored as runs.\n",
+                   DRD_(bm_get_run_page_count)());
+      VG_(message)(Vg_UserMsg,
+                   "       vc: %llu shared vector clock copies and %llu"
+                   " copy-on-write copies.\n",
+                   DRD_(vc_get_shared_copy_count)(),
+                   DRD_(vc_get_unshare_count)());
+      if (DRD_(get_sample_accesses)() > 1) {
+         ULong sampled, skipped;
+
+         VG_(sampler_stats)(&sampled, &skipped);
+         VG_(message)(Vg_UserMsg,
+                      "   sample: %llu sampled and %llu skipped code block"
+                      " executions.\n", sampled, skipped);
+      }
       VG_(message)(Vg_UserMsg,
                    "    mutex: %llu non-recursive lock/unlock events.\n",
                    DRD_(get_mutex_lock_count)());
@@ -79,6 +79,7 @@ static void sg_init(Segment* const sg,
    sg->thr_prev = NULL;
    sg->tid = created;
    sg->refcnt = 1;
+   sg->in_conflict_set = False;
 
    if (vg_created != VG_INVALID_THREADID && VG_(get_SP)(vg_created) != 0)
       sg->stacktrace = VG_(record_ExeContext)(vg_created, 0);
@@ -220,6 +221,8 @@ void DRD_(sg_merge)(Segment* const sg1, Segment* const sg2)
 
    // Keep sg1->stacktrace.
    // Keep sg1->vc.
+   // Keep sg1->in_conflict_set: sg1 and sg2 are ordered consistently against
+   // the latest segment of the running thread.
    // Merge sg2->bm into sg1->bm.
    DRD_(bm_merge2)(&sg1->bm, &sg2->bm);
 }
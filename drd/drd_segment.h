@@ -49,6 +49,11 @@ typedef struct segment
    DrdThreadId        tid;
    /** Reference count: number of pointers that point to this segment. */
    int                refcnt;
+   /**
+    * Whether the accesses of this segment have been merged into the conflict
+    * set of the running thread.
+    */
+   Bool               in_conflict_set;
    /** Stack trace of the first instruction of the segment. */
    ExeContext*        stacktrace;
    /** Vector clock associated with the segment. */
@@ -49,7 +49,18 @@ static void thread_append_segment(const DrdThreadId tid, Segment* const sg);
 static void thread_discard_segment(const DrdThreadId tid, Segment* const sg);
 static void thread_compute_conflict_set(struct bitmap** conflict_set,
                                         const DrdThreadId tid);
+static void thread_switch_conflict_set(const DrdThreadId tid);
+static void thread_withdraw_from_conflict_set(const DrdThreadId tid);
+static Bool thread_conflict_set_includes(const DrdThreadId tid,
+                                         const Segment* const p,
+                                         const DrdThreadId j,
+                                         const Segment* const q);
+static Bool thread_set_conflict_set_contribution(const DrdThreadId j,
+                                                 Segment* const q,
+                                                 const Bool included);
+static void thread_recalc_marked_conflict_set(const DrdThreadId tid);
 static Bool thread_conflict_set_up_to_date(const DrdThreadId tid);
+static void thread_set_conflict_set_vc(const VectorClock* const vc);
 
 
 /* Local variables. */
@@ -61,12 +72,16 @@ static ULong    s_update_conflict_set_count;
 static ULong    s_update_conflict_set_new_sg_count;
 static ULong    s_update_conflict_set_sync_count;
 static ULong    s_update_conflict_set_join_count;
+static ULong    s_update_conflict_set_switch_count;
 static ULong    s_conflict_set_bitmap_creation_count;
 static ULong    s_conflict_set_bitmap2_creation_count;
 static ThreadId s_vg_running_tid  = VG_INVALID_THREADID;
 DrdThreadId     DRD_(g_drd_running_tid) = DRD_INVALID_THREADID;
 ThreadInfo*     DRD_(g_threadinfo);
 struct bitmap*  DRD_(g_conflict_set);
+/* Vector clock the in_conflict_set flags of all segments are relative to. */
+static VectorClock s_conflict_set_vc;
+static Bool     s_conflict_set_vc_valid;
 Bool DRD_(verify_conflict_set);
 static Bool     s_trace_context_switches = False;
 static Bool     s_trace_conflict_set = False;
@@ -520,6 +535,7 @@ void DRD_(thread_delete)(const DrdThreadId tid, const Bool detached)
    tl_assert(DRD_(IsValidDrdThreadId)(tid));
 
    tl_assert(DRD_(g_threadinfo)[tid].synchr_nesting >= 0);
+   thread_withdraw_from_conflict_set(tid);
    for (sg = DRD_(g_threadinfo)[tid].sg_last; sg; sg = sg_prev) {
       sg_prev = sg->thr_prev;
       sg->thr_next = NULL;
@@ -585,6 +601,10 @@ void DRD_(drd_thread_atfork_child)(const DrdThreadId tid)
 
    DRD_(bm_cleanup)(DRD_(g_conflict_set));
    DRD_(bm_init)(DRD_(g_conflict_set));
+   if (s_conflict_set_vc_valid) {
+      DRD_(vc_cleanup)(&s_conflict_set_vc);
+      s_conflict_set_vc_valid = False;
+   }
 }
 
 /** Called just before pthread_cancel(). */
@@ -781,8 +801,9 @@ void DRD_(thread_set_running_tid)(const ThreadId vg_tid,
       }
       s_vg_running_tid = vg_tid;
       DRD_(g_drd_running_tid) = drd_tid;
-      thread_compute_conflict_set(&DRD_(g_conflict_set), drd_tid);
+      thread_switch_conflict_set(drd_tid);
       s_context_switch_count++;
+      tl_assert(thread_conflict_set_up_to_date(drd_tid));
    }
 
    tl_assert(s_vg_running_tid != VG_INVALID_THREADID);
@@ -821,6 +842,8 @@ int DRD_(thread_get_synchr_nesting_count)(const DrdThreadId tid)
 static
 void thread_append_segment(const DrdThreadId tid, Segment* const sg)
 {
+   const DrdThreadId running_tid = DRD_(g_drd_running_tid);
+
    tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
              && tid != DRD_INVALID_THREADID);
 
@@ -828,6 +851,19 @@ void thread_append_segment(const DrdThreadId tid, Segment* const sg)
    tl_assert(DRD_(sane_ThreadInfo)(&DRD_(g_threadinfo)[tid]));
 #endif
 
+   /*
+    * A new segment does not contain any accesses yet, so there is no need to
+    * update the conflict set itself.
+    */
+   if (DRD_(g_conflict_set) && DRD_(IsValidDrdThreadId)(running_tid)
+       && DRD_(g_threadinfo)[running_tid].sg_last)
+   {
+      sg->in_conflict_set
+         = thread_conflict_set_includes(running_tid,
+                                        DRD_(g_threadinfo)[running_tid].sg_last,
+                                        tid, sg);
+   }
+
    // add at tail
    sg->thr_prev = DRD_(g_threadinfo)[tid].sg_last;
    sg->thr_next = NULL;
@@ -837,6 +873,13 @@ void thread_append_segment(const DrdThreadId tid, Segment* const sg)
    if (DRD_(g_threadinfo)[tid].sg_first == NULL)
       DRD_(g_threadinfo)[tid].sg_first = sg;
 
+   /*
+    * No further accesses will be recorded in the previous segment of thread
+    * tid, so store its fully accessed second-level bitmaps as runs.
+    */
+   if (sg->thr_prev)
+      DRD_(bm_compress)(DRD_(sg_bm)(sg->thr_prev));
+
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(DRD_(sane_ThreadInfo)(&DRD_(g_threadinfo)[tid]));
 #endif
@@ -1182,8 +1225,28 @@ void DRD_(thread_combine_vc_join)(DrdThreadId joiner, DrdThreadId joinee)
       s_update_conflict_set_join_count++;
       DRD_(vc_cleanup)(&old_vc);
    } else {
+      const DrdThreadId running_tid = DRD_(g_drd_running_tid);
+      Segment* const joiner_sg = DRD_(g_threadinfo)[joiner].sg_last;
+
       DRD_(vc_combine)(DRD_(thread_get_vc)(joiner),
                        DRD_(thread_get_vc)(joinee));
+      /*
+       * The vector clock of the latest segment of the joiner changed, so its
+       * contribution to the conflict set of the running thread may change too.
+       */
+      if (DRD_(g_conflict_set) && DRD_(IsValidDrdThreadId)(running_tid)
+          && DRD_(g_threadinfo)[running_tid].sg_last)
+      {
+         const Segment* const p = DRD_(g_threadinfo)[running_tid].sg_last;
+
+         DRD_(bm_unmark)(DRD_(g_conflict_set));
+         if (thread_set_conflict_set_contribution
+             (joiner, joiner_sg,
+              thread_conflict_set_includes(running_tid, p, joiner, joiner_sg)))
+         {
+            thread_recalc_marked_conflict_set(running_tid);
+         }
+      }
    }
 
    thread_discard_ordered_segments();
@@ -1226,11 +1289,15 @@ static void thread_combine_vc_sync(DrdThreadId tid, const Segment* sg)
          VG_(free)(str2);
       }
 
-      thread_discard_ordered_segments();
-
+      /*
+       * Update the conflict set before discarding ordered segments such that
+       * segments that are discarded no longer contribute to it.
+       */
       DRD_(thread_update_conflict_set)(tid, &old_vc);
       s_update_conflict_set_sync_count++;
 
+      thread_discard_ordered_segments();
+
       DRD_(vc_cleanup)(&old_vc);
    } else {
       tl_assert(DRD_(vc_lte)(vc, DRD_(thread_get_vc)(tid)));
@@ -1540,17 +1607,95 @@ static void thread_compute_conflict_set(struct bitmap** conflict_set,
    }
 }
 
+/**
+ * Whether segment q of thread j is unordered against segment p, the latest
+ * segment of thread tid, and hence belongs to the conflict set of thread tid.
+ */
+static __inline__
+Bool thread_conflict_set_includes(const DrdThreadId tid, const Segment* const p,
+                                  const DrdThreadId j, const Segment* const q)
+{
+   return j != tid
+      && !DRD_(vc_lte)(&q->vc, &p->vc)
+      && !DRD_(vc_lte)(&p->vc, &q->vc);
+}
+
+/**
+ * Record whether segment q of thread j contributes to the conflict set. If
+ * the contribution of q changes, mark the second-level bitmaps of the conflict
+ * set that correspond to the accesses of q such that these can be
+ * recalculated by thread_recalc_marked_conflict_set().
+ *
+ * @return True if and only if the contribution of q has changed.
+ */
+static Bool thread_set_conflict_set_contribution(const DrdThreadId j,
+                                                 Segment* const q,
+                                                 const Bool included)
+{
+   const Bool changed = q->in_conflict_set != included;
+
+   if (UNLIKELY(s_trace_conflict_set)) {
+      HChar* str;
+
+      str = DRD_(vc_aprint)(&q->vc);
+      VG_(message)(Vg_DebugMsg,
+                   "conflict set: [%u] %s segment %s\n", j,
+                   changed ? included ? "merging" : "removing" : "keeping",
+                   str);
+      VG_(free)(str);
+   }
+
+   if (changed) {
+      q->in_conflict_set = included;
+      DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+   }
+
+   return changed;
+}
+
+/**
+ * Recalculate the marked second-level bitmaps of the conflict set of thread
+ * tid from the bitmaps of all segments that contribute to the conflict set.
+ * Segments ordered before the latest segment of thread tid do not contribute,
+ * and neither do the segments preceding them, so these are not visited.
+ */
+static void thread_recalc_marked_conflict_set(const DrdThreadId tid)
+{
+   const Segment* const p = DRD_(g_threadinfo)[tid].sg_last;
+   unsigned j;
+
+   DRD_(bm_clear_marked)(DRD_(g_conflict_set));
+
+   for (j = 0; j < DRD_N_THREADS; j++) {
+      if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
+         Segment* q;
+
+         for (q = DRD_(g_threadinfo)[j].sg_last; q; q = q->thr_prev) {
+            if (p && DRD_(vc_lte)(&q->vc, &p->vc))
+               break;
+            if (q->in_conflict_set)
+               DRD_(bm_merge2_marked)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+         }
+      }
+   }
+
+   DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+}
+
 /**
  * Update the conflict set after the vector clock of thread tid has been
  * updated from old_vc to its current value, either because a new segment has
- * been created or because of a synchronization operation.
+ * been created or because of a synchronization operation. Only segments that
+ * are not ordered before old_vc can change their contribution to the
+ * conflict set, and only the parts of the conflict set touched by these
+ * segments are recalculated.
  */
 void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
                                       const VectorClock* const old_vc)
 {
-   const VectorClock* new_vc;
    Segment* p;
    unsigned j;
+   Bool changed;
 
    tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
              && tid != DRD_INVALID_THREADID);
@@ -1568,11 +1713,12 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
       VG_(free)(str);
    }
 
-   new_vc = DRD_(thread_get_vc)(tid);
-   tl_assert(DRD_(vc_lte)(old_vc, new_vc));
+   p = DRD_(g_threadinfo)[tid].sg_last;
+   tl_assert(DRD_(vc_lte)(old_vc, &p->vc));
 
    DRD_(bm_unmark)(DRD_(g_conflict_set));
 
+   changed = False;
    for (j = 0; j < DRD_N_THREADS; j++)
    {
       Segment* q;
@@ -1581,78 +1727,151 @@ void DRD_(thread_update_conflict_set)(const DrdThreadId tid,
          continue;
 
       for (q = DRD_(g_threadinfo)[j].sg_last;
-           q && !DRD_(vc_lte)(&q->vc, new_vc);
+           q && !DRD_(vc_lte)(&q->vc, old_vc);
            q = q->thr_prev) {
-         const Bool included_in_old_conflict_set
-            = !DRD_(vc_lte)(old_vc, &q->vc);
-         const Bool included_in_new_conflict_set
-            = !DRD_(vc_lte)(new_vc, &q->vc);
-
-         if (UNLIKELY(s_trace_conflict_set)) {
-            HChar* str;
-
-            str = DRD_(vc_aprint)(&q->vc);
-            VG_(message)(Vg_DebugMsg,
-                         "conflict set: [%u] %s segment %s\n", j,
-                         included_in_old_conflict_set
-                         != included_in_new_conflict_set
-                         ? "merging" : "ignoring", str);
-            VG_(free)(str);
-         }
-         if (included_in_old_conflict_set != included_in_new_conflict_set)
-            DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+         changed |= thread_set_conflict_set_contribution
+            (j, q, thread_conflict_set_includes(tid, p, j, q));
       }
+   }
 
-      for ( ; q && !DRD_(vc_lte)(&q->vc, old_vc); q = q->thr_prev) {
-         const Bool included_in_old_conflict_set
-            = !DRD_(vc_lte)(old_vc, &q->vc);
-         const Bool included_in_new_conflict_set
-            = !DRD_(vc_lte)(&q->vc, new_vc)
-            && !DRD_(vc_lte)(new_vc, &q->vc);
-
-         if (UNLIKELY(s_trace_conflict_set)) {
-            HChar* str;
-
-            str = DRD_(vc_aprint)(&q->vc);
-            VG_(message)(Vg_DebugMsg,
-                         "conflict set: [%u] %s segment %s\n", j,
-                         included_in_old_conflict_set
-                         != included_in_new_conflict_set
-                         ? "merging" : "ignoring", str);
-            VG_(free)(str);
-         }
-         if (included_in_old_conflict_set != included_in_new_conflict_set)
-            DRD_(bm_mark)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
-      }
+   if (changed)
+      thread_recalc_marked_conflict_set(tid);
+
+   thread_set_conflict_set_vc(&p->vc);
+
+   s_update_conflict_set_count++;
+
+   if (s_trace_conflict_set_bm)
+   {
+      VG_(message)(Vg_DebugMsg, "[%u] updated conflict set:\n", tid);
+      DRD_(bm_print)(DRD_(g_conflict_set));
+      VG_(message)(Vg_DebugMsg, "[%u] end of updated conflict set.\n", tid);
    }
 
-   DRD_(bm_clear_marked)(DRD_(g_conflict_set));
+   tl_assert(thread_conflict_set_up_to_date(DRD_(g_drd_running_tid)));
+}
+
+/**
+ * Remember the vector clock the contributions of all segments to the conflict
+ * set have been computed against.
+ */
+static void thread_set_conflict_set_vc(const VectorClock* const vc)
+{
+   if (s_conflict_set_vc_valid)
+      DRD_(vc_assign)(&s_conflict_set_vc, vc);
+   else
+      DRD_(vc_copy)(&s_conflict_set_vc, vc);
+   s_conflict_set_vc_valid = True;
+}
+
+/**
+ * Update the conflict set after thread tid became the running thread. Instead
+ * of merging the bitmaps of all segments that are unordered against the latest
+ * segment of thread tid, only the parts of the conflict set affected by
+ * segments that started or stopped contributing are recalculated. Segments
+ * that are unordered against the latest segments of both the previously and
+ * the newly running thread keep their contribution.
+ *
+ * Since the segments of a thread are ordered, the segments of a thread that
+ * are ordered before both s_conflict_set_vc and the latest segment of thread
+ * tid form a prefix of its segment list. These segments contributed nothing
+ * before the switch and contribute nothing after it, so the walk over the
+ * segments of each thread stops at the first such segment. The cost of a
+ * context switch is thus proportional to the number of segments that are
+ * unordered against either thread instead of to the number of all segments.
+ */
+static void thread_switch_conflict_set(const DrdThreadId tid)
+{
+   Segment* p;
+   unsigned j;
+   Bool changed;
+
+   tl_assert(0 <= (int)tid && tid < DRD_N_THREADS
+             && tid != DRD_INVALID_THREADID);
+   tl_assert(tid == DRD_(g_drd_running_tid));
+
+   if (!DRD_(g_conflict_set))
+      DRD_(g_conflict_set) = DRD_(bm_new)();
+
+   if (s_trace_conflict_set) {
+      HChar* str;
+
+      str = DRD_(vc_aprint)(DRD_(thread_get_vc)(tid));
+      VG_(message)(Vg_DebugMsg,
+                   "switching conflict set to thread %u with vc %s\n",
+                   tid, str);
+      VG_(free)(str);
+   }
+
+   s_conflict_set_bitmap_creation_count
+      -= DRD_(bm_get_bitmap_creation_count)();
+   s_conflict_set_bitmap2_creation_count
+      -= DRD_(bm_get_bitmap2_creation_count)();
 
    p = DRD_(g_threadinfo)[tid].sg_last;
+
+   DRD_(bm_unmark)(DRD_(g_conflict_set));
+
+   changed = False;
    for (j = 0; j < DRD_N_THREADS; j++) {
-      if (j != tid && DRD_(IsValidDrdThreadId)(j)) {
+      if (DRD_(IsValidDrdThreadId)(j)) {
          Segment* q;
-         for (q = DRD_(g_threadinfo)[j].sg_last;
-              q && !DRD_(vc_lte)(&q->vc, &p->vc);
-              q = q->thr_prev) {
-            if (!DRD_(vc_lte)(&p->vc, &q->vc))
-               DRD_(bm_merge2_marked)(DRD_(g_conflict_set), DRD_(sg_bm)(q));
+
+         for (q = DRD_(g_threadinfo)[j].sg_last; q; q = q->thr_prev) {
+            if (s_conflict_set_vc_valid
+                && DRD_(vc_lte)(&q->vc, &p->vc)
+                && DRD_(vc_lte)(&q->vc, &s_conflict_set_vc)) {
+               tl_assert(!q->in_conflict_set);
+               break;
+            }
+            changed |= thread_set_conflict_set_contribution
+               (j, q, thread_conflict_set_includes(tid, p, j, q));
          }
       }
    }
 
-   DRD_(bm_remove_cleared_marked)(DRD_(g_conflict_set));
+   if (changed)
+      thread_recalc_marked_conflict_set(tid);
+
+   thread_set_conflict_set_vc(&p->vc);
+
+   s_conflict_set_bitmap_creation_count
+      += DRD_(bm_get_bitmap_creation_count)();
+   s_conflict_set_bitmap2_creation_count
+      += DRD_(bm_get_bitmap2_creation_count)();
 
    s_update_conflict_set_count++;
+   s_update_conflict_set_switch_count++;
 
-   if (s_trace_conflict_set_bm)
-   {
-      VG_(message)(Vg_DebugMsg, "[%u] updated conflict set:\n", tid);
+   if (s_trace_conflict_set_bm) {
+      VG_(message)(Vg_DebugMsg, "[%u] new conflict set:\n", tid);
       DRD_(bm_print)(DRD_(g_conflict_set));
-      VG_(message)(Vg_DebugMsg, "[%u] end of updated conflict set.\n", tid);
+      VG_(message)(Vg_DebugMsg, "[%u] end of new conflict set.\n", tid);
    }
+}
 
-   tl_assert(thread_conflict_set_up_to_date(DRD_(g_drd_running_tid)));
+/**
+ * Withdraw the contribution of the segments of thread tid from the conflict
+ * set. Must be called before the segments of thread tid are discarded.
+ */
+static void thread_withdraw_from_conflict_set(const DrdThreadId tid)
+{
+   const DrdThreadId running_tid = DRD_(g_drd_running_tid);
+   Segment* q;
+   Bool changed;
+
+   if (!DRD_(g_conflict_set) || tid == running_tid
+       || !DRD_(IsValidDrdThreadId)(running_tid))
+      return;
+
+   DRD_(bm_unmark)(DRD_(g_conflict_set));
+
+   changed = False;
+   for (q = DRD_(g_threadinfo)[tid].sg_last; q; q = q->thr_prev)
+      changed |= thread_set_conflict_set_contribution(tid, q, False);
+
+   if (changed)
+      thread_recalc_marked_conflict_set(running_tid);
 }
 
 /** Report the number of context switches performed. */
@@ -1679,6 +1898,15 @@ ULong DRD_(thread_get_update_conflict_set_count)(void)
    return s_update_conflict_set_count;
 }
 
+/**
+ * Return how many times the conflict set has been updated partially
+ * because of a context switch.
+ */
+ULong DRD_(thread_get_update_conflict_set_switch_count)(void)
+{
+   return s_update_conflict_set_switch_count;
+}
+
 /**
  * Return how many times the conflict set has been updated partially
  * because a new segment has been created.
@@ -30,14 +30,86 @@
 #include "pub_tool_mallocfree.h"  // VG_(malloc), VG_(free)
 
 
+/* Local type definitions. */
+
+/**
+ * Header of a heap-allocated vector clock element array. The array elements
+ * follow the header.
+ */
+typedef struct
+{
+   UWord refcnt; /**< number of vector clocks that use the element array. */
+} VCBuffer;
+
+
 /* Local function declarations. */
 
 static
 void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity);
 
 
+/* Local variables. */
+
+static ULong s_vc_shared_copy_count;
+static ULong s_vc_unshare_count;
+
+
 /* Function definitions. */
 
+/** Allocate a heap element array with room for capacity elements. */
+static VCElem* vc_buffer_alloc(const unsigned capacity)
+{
+   VCBuffer* const b = VG_(malloc)("drd.vc.vb.1",
+                                   sizeof(*b) + capacity * sizeof(VCElem));
+   b->refcnt = 1;
+   return (VCElem*)(b + 1);
+}
+
+/** Return the header of heap element array elem. */
+static VCBuffer* vc_buffer(VCElem* const elem)
+{
+   return (VCBuffer*)elem - 1;
+}
+
+/** Drop a reference to heap element array elem. */
+static void vc_buffer_put(VCElem* const elem)
+{
+   VCBuffer* const b = vc_buffer(elem);
+
+   tl_assert(b->refcnt >= 1);
+   if (--b->refcnt == 0)
+      VG_(free)(b);
+}
+
+/** Whether vc->vc is a heap element array that is shared with another clock. */
+static Bool vc_is_shared(const VectorClock* const vc)
+{
+   return vc->capacity > VC_PREALLOCATED && vc_buffer(vc->vc)->refcnt > 1;
+}
+
+/**
+ * Make sure that the element array of vc is not shared with any other vector
+ * clock and that no epoch is pending, such that vc->vc[] may be modified.
+ */
+static void vc_unshare(VectorClock* const vc)
+{
+   if (vc_is_shared(vc))
+   {
+      VCElem* const old = vc->vc;
+
+      s_vc_unshare_count++;
+      vc->vc = vc_buffer_alloc(vc->capacity);
+      VG_(memcpy)(vc->vc, old, vc->size * sizeof(vc->vc[0]));
+      vc_buffer_put(old);
+   }
+   if (vc->epoch != VC_NO_EPOCH)
+   {
+      tl_assert(vc->epoch < vc->size);
+      vc->vc[vc->epoch].count = vc->epoch_count;
+      vc->epoch = VC_NO_EPOCH;
+   }
+}
+
 /**
  * Initialize the memory 'vc' points at as a vector clock with size 'size'.
  * If the pointer 'vcelem' is not null, it is assumed to be an array with
@@ -51,6 +123,7 @@ void DRD_(vc_init)(VectorClock* const vc,
    vc->size = 0;
    vc->capacity = 0;
    vc->vc = 0;
+   vc->epoch = VC_NO_EPOCH;
    DRD_(vc_reserve)(vc, size);
    tl_assert(size == 0 || vc->vc != 0);
    if (vcelem)
@@ -67,12 +140,30 @@ void DRD_(vc_init)(VectorClock* const vc,
 void DRD_(vc_cleanup)(VectorClock* const vc)
 {
    DRD_(vc_reserve)(vc, 0);
+   vc->epoch = VC_NO_EPOCH;
 }
 
-/** Copy constructor -- initializes *new. */
+/**
+ * Copy constructor -- initializes *new. Heap element arrays are shared
+ * instead of copied.
+ */
 void DRD_(vc_copy)(VectorClock* const new, const VectorClock* const rhs)
 {
-   DRD_(vc_init)(new, rhs->vc, rhs->size);
+   if (rhs->capacity > VC_PREALLOCATED)
+   {
+      s_vc_shared_copy_count++;
+      vc_buffer(rhs->vc)->refcnt++;
+      new->capacity = rhs->capacity;
+      new->size = rhs->size;
+      new->vc = rhs->vc;
+      new->epoch = rhs->epoch;
+      new->epoch_count = rhs->epoch_count;
+   }
+   else
+   {
+      tl_assert(rhs->epoch == VC_NO_EPOCH);
+      DRD_(vc_init)(new, rhs->vc, rhs->size);
+   }
 }
 
 /** Assignment operator -- *lhs is already a valid vector clock. */
@@ -90,7 +181,22 @@ void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid)
    {
       if (vc->vc[i].threadid == tid)
       {
-         typeof(vc->vc[i].count) const oldcount = vc->vc[i].count;
+         typeof(vc->vc[i].count) const oldcount = DRD_(vc_count)(vc, i);
+
+         /*
+          * Fast path: if the element array is shared, record the new counter
+          * as an epoch instead of copying the array.
+          */
+         if (vc_is_shared(vc)
+             && (vc->epoch == VC_NO_EPOCH || vc->epoch == i))
+         {
+            vc->epoch = i;
+            vc->epoch_count = oldcount + 1;
+            // Check for integer overflow.
+            tl_assert(oldcount < vc->epoch_count);
+            return;
+         }
+         vc_unshare(vc);
          vc->vc[i].count++;
          // Check for integer overflow.
          tl_assert(oldcount < vc->vc[i].count);
@@ -132,6 +238,12 @@ void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
 
    DRD_(vc_check)(result);
 
+   /* Nothing to do if result <= rhs, e.g. because both share their array. */
+   if (DRD_(vc_lte)(result, rhs))
+      return;
+
+   vc_unshare(result);
+
    /* Next, combine both vector clocks into one. */
    i = 0;
    for (j = 0; j < rhs->size; j++)
@@ -151,12 +263,16 @@ void DRD_(vc_min)(VectorClock* const result, const VectorClock* const rhs)
          /* The thread ID is present in both vector clocks. Compute the */
          /* minimum of vc[i].count and vc[j].count. */
          tl_assert(result->vc[i].threadid == rhs->vc[j].threadid);
-         if (rhs->vc[j].count < result->vc[i].count)
+         if (DRD_(vc_count)(rhs, j) < result->vc[i].count)
          {
-            result->vc[i].count = rhs->vc[j].count;
+            result->vc[i].count = DRD_(vc_count)(rhs, j);
          }
+         i++;
       }
    }
+   /* Clear the counts of the thread IDs past the end of the second clock. */
+   for ( ; i < result->size; i++)
+      result->vc[i].count = 0;
    DRD_(vc_check)(result);
 }
 
@@ -173,6 +289,12 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
    tl_assert(result);
    tl_assert(rhs);
 
+   /* Nothing to do if rhs <= result, e.g. because both share their array. */
+   if (DRD_(vc_lte)(rhs, result))
+      return;
+
+   vc_unshare(result);
+
    // First count the number of shared thread id's.
    j = 0;
    shared = 0;
@@ -209,6 +331,7 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
       {
          result->size++;
          result->vc[i] = rhs->vc[j];
+         result->vc[i].count = DRD_(vc_count)(rhs, j);
       }
       /* If clock rhs->vc[j] is not in *result, insert it. */
       else if (result->vc[i].threadid > rhs->vc[j].threadid)
@@ -220,15 +343,16 @@ void DRD_(vc_combine)(VectorClock* const result, const VectorClock* const rhs)
          }
          result->size++;
          result->vc[i] = rhs->vc[j];
+         result->vc[i].count = DRD_(vc_count)(rhs, j);
       }
       /* Otherwise, both *result and *rhs have a clock for thread            */
       /* result->vc[i].threadid == rhs->vc[j].threadid. Compute the maximum. */
       else
       {
          tl_assert(result->vc[i].threadid == rhs->vc[j].threadid);
-         if (rhs->vc[j].count > result->vc[i].count)
+         if (DRD_(vc_count)(rhs, j) > result->vc[i].count)
          {
-            result->vc[i].count = rhs->vc[j].count;
+            result->vc[i].count = DRD_(vc_count)(rhs, j);
          }
       }
    }
@@ -278,7 +402,7 @@ HChar* DRD_(vc_aprint)(const VectorClock* const vc)
       }
       size += VG_(snprintf)(str + size, reserved - size,
                             "%s %u: %u", i > 0 ? "," : "",
-                            vc->vc[i].threadid, vc->vc[i].count);
+                            vc->vc[i].threadid, DRD_(vc_count)(vc, i));
    }
    size += VG_(snprintf)(str + size, reserved - size, " ]");
 
@@ -300,6 +424,7 @@ void DRD_(vc_check)(const VectorClock* const vc)
    unsigned i;
 
    tl_assert(vc->size <= vc->capacity);
+   tl_assert(vc->epoch == VC_NO_EPOCH || vc->epoch < vc->size);
 
    for (i = 1; i < vc->size; i++)
       tl_assert(vc->vc[i-1].threadid < vc->vc[i].threadid);
@@ -320,23 +445,26 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
 
    if (new_capacity > vc->capacity)
    {
-      if (vc->vc && vc->capacity > VC_PREALLOCATED)
+      if (vc->vc && vc->capacity > VC_PREALLOCATED && ! vc_is_shared(vc))
       {
          tl_assert(vc->vc
                    && vc->vc != vc->preallocated
                    && vc->capacity > VC_PREALLOCATED);
-         vc->vc = VG_(realloc)("drd.vc.vr.1",
-                               vc->vc, new_capacity * sizeof(vc->vc[0]));
+         vc->vc = (VCElem*)((VCBuffer*)
+                            VG_(realloc)("drd.vc.vr.1", vc_buffer(vc->vc),
+                                         sizeof(VCBuffer)
+                                         + new_capacity * sizeof(vc->vc[0]))
+                            + 1);
       }
       else if (vc->vc && new_capacity > VC_PREALLOCATED)
       {
-         tl_assert((vc->vc == 0 || vc->vc == vc->preallocated)
-                   && new_capacity > VC_PREALLOCATED
-                   && vc->capacity <= VC_PREALLOCATED);
-         vc->vc = VG_(malloc)("drd.vc.vr.2",
-                              new_capacity * sizeof(vc->vc[0]));
-         VG_(memcpy)(vc->vc, vc->preallocated,
-                     vc->capacity * sizeof(vc->vc[0]));
+         VCElem* const old = vc->vc;
+
+         tl_assert(vc->vc == vc->preallocated || vc_is_shared(vc));
+         vc->vc = vc_buffer_alloc(new_capacity);
+         VG_(memcpy)(vc->vc, old, vc->size * sizeof(vc->vc[0]));
+         if (old != vc->preallocated)
+            vc_buffer_put(old);
       }
       else if (vc->vc)
       {
@@ -349,8 +477,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
          tl_assert(vc->vc == 0
                    && new_capacity > VC_PREALLOCATED
                    && vc->capacity == 0);
-         vc->vc = VG_(malloc)("drd.vc.vr.3",
-                              new_capacity * sizeof(vc->vc[0]));
+         vc->vc = vc_buffer_alloc(new_capacity);
       }
       else
       {
@@ -364,7 +491,7 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
    else if (new_capacity == 0 && vc->vc)
    {
       if (vc->capacity > VC_PREALLOCATED)
-         VG_(free)(vc->vc);
+         vc_buffer_put(vc->vc);
       vc->vc = 0;
       vc->capacity = 0;
    }
@@ -374,3 +501,13 @@ void DRD_(vc_reserve)(VectorClock* const vc, const unsigned new_capacity)
              || vc->vc == 0
              || vc->vc == vc->preallocated);
 }
+
+ULong DRD_(vc_get_shared_copy_count)(void)
+{
+   return s_vc_shared_copy_count;
+}
+
+ULong DRD_(vc_get_unshare_count)(void)
+{
+   return s_vc_unshare_count;
+}
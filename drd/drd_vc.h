@@ -43,6 +43,14 @@
  * - A vector clock is incremented during actions such as
  *   pthread_create(), pthread_mutex_unlock(), sem_post(). (Actions where
  *   an inter-thread ordering "arrow" starts).
+ *
+ * Representation:
+ * - Element arrays that do not fit in the preallocated array are reference
+ *   counted and shared between copies of a vector clock until one of the
+ *   copies is modified (copy-on-write).
+ * - Incrementing a counter of a vector clock that shares its element array
+ *   does not copy the array but stores the new counter value as an epoch
+ *   that overrides a single element of the shared array.
  */
 
 
@@ -53,6 +61,9 @@
 
 #define VC_PREALLOCATED 8
 
+/** Value of VectorClock::epoch if no element is overridden. */
+#define VC_NO_EPOCH (~0U)
+
 
 /** Vector clock element. */
 typedef struct
@@ -66,6 +77,8 @@ typedef struct
    unsigned capacity; /**< number of elements allocated for array vc. */
    unsigned size;     /**< number of elements used of array vc. */
    VCElem*  vc;       /**< vector clock elements. */
+   unsigned epoch;    /**< index of the element overridden by epoch_count. */
+   UInt     epoch_count; /**< counter value of element epoch. */
    VCElem   preallocated[VC_PREALLOCATED];
 } VectorClock;
 
@@ -78,6 +91,8 @@ void DRD_(vc_copy)(VectorClock* const new, const VectorClock* const rhs);
 void DRD_(vc_assign)(VectorClock* const lhs, const VectorClock* const rhs);
 void DRD_(vc_increment)(VectorClock* const vc, DrdThreadId const tid);
 static __inline__
+UInt DRD_(vc_count)(const VectorClock* const vc, const unsigned i);
+static __inline__
 Bool DRD_(vc_lte)(const VectorClock* const vc1,
                   const VectorClock* const vc2);
 Bool DRD_(vc_ordered)(const VectorClock* const vc1,
@@ -90,8 +105,17 @@ void DRD_(vc_print)(const VectorClock* const vc);
 HChar* DRD_(vc_aprint)(const VectorClock* const vc);
 void DRD_(vc_check)(const VectorClock* const vc);
 void DRD_(vc_test)(void);
+ULong DRD_(vc_get_shared_copy_count)(void);
+ULong DRD_(vc_get_unshare_count)(void);
 
 
+/** @return The counter of element i of vector clock vc. */
+static __inline__
+UInt DRD_(vc_count)(const VectorClock* const vc, const unsigned i)
+{
+   return i == vc->epoch ? vc->epoch_count : vc->vc[i].count;
+}
+
 
 /**
  * @return True if all thread id's that are present in vc1 also exist in
@@ -104,6 +128,17 @@ Bool DRD_(vc_lte)(const VectorClock* const vc1, const VectorClock* const vc2)
    unsigned i;
    unsigned j = 0;
 
+   /*
+    * If both vector clocks share their element array, they only differ in
+    * their epochs, and an epoch is always larger than the element it
+    * overrides.
+    */
+   if (vc1->vc == vc2->vc && vc1->vc)
+   {
+      return vc1->epoch == VC_NO_EPOCH
+         || DRD_(vc_count)(vc1, vc1->epoch) <= DRD_(vc_count)(vc2, vc1->epoch);
+   }
+
    for (i = 0; i < vc1->size; i++)
    {
       while (j < vc2->size && vc2->vc[j].threadid < vc1->vc[i].threadid)
@@ -117,7 +152,7 @@ Bool DRD_(vc_lte)(const VectorClock* const vc1, const VectorClock* const vc2)
        */
       tl_assert(j < vc2->size && vc2->vc[j].threadid == vc1->vc[i].threadid);
 #endif
-      if (vc1->vc[i].count > vc2->vc[j].count)
+      if (DRD_(vc_count)(vc1, i) > DRD_(vc_count)(vc2, j))
          return False;
    }
    return True;
@@ -65,11 +65,21 @@ struct bm_cache_elem
 
 #define DRD_BITMAP_N_CACHE_ELEM 4
 
-/* Complete bitmap. */
+/*
+ * Complete bitmap. Second-level bitmaps in which all addresses have been
+ * loaded from and / or stored to are not stored in oset but are represented
+ * by runs of consecutive second-level bitmap addresses in runs_r and runs_w
+ * instead. An address_msb() value is never present both in oset and in one
+ * of the run sets. runs_m holds the runs of second-level bitmap addresses
+ * that have been marked by DRD_(bm_mark)() for recalculation.
+ */
 struct bitmap
 {
    struct bm_cache_elem cache[DRD_BITMAP_N_CACHE_ELEM];
    OSet*                oset;
+   OSet*                runs_r;
+   OSet*                runs_w;
+   OSet*                runs_m;
 };
 
 
@@ -140,6 +150,7 @@ void DRD_(bm_mark)(struct bitmap* bm1, struct bitmap* bm2);
 void DRD_(bm_clear_marked)(struct bitmap* bm);
 void DRD_(bm_merge2_marked)(struct bitmap* const lhs, struct bitmap* const rhs);
 void DRD_(bm_remove_cleared_marked)(struct bitmap* bm);
+void DRD_(bm_compress)(struct bitmap* const bm);
 int DRD_(bm_has_races)(struct bitmap* const bm1,
                        struct bitmap* const bm2);
 void DRD_(bm_report_races)(ThreadId const tid1, ThreadId const tid2,
@@ -149,5 +160,6 @@ void DRD_(bm_print)(struct bitmap* bm);
 ULong DRD_(bm_get_bitmap_creation_count)(void);
 ULong DRD_(bm_get_bitmap2_creation_count)(void);
 ULong DRD_(bm_get_bitmap2_merge_count)(void);
+ULong DRD_(bm_get_run_page_count)(void);
 
 #endif /* __PUB_DRD_BITMAP_H */
@@ -57,7 +57,7 @@ UInt VG_(printf)(const HChar *format, ...)
 UInt VG_(message)(VgMsgKind kind, const HChar* format, ...)
 { UInt ret; va_list vargs; va_start(vargs, format); ret = vprintf(format, vargs); va_end(vargs); printf("\n"); return ret; }
 Bool DRD_(is_suppressed)(const Addr a1, const Addr a2)
-{ assert(0); }
+{ return False; }
 void VG_(vcbprintf)(void(*char_sink)(HChar, void* opaque),
                     void* opaque,
                     const HChar* format, va_list vargs)
@@ -317,6 +317,106 @@ void bm_test3(const int outer_loop_step, const int inner_loop_step)
   DRD_(bm_delete)(bm1);
 }
 
+/**
+ * Test whether second-level bitmaps that are represented as runs behave the
+ * same as regular second-level bitmaps.
+ */
+void bm_test4(void)
+{
+  const Addr lb = make_address(16, 0);
+  const Addr ub = make_address(32, 0);
+  struct bitmap* bm1;
+  struct bitmap* bm2;
+  struct bitmap* bm3;
+  struct bitmap* bm4;
+  Addr a;
+  Word n;
+
+  bm1 = DRD_(bm_new)();
+  bm2 = DRD_(bm_new)();
+  bm3 = DRD_(bm_new)();
+  bm4 = DRD_(bm_new)();
+
+  /* Runs created by a range access versus per-address accesses. */
+  DRD_(bm_access_range_load)(bm1, lb - 3, ub + 5);
+  for (a = lb - 3; a < ub + 5; a++)
+    DRD_(bm_access_load_1)(bm2, a);
+  assert(bm_equal_print_diffs(bm1, bm2));
+  DRD_(bm_compress)(bm2);
+  assert(bm_equal_print_diffs(bm1, bm2));
+  assert(DRD_(bm_has_1)(bm2, lb + 7, eLoad));
+  assert(! DRD_(bm_has_1)(bm2, lb + 7, eStore));
+  assert(! DRD_(bm_has_conflict_with)(bm2, lb, ub, eLoad));
+  assert(DRD_(bm_has_conflict_with)(bm2, lb, ub, eStore));
+
+  /* Partially clearing runs. */
+  DRD_(bm_clear)(bm1, make_address(18, 100), make_address(21, 7));
+  DRD_(bm_clear)(bm2, make_address(18, 100), make_address(21, 7));
+  assert(bm_equal_print_diffs(bm1, bm2));
+  assert(! DRD_(bm_has_any_access)(bm1, make_address(19, 0),
+                                   make_address(20, 0)));
+  assert(DRD_(bm_has_1)(bm1, make_address(21, 7), eLoad));
+  assert(! DRD_(bm_has_races)(bm1, bm2));
+
+  /* Accesses to pages that are part of a run. */
+  DRD_(bm_access_store_4)(bm1, make_address(24, 8));
+  DRD_(bm_access_store_4)(bm2, make_address(24, 8));
+  assert(bm_equal_print_diffs(bm1, bm2));
+
+  /* Merging runs. */
+  DRD_(bm_merge2)(bm3, bm1);
+  assert(bm_equal_print_diffs(bm3, bm1));
+  DRD_(bm_access_range_store)(bm4, make_address(26, 0), make_address(40, 0));
+  assert(DRD_(bm_has_races)(bm1, bm4));
+  assert(DRD_(bm_has_races)(bm4, bm1));
+  DRD_(bm_merge2)(bm3, bm4);
+  assert(DRD_(bm_has_1)(bm3, make_address(27, 0), eLoad));
+  assert(DRD_(bm_has_1)(bm3, make_address(27, 0), eStore));
+  assert(DRD_(bm_has_1)(bm3, make_address(36, 0), eStore));
+
+  /* Recomputing marked second-level bitmaps as for the conflict set. */
+  DRD_(bm_mark)(bm3, bm4);
+  DRD_(bm_clear_marked)(bm3);
+  DRD_(bm_merge2_marked)(bm3, bm1);
+  DRD_(bm_merge2_marked)(bm3, bm4);
+  DRD_(bm_remove_cleared_marked)(bm3);
+  DRD_(bm_unmark)(bm3);
+  DRD_(bm_cleanup)(bm2);
+  DRD_(bm_init)(bm2);
+  DRD_(bm_merge2)(bm2, bm4);
+  DRD_(bm_merge2)(bm2, bm1);
+  assert(bm_equal_print_diffs(bm3, bm2));
+  DRD_(bm_compress)(bm3);
+  assert(bm_equal_print_diffs(bm3, bm2));
+
+  /* Withdrawing the runs of a bitmap from a merged bitmap. */
+  DRD_(bm_mark)(bm3, bm4);
+  DRD_(bm_clear_marked)(bm3);
+  DRD_(bm_merge2_marked)(bm3, bm1);
+  DRD_(bm_remove_cleared_marked)(bm3);
+  DRD_(bm_unmark)(bm3);
+  assert(bm_equal_print_diffs(bm3, bm1));
+  assert(! DRD_(bm_equal)(bm3, bm4));
+  DRD_(bm_merge2)(bm3, bm4);
+  assert(! DRD_(bm_equal)(bm3, bm1));
+
+  /* Compressing away second-level bitmaps from which all accesses have been
+     cleared. */
+  n = VG_(OSetGen_Size)(bm1->oset);
+  DRD_(bm_access_store_4)(bm1, make_address(50, 8));
+  DRD_(bm_clear)(bm1, make_address(50, 8), make_address(50, 12));
+  assert(VG_(OSetGen_Size)(bm1->oset) == n + 1);
+  DRD_(bm_compress)(bm1);
+  assert(VG_(OSetGen_Size)(bm1->oset) == n);
+  assert(! DRD_(bm_has_any_access)(bm1, make_address(50, 0),
+                                   make_address(51, 0)));
+
+  DRD_(bm_delete)(bm4);
+  DRD_(bm_delete)(bm3);
+  DRD_(bm_delete)(bm2);
+  DRD_(bm_delete)(bm1);
+}
+
 int main(int argc, char** argv)
 {
   int outer_loop_step = ADDR_GRANULARITY;
@@ -350,6 +450,7 @@ int main(int argc, char** argv)
   bm_test1();
   bm_test2();
   bm_test3(outer_loop_step, inner_loop_step);
+  bm_test4();
   DRD_(bm_module_cleanup)();
 
   fprintf(stderr, "End of DRD BM unit test.\n");
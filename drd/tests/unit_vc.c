@@ -103,8 +103,93 @@ static void vc_unittest(void)
   DRD_(vc_cleanup)(&vc3);
 }
 
+/* Copy-on-write sharing of vector clocks that do not fit in preallocated[]. */
+static void vc_cow_unittest(void)
+{
+  int i;
+  char *str;
+  VCElem vc6elem[VC_PREALLOCATED + 2];
+  VectorClock vc6;
+  VectorClock vc7;
+  VectorClock vc8;
+
+  for (i = 0; i < VC_PREALLOCATED + 2; i++)
+  {
+    vc6elem[i].threadid = i + 1;
+    vc6elem[i].count = 1;
+  }
+  DRD_(vc_init)(&vc6, vc6elem, sizeof(vc6elem)/sizeof(vc6elem[0]));
+  DRD_(vc_copy)(&vc7, &vc6);
+  DRD_(vc_increment)(&vc7, 3);
+  DRD_(vc_copy)(&vc8, &vc7);
+  DRD_(vc_increment)(&vc8, 3);
+  DRD_(vc_increment)(&vc8, 5);
+
+  fprintf(stderr, "vc7: %s", (str = DRD_(vc_aprint)(&vc7)));
+  free(str);
+  fprintf(stderr, "\nvc8: %s", (str = DRD_(vc_aprint)(&vc8)));
+  free(str);
+  fprintf(stderr, "\nvc_lte(vc6, vc7) = %d, vc_lte(vc7, vc6) = %d,"
+          " vc_lte(vc7, vc8) = %d\n",
+          DRD_(vc_lte)(&vc6, &vc7), DRD_(vc_lte)(&vc7, &vc6),
+          DRD_(vc_lte)(&vc7, &vc8));
+
+  DRD_(vc_combine)(&vc6, &vc7);
+  DRD_(vc_cleanup)(&vc7);
+  fprintf(stderr, "max(vc6, vc7): %s\n", (str = DRD_(vc_aprint)(&vc6)));
+  free(str);
+
+  DRD_(vc_cleanup)(&vc6);
+  DRD_(vc_cleanup)(&vc8);
+}
+
+/* Elementwise minimum, both for clocks that share their array and not. */
+static void vc_min_unittest(void)
+{
+  char *str;
+  VCElem vc9elem[] = { { 1, 3 }, { 2, 5 }, { 4, 7 }, };
+  VectorClock vc9;
+  VCElem vc10elem[] = { { 1, 2 }, { 2, 7 }, { 3, 1 }, };
+  VectorClock vc10;
+  VCElem vc11elem[VC_PREALLOCATED + 2];
+  VectorClock vc11;
+  VectorClock vc12;
+  int i;
+
+  DRD_(vc_init)(&vc9, vc9elem, sizeof(vc9elem)/sizeof(vc9elem[0]));
+  DRD_(vc_init)(&vc10, vc10elem, sizeof(vc10elem)/sizeof(vc10elem[0]));
+  DRD_(vc_min)(&vc9, &vc10);
+  fprintf(stderr, "min([ 1: 3, 2: 5, 4: 7 ], [ 1: 2, 2: 7, 3: 1 ]): %s\n",
+          (str = DRD_(vc_aprint)(&vc9)));
+  free(str);
+
+  for (i = 0; i < VC_PREALLOCATED + 2; i++)
+  {
+    vc11elem[i].threadid = i + 1;
+    vc11elem[i].count = 2;
+  }
+  DRD_(vc_init)(&vc11, vc11elem, sizeof(vc11elem)/sizeof(vc11elem[0]));
+  DRD_(vc_copy)(&vc12, &vc11);
+  DRD_(vc_increment)(&vc12, 3);
+  DRD_(vc_min)(&vc11, &vc12);
+  fprintf(stderr, "min(vc11, vc11 + 1): %s\n",
+          (str = DRD_(vc_aprint)(&vc11)));
+  free(str);
+  DRD_(vc_min)(&vc12, &vc11);
+  fprintf(stderr, "min(vc11 + 1, vc11): %s\n",
+          (str = DRD_(vc_aprint)(&vc12)));
+  free(str);
+
+  DRD_(vc_cleanup)(&vc9);
+  DRD_(vc_cleanup)(&vc10);
+  DRD_(vc_cleanup)(&vc11);
+  DRD_(vc_cleanup)(&vc12);
+}
+
 int main(int argc, char** argv)
 {
   vc_unittest();
+  vc_cow_unittest();
+  vc_min_unittest();
   return 0;
 }
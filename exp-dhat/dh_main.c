@@ -31,6 +31,10 @@
 
 
 #include "pub_tool_basics.h"
+#include "pub_tool_vki.h"          // VKI_O_CREAT etc
+#include "pub_tool_debuginfo.h"
+#include "pub_tool_execontext.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
@@ -41,7 +45,34 @@
 #include "pub_tool_tooliface.h"
 #include "pub_tool_wordfm.h"
 
-#define HISTOGRAM_SIZE_LIMIT 1024
+/* Access histograms count, for each 64-byte cache line of a block, the
+   accesses touching that line.  They are sparse: a directory with one
+   entry per HISTO_CHUNK_LINES lines points at chunks of counters, which
+   are only allocated when one of their lines is first accessed.  So
+   large blocks of which only a part is used cost little, and a block of
+   at most one chunk (4KB) only gets counters for the lines it has. */
+#define HISTO_LINE_BITS    6
+#define HISTO_LINE_SZB     (1UL << HISTO_LINE_BITS)
+#define HISTO_CHUNK_BITS   6
+#define HISTO_CHUNK_LINES  (1UL << HISTO_CHUNK_BITS)
+
+static inline UWord histo_n_lines ( SizeT szB )
+{
+   return (szB + HISTO_LINE_SZB - 1) >> HISTO_LINE_BITS;
+}
+
+static inline UWord histo_n_chunks ( UWord n_lines )
+{
+   return (n_lines + HISTO_CHUNK_LINES - 1) >> HISTO_CHUNK_BITS;
+}
+
+// Length of the chunks of a histogram of 'n_lines' lines.
+static inline UWord histo_chunk_len ( UWord n_lines )
+{
+   return n_lines < HISTO_CHUNK_LINES ? n_lines : HISTO_CHUNK_LINES;
+}
+
+static UWord stats__n_histo_chunks = 0;
 
 
 //------------------------------------------------------------//
@@ -62,9 +93,44 @@ static ULong g_cur_bytes_live  = 0; // curr # bytes live
 static ULong g_max_blocks_live = 0; // bytes and blocks at
 static ULong g_max_bytes_live  = 0; // the max residency point
 
+static void g_note_alloc ( SizeT szB )
+{
+   g_tot_blocks++;
+   g_tot_bytes += szB;
+
+   g_cur_blocks_live++;
+   g_cur_bytes_live += szB;
+   if (g_cur_bytes_live > g_max_bytes_live) {
+      g_max_bytes_live = g_cur_bytes_live;
+      g_max_blocks_live = g_cur_blocks_live;
+   }
+}
+
+static void g_note_free ( SizeT szB )
+{
+   tl_assert(g_cur_blocks_live > 0);
+   g_cur_blocks_live--;
+   tl_assert(g_cur_bytes_live >= szB);
+   g_cur_bytes_live -= szB;
+}
+
+static void g_note_resize ( Long delta )
+{
+   if (delta < 0)
+      tl_assert(g_cur_bytes_live >= -delta);
+   g_cur_bytes_live += delta;
+   if (delta > 0) {
+      if (g_cur_bytes_live > g_max_bytes_live) {
+         g_max_bytes_live = g_cur_bytes_live;
+         g_max_blocks_live = g_cur_blocks_live;
+      }
+      g_tot_bytes += delta;
+   }
+}
+
 
 //------------------------------------------------------------//
-//--- an Interval Tree of live blocks                      ---//
+//--- a map of live blocks                                ---//
 //------------------------------------------------------------//
 
 /* Tracks information about live blocks. */
@@ -76,16 +142,241 @@ typedef
       ULong       allocd_at; /* instruction number */
       ULong       n_reads;
       ULong       n_writes;
-      /* Approx histogram, one byte per payload byte.  Counts latch up
-         therefore at 0xFFFF.  Can be NULL if the block is resized or if
-         the block is larger than HISTOGRAM_SIZE_LIMIT. */
-      UShort*     histoW; /* [0 .. req_szB-1] */
+      /* Number of blocks this one stands for in the APInfo stats: 1,
+         unless --sample-bytes is in use. */
+      ULong       weight;
+      /* Sparse access histogram, one counter per cache line.  Counts
+         latch up at 0xFFFF. */
+      UShort**    histoW; /* [0 .. histo_n_chunks(..)-1] */
    }
    Block;
 
-/* May not contain zero-sized blocks.  May not contain
-   overlapping blocks. */
-static WordFM* interval_tree = NULL;  /* WordFM* Block* void */
+static void histo_init ( Block* bk )
+{
+   UWord n_chunks = histo_n_chunks(histo_n_lines(bk->req_szB));
+   bk->histoW = VG_(calloc)("dh.histo_init.1", n_chunks, sizeof(UShort*));
+}
+
+static void histo_free ( Block* bk )
+{
+   UWord i, n_chunks = histo_n_chunks(histo_n_lines(bk->req_szB));
+   for (i = 0; i < n_chunks; i++) {
+      if (bk->histoW[i])
+         VG_(free)(bk->histoW[i]);
+   }
+   VG_(free)(bk->histoW);
+   bk->histoW = NULL;
+}
+
+/* The block is being resized to 'new_req_szB'.  Keep the counts of the
+   lines which remain, so that the histograms of growing buffers are not
+   lost. */
+static void histo_resize ( Block* bk, SizeT new_req_szB )
+{
+   UWord i;
+   UWord old_lines  = histo_n_lines(bk->req_szB);
+   UWord new_lines  = histo_n_lines(new_req_szB);
+   UWord old_chunks = histo_n_chunks(old_lines);
+   UWord new_chunks = histo_n_chunks(new_lines);
+   UWord old_len    = histo_chunk_len(old_lines);
+   UWord new_len    = histo_chunk_len(new_lines);
+
+   if (old_lines == new_lines) return;
+
+   for (i = new_chunks; i < old_chunks; i++) {
+      if (bk->histoW[i])
+         VG_(free)(bk->histoW[i]);
+   }
+   bk->histoW = VG_(realloc)("dh.histo_resize.1", bk->histoW,
+                             new_chunks * sizeof(UShort*));
+   for (i = old_chunks; i < new_chunks; i++)
+      bk->histoW[i] = NULL;
+
+   // A block of one chunk has a chunk of just its lines.
+   if (old_len != new_len && bk->histoW[0]) {
+      bk->histoW[0] = VG_(realloc)("dh.histo_resize.2", bk->histoW[0],
+                                   new_len * sizeof(UShort));
+      for (i = old_len; i < new_len; i++)
+         bk->histoW[0][i] = 0;
+   }
+
+   // Clear the counts of lines cut off from the last chunk, which would
+   // otherwise come back if the block grew again.
+   if (new_lines < old_lines && bk->histoW[new_chunks-1]) {
+      UWord last = (new_chunks-1) << HISTO_CHUNK_BITS;
+      UWord end  = old_lines - last;
+      if (end > new_len) end = new_len;
+      for (i = new_lines - last; i < end; i++)
+         bk->histoW[new_chunks-1][i] = 0;
+   }
+}
+
+/* The block map: for each 4KB page of the address space, the live
+   Blocks overlapping it.  It is a three level radix tree, the leaves
+   of which hold one word per page: 0 if no block overlaps the page, a
+   Block* if just one does, or else a PageSet* tagged with bit 0, which
+   lists the blocks in address order.  Looking up the block containing
+   an address, which is done for every memory access, therefore costs a
+   few loads, plus a short binary search on pages holding several small
+   blocks.
+
+   A leaf whose pages all lie inside one block is not needed:  its word
+   in the node holds a span marker instead, the Block* tagged with bit
+   0.  A big block is thus only entered in the pages at its ends, plus
+   one word per 1MB in between.  Shrinking a block in place only
+   touches the pages it no longer overlaps.  Nodes are never freed;
+   leaves are freed when a span marker replaces them.
+
+   The map covers the addresses below BM_MAX_ADDR, which is where the
+   client's heap is on all supported platforms.  Any block beyond it
+   goes in 'outlier_blocks', an interval tree.
+
+   Blocks may not be zero-sized nor overlap. */
+
+#define BM_PAGE_BITS  12
+#define BM_L3_BITS    8     // pages per leaf (1MB)
+#define BM_L2_BITS    12    // leaves per node (4GB)
+#if VG_WORDSIZE == 8
+#  define BM_L1_BITS  16    // 256TB
+#else
+#  define BM_L1_BITS  0
+#endif
+#define BM_L3_SIZE    (1UL << BM_L3_BITS)
+#define BM_L2_SIZE    (1UL << BM_L2_BITS)
+#define BM_L1_SIZE    (1UL << BM_L1_BITS)
+#define BM_MAX_ADDR \
+   ((Addr)((1ULL << (BM_PAGE_BITS + BM_L3_BITS + BM_L2_BITS + BM_L1_BITS)) \
+           - 1))
+
+typedef
+   struct {
+      UInt   n_bks;
+      UInt   max_bks;
+      Block* bks[];    /* [0 .. n_bks-1], by address */
+   }
+   PageSet;
+
+typedef UWord* BM_Node;   /* [BM_L2_SIZE], each 0, a leaf of BM_L3_SIZE
+                             words or a span marker */
+
+// 512KB on 64-bit hosts, but only the pages of it that are written
+// take memory, and the first page alone covers the lowest 2TB.
+static BM_Node bm_root[BM_L1_SIZE];
+
+// 2-entry cache for find_Block_containing
+static Block* fbc_cache0 = NULL;
+static Block* fbc_cache1 = NULL;
+
+static UWord stats__n_bm_cached = 0;
+static UWord stats__n_bm_found = 0;
+static UWord stats__n_bm_notfound = 0;
+static UWord stats__n_bm_leaves = 0;
+static UWord stats__n_bm_pagesets = 0;
+static UWord stats__n_bm_spans = 0;
+static UWord stats__n_bm_page_updates = 0;
+
+// The node word for the leaf holding page 'pg', or NULL if the page is
+// beyond BM_MAX_ADDR, or there is no node and !create.
+static inline UWord* bm_node_slot ( UWord pg, Bool create )
+{
+   UWord   i1   = (UWord)((ULong)pg >> (BM_L3_BITS + BM_L2_BITS));
+   UWord   i2   = (pg >> BM_L3_BITS) & (BM_L2_SIZE - 1);
+   if (UNLIKELY(i1 >= BM_L1_SIZE)) return NULL;   // beyond BM_MAX_ADDR
+   BM_Node node = bm_root[i1];
+   if (UNLIKELY(!node)) {
+      if (!create) return NULL;
+      node = VG_(calloc)("dh.bm_node_slot.1", BM_L2_SIZE, sizeof(UWord));
+      bm_root[i1] = node;
+   }
+   return &node[i2];
+}
+
+// The leaf of node word 'nslot', which must not be a span marker.  It
+// is made if need be.
+static inline UWord* bm_leaf ( UWord* nslot )
+{
+   tl_assert(!(*nslot & 1));
+   if (UNLIKELY(!*nslot)) {
+      *nslot = (UWord)VG_(calloc)("dh.bm_leaf.1", BM_L3_SIZE, sizeof(UWord));
+      stats__n_bm_leaves++;
+   }
+   return (UWord*)*nslot;
+}
+
+static inline Bool block_contains ( Block* bk, Addr a )
+{
+   return a - bk->payload < bk->req_szB;
+}
+
+static Block* pageset_find ( PageSet* ps, Addr a )
+{
+   // Find the last block starting at or before 'a'.
+   UInt lo = 0, hi = ps->n_bks;
+   while (hi - lo > 1) {
+      UInt mid = (lo + hi) / 2;
+      if (ps->bks[mid]->payload <= a) lo = mid; else hi = mid;
+   }
+   return block_contains(ps->bks[lo], a) ? ps->bks[lo] : NULL;
+}
+
+static void bm_add_to_page ( UWord* slot, Block* bk )
+{
+   UWord    e = *slot;
+   PageSet* ps;
+   UInt     i;
+
+   if (e == 0) {
+      *slot = (UWord)bk;
+      return;
+   }
+   if (!(e & 1)) {
+      ps = VG_(malloc)("dh.bm_add_to_page.1",
+                       sizeof(PageSet) + 4 * sizeof(Block*));
+      ps->n_bks   = 1;
+      ps->max_bks = 4;
+      ps->bks[0]  = (Block*)e;
+      stats__n_bm_pagesets++;
+   } else {
+      ps = (PageSet*)(e & ~1UL);
+      if (ps->n_bks == ps->max_bks) {
+         ps->max_bks *= 2;
+         ps = VG_(realloc)("dh.bm_add_to_page.2", ps,
+                           sizeof(PageSet) + ps->max_bks * sizeof(Block*));
+      }
+   }
+   for (i = ps->n_bks; i > 0 && ps->bks[i-1]->payload > bk->payload; i--)
+      ps->bks[i] = ps->bks[i-1];
+   ps->bks[i] = bk;
+   ps->n_bks++;
+   *slot = (UWord)ps | 1;
+}
+
+static void bm_remove_from_page ( UWord* slot, Block* bk )
+{
+   UWord    e = *slot;
+   PageSet* ps;
+   UInt     i;
+
+   if (!(e & 1)) {
+      tl_assert(e == (UWord)bk);
+      *slot = 0;
+      return;
+   }
+   ps = (PageSet*)(e & ~1UL);
+   for (i = 0; i < ps->n_bks && ps->bks[i] != bk; i++)
+      ;
+   tl_assert(i < ps->n_bks);
+   for (; i+1 < ps->n_bks; i++)
+      ps->bks[i] = ps->bks[i+1];
+   ps->n_bks--;
+   if (ps->n_bks == 1) {
+      *slot = (UWord)ps->bks[0];
+      VG_(free)(ps);
+      stats__n_bm_pagesets--;
+   }
+}
+
+static WordFM* outlier_blocks = NULL;  /* WordFM* Block* void */
 
 /* Here's the comparison function.  Since the tree is required
 to contain non-zero sized, non-overlapping blocks, it's good
@@ -101,66 +392,239 @@ static Word interval_tree_Cmp ( UWord k1, UWord k2 )
    return 0;
 }
 
-// 2-entry cache for find_Block_containing
-static Block* fbc_cache0 = NULL;
-static Block* fbc_cache1 = NULL;
+static inline Bool is_outlier ( Block* bk )
+{
+   return bk->payload > BM_MAX_ADDR
+          || bk->req_szB - 1 > BM_MAX_ADDR - bk->payload;
+}
 
-static UWord stats__n_fBc_cached = 0;
-static UWord stats__n_fBc_uncached = 0;
-static UWord stats__n_fBc_notfound = 0;
+// Enter 'bk' in pages [lo, hi], which it overlaps and is not in yet.
+// Leaves lying wholly in the range get a span marker, if 'bk' fills all
+// of their pages: a block may share its first and last pages with
+// others.
+static void bm_add_pages ( Block* bk, UWord lo, UWord hi )
+{
+   // bk fills the pages [full_lo, full_end - 1]
+   UWord full_lo  = (bk->payload + (1UL << BM_PAGE_BITS) - 1) >> BM_PAGE_BITS;
+   UWord full_end = (bk->payload + bk->req_szB) >> BM_PAGE_BITS;
+   UWord pg = lo;
+   while (pg <= hi) {
+      UWord  first = pg & ~(BM_L3_SIZE - 1);
+      UWord  last  = first + BM_L3_SIZE - 1;
+      UWord  end   = last < hi ? last : hi;
+      UWord* nslot = bm_node_slot(pg, True);
+      tl_assert(nslot);
+      if (pg == first && end == last && first >= full_lo && last < full_end) {
+         // No other block can overlap these pages, so any leaf is empty.
+         tl_assert(!(*nslot & 1));
+         if (*nslot) {
+            VG_(free)((void*)*nslot);
+            stats__n_bm_leaves--;
+         }
+         *nslot = (UWord)bk | 1;
+         stats__n_bm_spans++;
+         stats__n_bm_page_updates++;
+      } else {
+         UWord* leaf = bm_leaf(nslot);
+         for (; pg <= end; pg++) {
+            bm_add_to_page(&leaf[pg & (BM_L3_SIZE - 1)], bk);
+            stats__n_bm_page_updates++;
+         }
+      }
+      pg = end + 1;
+   }
+}
 
-static Block* find_Block_containing ( Addr a )
+// Remove 'bk' from pages [lo, hi].  If a span marker's leaf is only
+// partly in the range, 'bk' still overlaps the rest of the leaf, so it
+// is entered in those pages instead.
+static void bm_remove_pages ( Block* bk, UWord lo, UWord hi )
 {
-   if (LIKELY(fbc_cache0
-              && fbc_cache0->payload <= a 
-              && a < fbc_cache0->payload + fbc_cache0->req_szB)) {
-      // found at 0
-      stats__n_fBc_cached++;
-      return fbc_cache0;
+   UWord pg = lo;
+   while (pg <= hi) {
+      UWord  first = pg & ~(BM_L3_SIZE - 1);
+      UWord  last  = first + BM_L3_SIZE - 1;
+      UWord  end   = last < hi ? last : hi;
+      UWord* nslot = bm_node_slot(pg, False);
+      tl_assert(nslot && *nslot);
+      if (*nslot & 1) {
+         tl_assert(*nslot == ((UWord)bk | 1));
+         *nslot = 0;
+         stats__n_bm_spans--;
+         stats__n_bm_page_updates++;
+         if (pg > first)
+            bm_add_pages(bk, first, pg - 1);
+         if (end < last)
+            bm_add_pages(bk, end + 1, last);
+      } else {
+         UWord* leaf = (UWord*)*nslot;
+         for (; pg <= end; pg++) {
+            bm_remove_from_page(&leaf[pg & (BM_L3_SIZE - 1)], bk);
+            stats__n_bm_page_updates++;
+         }
+      }
+      pg = end + 1;
    }
-   if (LIKELY(fbc_cache1
-              && fbc_cache1->payload <= a 
-              && a < fbc_cache1->payload + fbc_cache1->req_szB)) {
-      // found at 1; swap 0 and 1
-      Block* tmp = fbc_cache0;
-      fbc_cache0 = fbc_cache1;
-      fbc_cache1 = tmp;
-      stats__n_fBc_cached++;
-      return fbc_cache0;
+}
+
+static void add_Block ( Block* bk )
+{
+   tl_assert(bk->req_szB > 0);
+   if (UNLIKELY(is_outlier(bk))) {
+      Bool present
+         = VG_(addToFM)( outlier_blocks, (UWord)bk, (UWord)0/*no val*/);
+      tl_assert(!present);
+      return;
    }
+   bm_add_pages(bk, bk->payload >> BM_PAGE_BITS,
+                (bk->payload + bk->req_szB - 1) >> BM_PAGE_BITS);
+}
+
+// Remove a block;  it must be present.
+static void delete_Block ( Block* bk )
+{
+   fbc_cache0 = fbc_cache1 = NULL;
+   if (UNLIKELY(is_outlier(bk))) {
+      Bool found = VG_(delFromFM)( outlier_blocks,
+                                   NULL, NULL, (UWord)bk );
+      tl_assert(found);
+      return;
+   }
+   bm_remove_pages(bk, bk->payload >> BM_PAGE_BITS,
+                   (bk->payload + bk->req_szB - 1) >> BM_PAGE_BITS);
+}
+
+// Shrink a block in place to 'new_req_szB', which may not be zero.  It
+// must be present.
+static void shrink_Block ( Block* bk, SizeT new_req_szB )
+{
+   UWord old_hi, new_hi, lo;
+
+   tl_assert(new_req_szB > 0 && new_req_szB <= bk->req_szB);
+   if (UNLIKELY(is_outlier(bk))) {
+      delete_Block( bk );
+      bk->req_szB = new_req_szB;
+      add_Block( bk );
+      return;
+   }
+   old_hi = (bk->payload + bk->req_szB - 1) >> BM_PAGE_BITS;
+   new_hi = (bk->payload + new_req_szB - 1) >> BM_PAGE_BITS;
+   // If bk no longer fills its new last page, that page may not stay
+   // under a span marker, so it is entered again on its own.
+   lo = ((bk->payload + new_req_szB) & ((1UL << BM_PAGE_BITS) - 1)) == 0
+        ? new_hi + 1 : new_hi;
+   if (lo <= old_hi)
+      bm_remove_pages(bk, lo, old_hi);
+   bk->req_szB = new_req_szB;
+   if (lo == new_hi)
+      bm_add_pages(bk, new_hi, new_hi);
+}
+
+static Block* find_outlier_Block_containing ( Addr a )
+{
    Block fake;
    fake.payload = a;
    fake.req_szB = 1;
    UWord foundkey = 1;
    UWord foundval = 1;
-   Bool found = VG_(lookupFM)( interval_tree,
+   Bool found = VG_(lookupFM)( outlier_blocks,
                                &foundkey, &foundval, (UWord)&fake );
-   if (!found) {
-      stats__n_fBc_notfound++;
+   if (!found)
       return NULL;
-   }
    tl_assert(foundval == 0); // we don't store vals in the interval tree
    tl_assert(foundkey != 1);
-   Block* res = (Block*)foundkey;
-   tl_assert(res != &fake);
-   // put at the top position
-   fbc_cache1 = fbc_cache0;
-   fbc_cache0 = res;
-   stats__n_fBc_uncached++;
+   tl_assert((Block*)foundkey != &fake);
+   return (Block*)foundkey;
+}
+
+static Block* find_Block_containing ( Addr a )
+{
+   UWord* nslot;
+   Block* res = NULL;
+   // Successive accesses are mostly to the same block or two.
+   if (LIKELY(fbc_cache0 && block_contains(fbc_cache0, a))) {
+      stats__n_bm_cached++;
+      return fbc_cache0;
+   }
+   if (LIKELY(fbc_cache1 && block_contains(fbc_cache1, a))) {
+      // found at 1; swap 0 and 1
+      Block* tmp = fbc_cache0;
+      fbc_cache0 = fbc_cache1;
+      fbc_cache1 = tmp;
+      stats__n_bm_cached++;
+      return fbc_cache0;
+   }
+   nslot = bm_node_slot(a >> BM_PAGE_BITS, False);
+   if (LIKELY(nslot && *nslot)) {
+      UWord n = *nslot;
+      if (UNLIKELY(n & 1)) {
+         res = (Block*)(n & ~1UL);   // a span marker
+      } else {
+         UWord e = ((UWord*)n)[(a >> BM_PAGE_BITS) & (BM_L3_SIZE - 1)];
+         if (LIKELY(!(e & 1))) {
+            if (e != 0 && block_contains((Block*)e, a))
+               res = (Block*)e;
+         } else {
+            res = pageset_find((PageSet*)(e & ~1UL), a);
+         }
+      }
+   }
+   if (UNLIKELY(!res && VG_(sizeFM)(outlier_blocks) > 0))
+      res = find_outlier_Block_containing(a);
+   if (res) {
+      // put at the top position
+      fbc_cache1 = fbc_cache0;
+      fbc_cache0 = res;
+      stats__n_bm_found++;
+   } else {
+      stats__n_bm_notfound++;
+   }
    return res;
 }
 
-// delete a block; asserts if not found.  (viz, 'a' must be
-// known to be present.)
-static void delete_Block_starting_at ( Addr a )
+// Apply 'f' to all the live blocks.
+static void forall_Blocks ( void (*f)(Block*) )
 {
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
-   Bool found = VG_(delFromFM)( interval_tree,
-                                NULL, NULL, (Addr)&fake );
-   tl_assert(found);
-   fbc_cache0 = fbc_cache1 = NULL;
+   UWord i1, i2, i3, i;
+   UWord keyW, valW;
+
+   for (i1 = 0; i1 < BM_L1_SIZE; i1++) {
+      if (!bm_root[i1]) continue;
+      for (i2 = 0; i2 < BM_L2_SIZE; i2++) {
+         UWord n     = bm_root[i1][i2];
+         UWord first = ((i1 << BM_L2_BITS) | i2) << BM_L3_BITS;
+         // Visit each block at the page where it starts.
+         if (n & 1) {
+            Block* bk = (Block*)(n & ~1UL);
+            if (bk->payload >> BM_PAGE_BITS == first)
+               f(bk);
+            continue;
+         }
+         UWord* leaf = (UWord*)n;
+         if (!leaf) continue;
+         for (i3 = 0; i3 < BM_L3_SIZE; i3++) {
+            UWord pg = first | i3;
+            UWord e  = leaf[i3];
+            if (!(e & 1)) {
+               if (e != 0 && ((Block*)e)->payload >> BM_PAGE_BITS == pg)
+                  f((Block*)e);
+            } else {
+               PageSet* ps = (PageSet*)(e & ~1UL);
+               for (i = 0; i < ps->n_bks; i++)
+                  if (ps->bks[i]->payload >> BM_PAGE_BITS == pg)
+                     f(ps->bks[i]);
+            }
+         }
+      }
+   }
+
+   VG_(initIterFM)( outlier_blocks );
+   while (VG_(nextIterFM)( outlier_blocks, &keyW, &valW )) {
+      tl_assert(valW == 0);
+      tl_assert(keyW);
+      f((Block*)keyW);
+   }
+   VG_(doneIterFM)( outlier_blocks );
 }
 
 
@@ -195,24 +659,70 @@ typedef
       // by this AP.
       ULong n_reads;
       ULong n_writes;
-      /* Histogram information.  We maintain a histogram aggregated for
-         all retiring Blocks allocated by this AP, but only if:
-         - this AP has only ever allocated objects of one size
-         - that size is <= HISTOGRAM_SIZE_LIMIT
-         What we need therefore is a mechanism to see if this AP
-         has only ever allocated blocks of one size.
-
-         3 states:
-            Unknown          because no retirement yet 
-            Exactly xsize    all retiring blocks are of this size
-            Mixed            multiple different sizes seen
-      */
-      enum { Unknown=999, Exactly, Mixed } xsize_tag;
-      SizeT xsize;
-      UInt* histo; /* [0 .. xsize-1] */
+      // Smallest and largest block sizes allocated, and whether any
+      // block was resized.
+      SizeT min_szB;
+      SizeT max_szB;
+      Bool  resized;
+      // Number of times cur_blocks_live went back to zero, and the most
+      // bytes allocated between two such times.  An arena holding this
+      // AP's blocks could be reset at these times, and would need to be
+      // that big.
+      ULong n_empties;
+      ULong cur_episode_bytes;
+      ULong max_episode_bytes;
+      /* Histogram aggregated for all retiring Blocks allocated by this
+         AP, by cache line offset from the start of the blocks.  It is
+         sparse like those of the Blocks, but always has full chunks,
+         and grows to the number of lines of the largest block. */
+      UWord  histo_n_lines;
+      UInt** histo; /* [0 .. histo_n_chunks(histo_n_lines)-1] */
    }
    APInfo;
 
+/* Add a chunk of 'n' counters of a retiring block, which stands for
+   'weight' blocks, into a chunk of its AP.  Written as a simple loop
+   over both arrays so that the compiler can vectorise it. */
+static void histo_merge_chunk ( UInt* dst, const UShort* src, UWord n,
+                                ULong weight )
+{
+   UWord i;
+   for (i = 0; i < n; i++) {
+      ULong sum = dst[i] + src[i] * weight;
+      // Latch up rather than wrap around.
+      dst[i] = sum < 0xFFFFFFFFULL ? (UInt)sum : 0xFFFFFFFF;
+   }
+}
+
+static void histo_merge ( APInfo* api, Block* bk )
+{
+   UWord c;
+   UWord n_lines  = histo_n_lines(bk->req_szB);
+   UWord n_chunks = histo_n_chunks(n_lines);
+   UWord len      = histo_chunk_len(n_lines);
+
+   if (n_lines > api->histo_n_lines) {
+      UWord old_chunks = histo_n_chunks(api->histo_n_lines);
+      if (n_chunks > old_chunks) {
+         api->histo = VG_(realloc)("dh.histo_merge.1", api->histo,
+                                   n_chunks * sizeof(UInt*));
+         for (c = old_chunks; c < n_chunks; c++)
+            api->histo[c] = NULL;
+      }
+      api->histo_n_lines = n_lines;
+   }
+
+   for (c = 0; c < n_chunks; c++) {
+      if (!bk->histoW[c]) continue;
+      if (!api->histo[c]) {
+         api->histo[c] = VG_(calloc)("dh.histo_merge.2",
+                                     HISTO_CHUNK_LINES, sizeof(UInt));
+         stats__n_histo_chunks++;
+      }
+      histo_merge_chunk(api->histo[c], bk->histoW[c], len, bk->weight);
+   }
+}
+
 /* maps ExeContext*'s to APInfo*'s.  Note that the keys must match the
    .ap field in the values. */
 static WordFM* apinfo = NULL;  /* WordFM* ExeContext* APInfo* */
@@ -242,11 +752,6 @@ static void intro_Block ( Block* bk )
       Bool present = VG_(addToFM)( apinfo,
                                    (UWord)bk->ap, (UWord)api );
       tl_assert(!present);
-      // histo stuff
-      tl_assert(api->deaths == 0);
-      api->xsize_tag = Unknown;
-      api->xsize = 0;
-      if (0) VG_(printf)("api %p   -->  Unknown\n", api);
    }
 
    tl_assert(api->ap == bk->ap);
@@ -254,29 +759,32 @@ static void intro_Block ( Block* bk )
    /* So: update stats to reflect an allocation */
 
    // # live blocks
-   api->cur_blocks_live++;
+   api->cur_blocks_live += bk->weight;
 
    // # live bytes
-   api->cur_bytes_live += bk->req_szB;
+   api->cur_bytes_live += bk->req_szB * bk->weight;
    if (api->cur_bytes_live > api->max_bytes_live) {
       api->max_bytes_live  = api->cur_bytes_live;
       api->max_blocks_live = api->cur_blocks_live;
    }
 
+   // sizes seen
+   if (api->tot_blocks == 0 || bk->req_szB < api->min_szB)
+      api->min_szB = bk->req_szB;
+   if (bk->req_szB > api->max_szB)
+      api->max_szB = bk->req_szB;
+
    // total blocks and bytes allocated here
-   api->tot_blocks++;
-   api->tot_bytes += bk->req_szB;
+   api->tot_blocks += bk->weight;
+   api->tot_bytes  += bk->req_szB * bk->weight;
 
-   // update summary globals
-   g_tot_blocks++;
-   g_tot_bytes += bk->req_szB;
+   // bytes allocated since this AP last had no live blocks
+   api->cur_episode_bytes += bk->req_szB * bk->weight;
+   if (api->cur_episode_bytes > api->max_episode_bytes)
+      api->max_episode_bytes = api->cur_episode_bytes;
 
-   g_cur_blocks_live++;
-   g_cur_bytes_live += bk->req_szB;
-   if (g_cur_bytes_live > g_max_bytes_live) {
-      g_max_bytes_live = g_cur_bytes_live;
-      g_max_blocks_live = g_cur_blocks_live;
-   }
+   // update summary globals
+   g_note_alloc(bk->req_szB);
 }
 
 
@@ -310,99 +818,38 @@ static void retire_Block ( Block* bk, Bool because_freed )
 
    // update total blocks live etc for this AP
    if (because_freed) {
-      tl_assert(api->cur_blocks_live >= 1);
-      tl_assert(api->cur_bytes_live >= bk->req_szB);
-      api->cur_blocks_live--;
-      api->cur_bytes_live -= bk->req_szB;
+      tl_assert(api->cur_blocks_live >= bk->weight);
+      tl_assert(api->cur_bytes_live >= bk->req_szB * bk->weight);
+      api->cur_blocks_live -= bk->weight;
+      api->cur_bytes_live -= bk->req_szB * bk->weight;
+
+      api->deaths += bk->weight;
 
-      api->deaths++;
+      if (api->cur_blocks_live == 0) {
+         api->n_empties++;
+         api->cur_episode_bytes = 0;
+      }
 
       tl_assert(bk->allocd_at <= g_guest_instrs_executed);
-      api->death_ages_sum += (g_guest_instrs_executed - bk->allocd_at);
+      api->death_ages_sum
+         += (g_guest_instrs_executed - bk->allocd_at) * bk->weight;
 
       // update global summary stats
-      tl_assert(g_cur_blocks_live > 0);
-      g_cur_blocks_live--;
-      tl_assert(g_cur_bytes_live >= bk->req_szB);
-      g_cur_bytes_live -= bk->req_szB;
+      g_note_free(bk->req_szB);
    }
 
    // access counts
-   api->n_reads  += bk->n_reads;
-   api->n_writes += bk->n_writes;
-
-   // histo stuff.  First, do state transitions for xsize/xsize_tag.
-   switch (api->xsize_tag) {
-
-      case Unknown:
-         tl_assert(api->xsize == 0);
-         tl_assert(api->deaths == 1 || api->deaths == 0);
-         tl_assert(!api->histo);
-         api->xsize_tag = Exactly;
-         api->xsize = bk->req_szB;
-         if (0) VG_(printf)("api %p   -->  Exactly(%lu)\n", api, api->xsize);
-         // and allocate the histo
-         if (bk->histoW) {
-            api->histo = VG_(malloc)("dh.main.retire_Block.1",
-                                     api->xsize * sizeof(UInt));
-            VG_(memset)(api->histo, 0, api->xsize * sizeof(UInt));
-         }
-         break;
-
-      case Exactly:
-         //tl_assert(api->deaths > 1);
-         if (bk->req_szB != api->xsize) {
-            if (0) VG_(printf)("api %p   -->  Mixed(%lu -> %lu)\n",
-                               api, api->xsize, bk->req_szB);
-            api->xsize_tag = Mixed;
-            api->xsize = 0;
-            // deallocate the histo, if any
-            if (api->histo) {
-               VG_(free)(api->histo);
-               api->histo = NULL;
-            }
-         }
-         break;
-
-      case Mixed:
-         //tl_assert(api->deaths > 1);
-         break;
-
-      default:
-        tl_assert(0);
-   }
-
-   // See if we can fold the histo data from this block into
-   // the data for the AP
-   if (api->xsize_tag == Exactly && api->histo && bk->histoW) {
-      tl_assert(api->xsize == bk->req_szB);
-      UWord i;
-      for (i = 0; i < api->xsize; i++) {
-         // FIXME: do something better in case of overflow of api->histo[..]
-         // Right now, at least don't let it overflow/wrap around
-         if (api->histo[i] <= 0xFFFE0000)
-            api->histo[i] += (UInt)bk->histoW[i];
-      }
-      if (0) VG_(printf)("fold in, AP = %p\n", api);
-   }
-
-
+   api->n_reads  += bk->n_reads  * bk->weight;
+   api->n_writes += bk->n_writes * bk->weight;
 
-#if 0
-   if (bk->histoB) {
-      VG_(printf)("block retiring, histo %lu: ", bk->req_szB);
-      UWord i;
-      for (i = 0; i < bk->req_szB; i++)
-        VG_(printf)("%u ", (UInt)bk->histoB[i]);
-      VG_(printf)("\n");
-   } else {
-      VG_(printf)("block retiring, no histo %lu\n", bk->req_szB);
-   }
-#endif
+   // fold the histo data from this block into the data for the AP
+   histo_merge(api, bk);
 }
 
 /* This handles block resizing.  When a block with AP 'ec' has a
-   size change of 'delta', call here to update the APInfo. */
+   size change of 'delta', call here to update the APInfo.  'delta' is
+   already multiplied by the block's weight;  the summary globals are
+   updated separately, with g_note_resize. */
 static void apinfo_change_cur_bytes_live( ExeContext* ec, Long delta )
 {
    APInfo* api   = NULL;
@@ -417,29 +864,90 @@ static void apinfo_change_cur_bytes_live( ExeContext* ec, Long delta )
 
    if (delta < 0) {
       tl_assert(api->cur_bytes_live >= -delta);
-      tl_assert(g_cur_bytes_live >= -delta);
    }
 
    // adjust current live size
    api->cur_bytes_live += delta;
-   g_cur_bytes_live += delta;
 
    if (delta > 0 && api->cur_bytes_live > api->max_bytes_live) {
       api->max_bytes_live  = api->cur_bytes_live;
       api->max_blocks_live = api->cur_blocks_live;
    }
 
-   // update global summary stats
-   if (delta > 0 && g_cur_bytes_live > g_max_bytes_live) {
-      g_max_bytes_live = g_cur_bytes_live;
-      g_max_blocks_live = g_cur_blocks_live;
-   }
-   if (delta > 0)
-      g_tot_bytes += delta;
-
    // adjust total allocation size
-   if (delta > 0)
+   if (delta > 0) {
       api->tot_bytes += delta;
+      api->cur_episode_bytes += delta;
+      if (api->cur_episode_bytes > api->max_episode_bytes)
+         api->max_episode_bytes = api->cur_episode_bytes;
+   }
+
+   api->resized = True;
+}
+
+
+//------------------------------------------------------------//
+//--- heap sampling (--sample-bytes)                       ---//
+//------------------------------------------------------------//
+
+/* With --sample-bytes=N, only some blocks get a Block: a block is
+   sampled when the bytes allocated since the previous sampled block
+   exceed a random gap with a mean of N bytes (see VG_(heap_sample_gap)).
+   The unsampled blocks cost neither a stack unwind nor any work on
+   memory accesses.  A sampled Block is weighted in its APInfo by the
+   number of blocks of its size it stands for (see
+   VG_(heap_sample_weight)), so the per-AP figures are estimates;  the
+   summary globals are still exact, which is why the unsampled blocks
+   are kept, with just their size, in 'unsampled_blocks'.
+   The APInfo figures are whole numbers, so the fixed-point weight is
+   rounded up or down at random, in proportion to its fractional part:
+   this keeps the estimates unbiased, whatever the block sizes. */
+
+static SizeT clo_sample_bytes = 0;   // 0 means every block is sampled
+
+typedef
+   struct _Unsampled {
+      struct _Unsampled* next;
+      Addr               payload;
+      SizeT              req_szB;
+   }
+   Unsampled;
+
+static VgHashTable* unsampled_blocks = NULL;
+
+static SSizeT sample_bytes_left = 0;
+static UInt   sample_seed       = 1;
+static UInt   weight_seed       = 2;   // not 0 nor sample_seed's start
+
+static UWord stats__n_unsampled = 0;
+
+static Bool sample_block ( SizeT req_szB )
+{
+   if (0 == clo_sample_bytes) return True;
+
+   sample_bytes_left -= req_szB;
+   if (sample_bytes_left > 0) {
+      stats__n_unsampled++;
+      return False;
+   }
+   sample_bytes_left = VG_(heap_sample_gap)(&sample_seed, clo_sample_bytes);
+   return True;
+}
+
+static ULong sample_weight ( SizeT req_szB )
+{
+   ULong w, frac;
+
+   if (0 == clo_sample_bytes) return 1;
+
+   w    = VG_(heap_sample_weight)(req_szB, clo_sample_bytes);
+   frac = w & (VG_HEAP_SAMPLE_WEIGHT_ONE - 1);
+   w  >>= VG_HEAP_SAMPLE_WEIGHT_SHIFT;
+   // The high bits of VG_(random) are the most random ones.
+   if ((VG_(random)(&weight_seed) >> (32 - VG_HEAP_SAMPLE_WEIGHT_SHIFT))
+       < frac)
+      w++;
+   return w;
 }
 
 
@@ -457,7 +965,7 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    if ((SSizeT)req_szB < 0) return NULL;
 
    if (req_szB == 0)
-      req_szB = 1;  /* can't allow zero-sized blocks in the interval tree */
+      req_szB = 1;  /* can't allow zero-sized blocks in the block map */
 
    // Allocate and zero if necessary
    if (!p) {
@@ -473,6 +981,15 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
       /* slop_szB = 0; */
    }
 
+   if (!sample_block(req_szB)) {
+      Unsampled* us = VG_(malloc)("dh.new_block.3", sizeof(Unsampled));
+      us->payload = (Addr)p;
+      us->req_szB = req_szB;
+      VG_(HT_add_node)(unsampled_blocks, us);
+      g_note_alloc(req_szB);
+      return p;
+   }
+
    // Make new HP_Chunk node, add to malloc_list
    Block* bk = VG_(malloc)("dh.new_block.1", sizeof(Block));
    bk->payload   = (Addr)p;
@@ -481,16 +998,10 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    bk->allocd_at = g_guest_instrs_executed;
    bk->n_reads   = 0;
    bk->n_writes  = 0;
-   // set up histogram array, if the block isn't too large
-   bk->histoW = NULL;
-   if (req_szB <= HISTOGRAM_SIZE_LIMIT) {
-      bk->histoW = VG_(malloc)("dh.new_block.2", req_szB * sizeof(UShort));
-      VG_(memset)(bk->histoW, 0, req_szB * sizeof(UShort));
-   }
+   bk->weight    = sample_weight(req_szB);
+   histo_init(bk);
 
-   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
-   tl_assert(!present);
-   fbc_cache0 = fbc_cache1 = NULL;
+   add_Block(bk);
 
    intro_Block(bk);
 
@@ -507,7 +1018,15 @@ void die_block ( void* p, Bool custom_free )
    Block* bk = find_Block_containing( (Addr)p );
 
    if (!bk) {
-     return; // bogus free
+      if (unsampled_blocks) {
+         Unsampled* us = VG_(HT_remove)(unsampled_blocks, (UWord)p);
+         if (us) {
+            g_note_free(us->req_szB);
+            VG_(cli_free)(p);
+            VG_(free)(us);
+         }
+      }
+      return; // otherwise, bogus free
    }
 
    tl_assert(bk->req_szB > 0);
@@ -525,15 +1044,38 @@ void die_block ( void* p, Bool custom_free )
    retire_Block(bk, True/*because_freed*/);
 
    VG_(cli_free)( (void*)bk->payload );
-   delete_Block_starting_at( bk->payload );
-   if (bk->histoW) {
-      VG_(free)( bk->histoW );
-      bk->histoW = NULL;
-   }
+   delete_Block( bk );
+   histo_free( bk );
    VG_(free)( bk );
 }
 
 
+// realloc of a block which was not sampled.  It stays unsampled.
+static
+void* renew_unsampled_block ( void* p_old, SizeT new_req_szB )
+{
+   void* p_new = p_old;
+   Unsampled* us = VG_(HT_lookup)(unsampled_blocks, (UWord)p_old);
+   if (!us) {
+      return NULL;   // bogus realloc
+   }
+
+   if (new_req_szB > us->req_szB) {
+      p_new = VG_(cli_malloc)(VG_(clo_alignment), new_req_szB);
+      if (!p_new) {
+         return NULL;
+      }
+      VG_(memcpy)(p_new, p_old, us->req_szB);
+      VG_(cli_free)(p_old);
+      VG_(HT_remove)(unsampled_blocks, (UWord)p_old);
+      us->payload = (Addr)p_new;
+      VG_(HT_add_node)(unsampled_blocks, us);
+   }
+   g_note_resize((Long)new_req_szB - (Long)us->req_szB);
+   us->req_szB = new_req_szB;
+   return p_new;
+}
+
 static
 void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
 {
@@ -545,6 +1087,8 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    // Find the old block.
    Block* bk = find_Block_containing( (Addr)p_old );
    if (!bk) {
+      if (unsampled_blocks)
+         return renew_unsampled_block(p_old, new_req_szB);
       return NULL;   // bogus realloc
    }
 
@@ -557,20 +1101,16 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       return NULL; // bogus realloc
    }
 
-   // Keeping the histogram alive in any meaningful way across
-   // block resizing is too darn complicated.  Just throw it away.
-   if (bk->histoW) {
-      VG_(free)(bk->histoW);
-      bk->histoW = NULL;
-   }
-
    // Actually do the allocation, if necessary.
    if (new_req_szB <= bk->req_szB) {
 
       // New size is smaller or same; block not moved.
       apinfo_change_cur_bytes_live(bk->ap,
-                                   (Long)new_req_szB - (Long)bk->req_szB);
-      bk->req_szB = new_req_szB;
+         ((Long)new_req_szB - (Long)bk->req_szB) * (Long)bk->weight);
+      g_note_resize((Long)new_req_szB - (Long)bk->req_szB);
+      histo_resize(bk, new_req_szB);
+      // The block may now overlap fewer pages.
+      shrink_Block( bk, new_req_szB );
       return p_old;
 
    } else {
@@ -588,23 +1128,23 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       VG_(cli_free)(p_old);
 
       // Since the block has moved, we need to re-insert it into the
-      // interval tree at the new place.  Do this by removing
+      // block map at the new place.  Do this by removing
       // and re-adding it.
-      delete_Block_starting_at( (Addr)p_old );
-      // now 'bk' is no longer in the tree, but the Block itself
+      delete_Block( bk );
+      // now 'bk' is no longer in the map, but the Block itself
       // is still alive
 
       // Update the metadata.
       apinfo_change_cur_bytes_live(bk->ap,
-                                   (Long)new_req_szB - (Long)bk->req_szB);
+         ((Long)new_req_szB - (Long)bk->req_szB) * (Long)bk->weight);
+      g_note_resize((Long)new_req_szB - (Long)bk->req_szB);
+      // The histogram is kept by offset, even though the block moved.
+      histo_resize(bk, new_req_szB);
       bk->payload = (Addr)p_new;
       bk->req_szB = new_req_szB;
 
       // and re-add
-      Bool present
-         = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/); 
-      tl_assert(!present);
-      fbc_cache0 = fbc_cache1 = NULL;
+      add_Block( bk );
 
       return p_new;
    }
@@ -672,6 +1212,10 @@ static void* dh_realloc ( ThreadId tid, void* p_old, SizeT new_szB )
 static SizeT dh_malloc_usable_size ( ThreadId tid, void* p )
 {                                                            
    Block* bk = find_Block_containing( (Addr)p );
+   if (!bk && unsampled_blocks) {
+      Unsampled* us = VG_(HT_lookup)(unsampled_blocks, (UWord)p);
+      return us ? us->req_szB : 0;
+   }
    return bk ? bk->req_szB : 0;
 }                                                            
 
@@ -683,17 +1227,26 @@ static SizeT dh_malloc_usable_size ( ThreadId tid, void* p )
 static
 void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
 {
-   UWord i, offMin, offMax1;
+   UWord i, offMin, offMax1, lineMin, lineMax;
+   UWord n_lines = histo_n_lines(bk->req_szB);
    offMin = addr - bk->payload;
    tl_assert(offMin < bk->req_szB);
    offMax1 = offMin + szB;
    if (offMax1 > bk->req_szB)
       offMax1 = bk->req_szB;
-   //VG_(printf)("%lu %lu   (size of block %lu)\n", offMin, offMax1, bk->req_szB);
-   for (i = offMin; i < offMax1; i++) {
-      UShort n = bk->histoW[i];
+   lineMin = offMin >> HISTO_LINE_BITS;
+   lineMax = (offMax1 - 1) >> HISTO_LINE_BITS;
+   for (i = lineMin; i <= lineMax; i++) {
+      UShort* chunk = bk->histoW[i >> HISTO_CHUNK_BITS];
+      if (UNLIKELY(!chunk)) {
+         chunk = VG_(calloc)("dh.inc_histo_for_block.1",
+                             histo_chunk_len(n_lines), sizeof(UShort));
+         bk->histoW[i >> HISTO_CHUNK_BITS] = chunk;
+         stats__n_histo_chunks++;
+      }
+      UShort n = chunk[i & (HISTO_CHUNK_LINES-1)];
       if (n < 0xFFFF) n++;
-      bk->histoW[i] = n;
+      chunk[i & (HISTO_CHUNK_LINES-1)] = n;
    }
 }
 
@@ -703,8 +1256,7 @@ void dh_handle_write ( Addr addr, UWord szB )
    Block* bk = find_Block_containing(addr);
    if (bk) {
       bk->n_writes += szB;
-      if (bk->histoW)
-         inc_histo_for_block(bk, addr, szB);
+      inc_histo_for_block(bk, addr, szB);
    }
 }
 
@@ -714,8 +1266,7 @@ void dh_handle_read ( Addr addr, UWord szB )
    Block* bk = find_Block_containing(addr);
    if (bk) {
       bk->n_reads += szB;
-      if (bk->histoW)
-         inc_histo_for_block(bk, addr, szB);
+      inc_histo_for_block(bk, addr, szB);
    }
 }
 
@@ -1034,11 +1585,17 @@ static Bool identify_metric ( /*OUT*/ULong(**get_metricP)(APInfo*),
 
 static Int    clo_show_top_n = 10;
 static const HChar *clo_sort_by = "max-bytes-live";
+static const HChar *clo_advice_out_file = NULL;
 
 static Bool dh_process_cmd_line_option(const HChar* arg)
 {
    if VG_BINT_CLO(arg, "--show-top-n", clo_show_top_n, 1, 100000) {}
 
+   else if VG_BINT_CLO(arg, "--sample-bytes", clo_sample_bytes,
+                                              0, 1024*1024*1024) {}
+
+   else if VG_STR_CLO(arg, "--advice-out-file", clo_advice_out_file) {}
+
    else if VG_STR_CLO(arg, "--sort-by", clo_sort_by) {
        ULong (*dummyFn)(APInfo*);
        Bool dummyB;
@@ -1067,6 +1624,13 @@ static void dh_print_usage(void)
 "                max-bytes-live    maximum live bytes [default]\n"
 "                tot-bytes-allocd  total allocation (turnover)\n"
 "                max-blocks-live   maximum live blocks\n"
+"    --sample-bytes=number     only track one block per <number> bytes\n"
+"                              allocated, on average, and scale up the\n"
+"                              per alloc point figures; 0 means every\n"
+"                              block [0]\n"
+"    --advice-out-file=<file>  write a ranked list of the alloc points\n"
+"                              which could use an arena or a pool, or\n"
+"                              whose blocks are never read, to <file> [none]\n"
    );
 }
 
@@ -1147,20 +1711,36 @@ static void show_APInfo ( APInfo* api )
 
    VG_(pp_ExeContext)(api->ap);
 
-   if (api->histo && api->xsize_tag == Exactly) {
-      VG_(umsg)("\nAggregated access counts by offset:\n");
+   if (api->histo) {
+      // One row per 16 lines;  runs of rows without any access are
+      // shown as "...", so that big blocks don't flood the output.
+      UWord row, i;
+      Bool  skipped = False;
+      VG_(umsg)("\nAggregated access counts by %lu-byte line offset:\n",
+                HISTO_LINE_SZB);
       VG_(umsg)("\n");
-      UWord i;
-      if (api->xsize > 0)
-         VG_(umsg)("[   0]  ");
-      for (i = 0; i < api->xsize; i++) {
-         if (i > 0 && (i % 16) == 0 && i != api->xsize-1) {
-            VG_(umsg)("\n");
-            VG_(umsg)("[%4lu]  ", i);
+      for (row = 0; row < api->histo_n_lines; row += 16) {
+         UInt* chunk = api->histo[row >> HISTO_CHUNK_BITS];
+         UWord end   = row + 16 < api->histo_n_lines
+                          ? row + 16 : api->histo_n_lines;
+         Bool  any   = False;
+         for (i = row; chunk && i < end; i++)
+            any |= chunk[i & (HISTO_CHUNK_LINES-1)] != 0;
+         if (!any) {
+            skipped = True;
+            continue;
+         }
+         if (skipped) {
+            VG_(umsg)("...\n");
+            skipped = False;
          }
-         VG_(umsg)("%u ", api->histo[i]);
+         VG_(umsg)("[%6lu]  ", row << HISTO_LINE_BITS);
+         for (i = row; i < end; i++)
+            VG_(umsg)("%u ", chunk[i & (HISTO_CHUNK_LINES-1)]);
+         VG_(umsg)("\n");
       }
-      VG_(umsg)("\n");
+      if (skipped)
+         VG_(umsg)("...\n");
    }
 }
 
@@ -1265,6 +1845,204 @@ static void show_top_n_apinfos ( void )
 }
 
 
+//------------------------------------------------------------//
+//--- Allocator advice (--advice-out-file)                 ---//
+//------------------------------------------------------------//
+
+/* Each AP is classified from its blocks' sizes, lifetimes, accesses,
+   and from how its allocations and frees interleave:
+
+   - short-lived: all blocks were freed, at an average age of at most
+     1% of the run;
+   - arena-able: all blocks were freed, and the AP repeatedly had no
+     live block left, with at most ADVICE_ARENA_MAX_SZB allocated in
+     between: a bump allocator, reset at these points, could hold them;
+   - poolable: at least ADVICE_POOL_MIN_BLOCKS blocks, never resized,
+     of at most ADVICE_POOL_MAX_SZB and all in one ADVICE_POOL_CLASS_SZB
+     size class: a free list of fixed-size objects could hold them;
+   - never-read: the blocks are never read, so are probably useless;
+   - write-once: on average each byte is written at most once.
+
+   The instructions saved are estimated from the rough costs below, for
+   the best applicable change: using an arena or a pool, or removing the
+   allocations when they are never read.  The costs of the client's own
+   allocator are not observed, as DHAT replaces it. */
+
+#define ADVICE_MALLOC_FREE_INSNS  100   // general purpose malloc + free
+#define ADVICE_BUMP_ALLOC_INSNS     8   // arena allocation, no free
+#define ADVICE_ARENA_RESET_INSNS   50   // arena reset
+#define ADVICE_POOL_PAIR_INSNS     20   // pool allocation + free
+
+#define ADVICE_ARENA_MAX_SZB    (1024*1024)
+#define ADVICE_POOL_MAX_SZB     256
+#define ADVICE_POOL_CLASS_SZB   16
+#define ADVICE_POOL_MIN_BLOCKS  1000
+
+#define ADVICE_SHORT_LIVED  (1 << 0)
+#define ADVICE_ARENA_ABLE   (1 << 1)
+#define ADVICE_POOLABLE     (1 << 2)
+#define ADVICE_NEVER_READ   (1 << 3)
+#define ADVICE_WRITE_ONCE   (1 << 4)
+
+typedef
+   struct {
+      APInfo*      api;
+      UInt         flags;
+      const HChar* advice;   // "arena", "pool", "remove" or "-"
+      ULong        insns_saved;
+   }
+   Advice;
+
+static void classify_APInfo ( APInfo* api, /*OUT*/Advice* adv )
+{
+   Bool all_freed = api->deaths == api->tot_blocks;
+   ULong saved;
+
+   adv->api         = api;
+   adv->flags       = 0;
+   adv->advice      = "-";
+   adv->insns_saved = 0;
+
+   if (api->tot_blocks == 0)
+      return;
+
+   if (all_freed
+       && api->death_ages_sum / api->deaths <= g_guest_instrs_executed / 100)
+      adv->flags |= ADVICE_SHORT_LIVED;
+   if (all_freed && api->n_empties > 0
+       && api->tot_blocks >= 2 * api->n_empties
+       && api->max_episode_bytes <= ADVICE_ARENA_MAX_SZB)
+      adv->flags |= ADVICE_ARENA_ABLE;
+   if (api->tot_blocks >= ADVICE_POOL_MIN_BLOCKS && !api->resized
+       && api->max_szB <= ADVICE_POOL_MAX_SZB
+       && api->max_szB - api->min_szB < ADVICE_POOL_CLASS_SZB)
+      adv->flags |= ADVICE_POOLABLE;
+   if (api->n_reads == 0)
+      adv->flags |= ADVICE_NEVER_READ;
+   else if (api->n_writes > 0 && api->n_writes <= api->tot_bytes)
+      adv->flags |= ADVICE_WRITE_ONCE;
+
+   if (adv->flags & ADVICE_NEVER_READ) {
+      adv->advice      = "remove";
+      adv->insns_saved = api->tot_blocks * ADVICE_MALLOC_FREE_INSNS;
+   }
+   if (adv->flags & ADVICE_ARENA_ABLE) {
+      saved = api->tot_blocks
+                 * (ADVICE_MALLOC_FREE_INSNS - ADVICE_BUMP_ALLOC_INSNS);
+      saved -= api->n_empties * ADVICE_ARENA_RESET_INSNS;
+      if (saved > adv->insns_saved) {
+         adv->advice      = "arena";
+         adv->insns_saved = saved;
+      }
+   }
+   if (adv->flags & ADVICE_POOLABLE) {
+      saved = api->tot_blocks
+                 * (ADVICE_MALLOC_FREE_INSNS - ADVICE_POOL_PAIR_INSNS);
+      if (saved > adv->insns_saved) {
+         adv->advice      = "pool";
+         adv->insns_saved = saved;
+      }
+   }
+}
+
+static Int cmp_Advice_by_insns_saved ( const void* v1, const void* v2 )
+{
+   const Advice* a1 = v1;
+   const Advice* a2 = v2;
+   if (a1->insns_saved > a2->insns_saved) return -1;
+   if (a1->insns_saved < a2->insns_saved) return  1;
+   if (a1->api->tot_blocks > a2->api->tot_blocks) return -1;
+   if (a1->api->tot_blocks < a2->api->tot_blocks) return  1;
+   return 0;
+}
+
+static VgFile* advice_fp;
+
+static void fprint_ExeContext_IP ( UInt n, Addr ip )
+{
+   VG_(fprintf)(advice_fp, "   %s %s\n", n == 0 ? "at" : "by",
+                VG_(describe_IP)(ip, NULL));
+}
+
+/* Write the APs having any of the flags above, most instructions saved
+   first.  Each AP is a line of tab-separated fields, as named by the
+   header line, followed by its allocation stack, one frame per
+   indented line. */
+static void write_advice ( void )
+{
+   static const struct { UInt flag; const HChar* name; } flag_names[] = {
+      { ADVICE_SHORT_LIVED, "short-lived" },
+      { ADVICE_ARENA_ABLE,  "arena-able"  },
+      { ADVICE_POOLABLE,    "poolable"    },
+      { ADVICE_NEVER_READ,  "never-read"  },
+      { ADVICE_WRITE_ONCE,  "write-once"  },
+   };
+   HChar*  advice_file;
+   Advice* advs;
+   UWord   n_advs = 0, i, k;
+   UWord   keyW, valW;
+
+   advice_file = VG_(expand_file_name)("--advice-out-file",
+                                       clo_advice_out_file);
+   advice_fp = VG_(fopen)(advice_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                       VKI_S_IRUSR|VKI_S_IWUSR);
+   if (advice_fp == NULL) {
+      VG_(umsg)("error: can't open advice file '%s'\n", advice_file);
+      VG_(free)(advice_file);
+      return;
+   }
+
+   advs = VG_(malloc)("dh.write_advice.1",
+                      (VG_(sizeFM)(apinfo) + 1) * sizeof(Advice));
+   VG_(initIterFM)( apinfo );
+   while (VG_(nextIterFM)( apinfo, &keyW, &valW )) {
+      classify_APInfo( (APInfo*)valW, &advs[n_advs] );
+      if (advs[n_advs].flags != 0)
+         n_advs++;
+   }
+   VG_(doneIterFM)( apinfo );
+   VG_(ssort)(advs, n_advs, sizeof(Advice), cmp_Advice_by_insns_saved);
+
+   VG_(fprintf)(advice_fp, "# rank\tadvice\tinsns-saved\tflags"
+                "\ttot-blocks\ttot-bytes\tmax-bytes-live\tmin-size\tmax-size"
+                "\tavg-age\tresets\tmax-arena-bytes\tb-read\tb-written\n");
+   for (i = 0; i < n_advs; i++) {
+      Advice* adv = &advs[i];
+      APInfo* api = adv->api;
+      Bool    first = True;
+
+      VG_(fprintf)(advice_fp, "%lu\t%s\t%llu\t", i+1, adv->advice,
+                   adv->insns_saved);
+      for (k = 0; k < sizeof(flag_names)/sizeof(flag_names[0]); k++) {
+         if (adv->flags & flag_names[k].flag) {
+            VG_(fprintf)(advice_fp, "%s%s", first ? "" : ",",
+                         flag_names[k].name);
+            first = False;
+         }
+      }
+      VG_(fprintf)(advice_fp,
+                   "\t%llu\t%llu\t%llu\t%lu\t%lu\t%llu\t%llu\t%llu"
+                   "\t%llu\t%llu\n",
+                   api->tot_blocks, api->tot_bytes, api->max_bytes_live,
+                   api->min_szB, api->max_szB,
+                   api->deaths == 0 ? 0 : api->death_ages_sum / api->deaths,
+                   api->n_empties, api->max_episode_bytes,
+                   api->n_reads, api->n_writes);
+      VG_(apply_ExeContext)(fprint_ExeContext_IP, api->ap,
+                            VG_(get_ExeContext_n_ips)(api->ap));
+   }
+
+   VG_(fclose)(advice_fp);
+   VG_(free)(advs);
+   VG_(free)(advice_file);
+}
+
+
+static void retire_live_Block ( Block* bk )
+{
+   retire_Block(bk, False/*!because_freed*/);
+}
+
 static void dh_fini(Int exit_status)
 {
    // Before printing statistics, we must harvest access counts for
@@ -1272,15 +2050,7 @@ static void dh_fini(Int exit_status)
    // access ratios which are too low (zero, in the worst case)
    // for such blocks, since the accesses that do get made will
    // (if we skip this step) not get folded into the AP summaries.
-   UWord keyW, valW;
-   VG_(initIterFM)( interval_tree );
-   while (VG_(nextIterFM)( interval_tree, &keyW, &valW )) {
-      Block* bk = (Block*)keyW;
-      tl_assert(valW == 0);
-      tl_assert(bk);
-      retire_Block(bk, False/*!because_freed*/);
-   }
-   VG_(doneIterFM)( interval_tree );
+   forall_Blocks( retire_live_Block );
 
    // show results
    VG_(umsg)("======== SUMMARY STATISTICS ========\n");
@@ -1298,9 +2068,17 @@ static void dh_fini(Int exit_status)
                 g_guest_instrs_executed / g_tot_bytes);
       VG_(umsg)("\n");
    }
+   if (clo_sample_bytes > 0) {
+      VG_(umsg)("alloc point figures are estimates: one block was sampled\n");
+      VG_(umsg)("per %'lu bytes allocated, on average\n", clo_sample_bytes);
+      VG_(umsg)("\n");
+   }
 
    show_top_n_apinfos();
 
+   if (clo_advice_out_file)
+      write_advice();
+
    VG_(umsg)("\n");
    VG_(umsg)("\n");
    VG_(umsg)("==============================================================\n");
@@ -1324,11 +2102,20 @@ static void dh_fini(Int exit_status)
 
    if (VG_(clo_stats)) {
       VG_(dmsg)(" dhat: find_Block_containing:\n");
-      VG_(dmsg)("             found: %'lu (%'lu cached + %'lu uncached)\n",
-                stats__n_fBc_cached + stats__n_fBc_uncached,
-                stats__n_fBc_cached,
-                stats__n_fBc_uncached);
-      VG_(dmsg)("          notfound: %'lu\n", stats__n_fBc_notfound);
+      VG_(dmsg)("             found: %'lu (%'lu cached + %'lu in map)\n",
+                stats__n_bm_cached + stats__n_bm_found,
+                stats__n_bm_cached, stats__n_bm_found);
+      VG_(dmsg)("          notfound: %'lu\n", stats__n_bm_notfound);
+      VG_(dmsg)(" dhat: block map: %'lu leaves, %'lu spans, "
+                "%'lu page sets, %'lu outliers\n",
+                stats__n_bm_leaves, stats__n_bm_spans, stats__n_bm_pagesets,
+                VG_(sizeFM)(outlier_blocks));
+      VG_(dmsg)(" dhat: block map updates: %'lu\n",
+                stats__n_bm_page_updates);
+      VG_(dmsg)(" dhat: histogram chunks: %'lu\n", stats__n_histo_chunks);
+      if (clo_sample_bytes > 0)
+         VG_(dmsg)(" dhat: unsampled heap allocs: %'lu\n",
+                   stats__n_unsampled);
       VG_(dmsg)("\n");
    }
 }
@@ -1340,6 +2127,14 @@ static void dh_fini(Int exit_status)
 
 static void dh_post_clo_init(void)
 {
+   if (clo_sample_bytes > 0) {
+      unsampled_blocks = VG_(HT_construct)( "dh.unsampled_blocks" );
+      // 'sample_seed' starts at a fixed value, so that runs are
+      // repeatable.  Not zero: the first VG_(random) number would then
+      // be tiny, and the first gap about 13 times the mean.
+      sample_bytes_left
+         = VG_(heap_sample_gap)(&sample_seed, clo_sample_bytes);
+   }
 }
 
 static void dh_pre_clo_init(void)
@@ -1376,19 +2171,18 @@ static void dh_pre_clo_init(void)
                                    dh_realloc,
                                    dh_malloc_usable_size,
                                    0 );
+   VG_(needs_direct_malloc_calls) ();
 
    VG_(track_pre_mem_read)        ( dh_handle_noninsn_read );
    //VG_(track_pre_mem_read_asciiz) ( check_mem_is_defined_asciiz );
    VG_(track_post_mem_write)      ( dh_handle_noninsn_write );
 
-   tl_assert(!interval_tree);
-   tl_assert(!fbc_cache0);
-   tl_assert(!fbc_cache1);
+   tl_assert(!outlier_blocks);
 
-   interval_tree = VG_(newFM)( VG_(malloc),
-                               "dh.main.interval_tree.1",
-                               VG_(free),
-                               interval_tree_Cmp );
+   outlier_blocks = VG_(newFM)( VG_(malloc),
+                                "dh.main.outlier_blocks.1",
+                                VG_(free),
+                                interval_tree_Cmp );
 
    apinfo = VG_(newFM)( VG_(malloc),
                         "dh.main.apinfo.1",
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+
+// Write a byte to each page of two big blocks, which the block map
+// holds partly as span markers, and shrink one of them in place, so
+// that the map has to turn a span marker back into page entries.  All
+// the writes must be found, including those to 'q', which is still
+// live at exit.
+
+#define PAGE   4096
+#define MB     (1024 * 1024)
+
+static void touch(volatile char* p, size_t len)
+{
+   size_t i;
+   for (i = 0; i < len; i += PAGE) {
+      p[i] = 1;
+   }
+}
+
+int main(void)
+{
+   char* p = malloc(5 * MB);
+   char* q = malloc(3 * MB);
+
+   touch(q, 3 * MB);                   // 768 writes
+   touch(p, 5 * MB);                   // 1280 writes
+
+   p = realloc(p, 3 * MB / 2 + 3);
+   touch(p, 3 * MB / 2 + 3);           // 385 writes
+   p = realloc(p, 100);
+   touch(p, 100);                      // 1 write
+
+   return 0;
+}
@@ -0,0 +1,20 @@
+#include <stdlib.h>
+
+// Allocate some blocks of the same size, and free all but one of them,
+// to check that the summary figures stay exact with --sample-bytes.
+
+int main(void)
+{
+   #define N   36
+   int i;
+   int* a[N];
+
+   for (i = 0; i < N; i++) {
+      a[i] = malloc(400);
+   }
+   for (i = 0; i < N-1; i++) {
+      free(a[i]);
+   }
+
+   return 0;
+}
@@ -126,6 +126,12 @@ extern UWord HG_(clo_vts_pruning);
    the stack, which speeds things up a bit.  Default: True. */
 extern Bool HG_(clo_check_stack_refs); 
 
+/* When greater than 1, only the memory references of about one in
+   every N executions of each superblock are race checked.  Rarely
+   executed superblocks are checked every time.  Synchronisation
+   events are always processed.  Default: 1 (check everything). */
+extern UWord HG_(clo_sample_accesses);
+
 #endif /* ! __HG_BASICS_H */
 
 /*--------------------------------------------------------------------*/
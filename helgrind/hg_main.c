@@ -57,6 +57,7 @@
 #include "pub_tool_aspacemgr.h" // VG_(am_is_valid_for_client)
 #include "pub_tool_poolalloc.h"
 #include "pub_tool_addrinfo.h"
+#include "pub_tool_sampler.h"    // VG_(mk_sample_guard)
 
 #include "hg_basics.h"
 #include "hg_wordset.h"
@@ -4422,7 +4423,8 @@ static void instrument_mem_access ( IRSB*   sbOut,
                                     Bool    isStore,
                                     Int     hWordTy_szB,
                                     Int     goff_sp,
-                                    IRExpr* guard ) /* NULL => True */
+                                    IRExpr* guard,   /* NULL => True */
+                                    IRExpr* sampled ) /* NULL => True */
 {
    IRType   tyAddr   = Ity_INVALID;
    const HChar* hName    = NULL;
@@ -4577,6 +4579,11 @@ static void instrument_mem_access ( IRSB*   sbOut,
       di->guard = mk_And1(sbOut, di->guard, guard);
    }
 
+   /* Likewise for the --sample-accesses guard. */
+   if (sampled) {
+      di->guard = mk_And1(sbOut, di->guard, sampled);
+   }
+
    /* Add the helper. */
    addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
 }
@@ -4614,6 +4621,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    IRStmt* st;
    Bool    inLDSO = False;
    Addr    inLDSOmask4K = 1; /* mismatches on first check */
+   IRExpr* sampled = NULL; /* --sample-accesses guard, NULL => True */
 
    const Int goff_sp = layout->offset_SP;
 
@@ -4640,6 +4648,11 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
       i++;
    }
 
+   // With --sample-accesses, decide once per superblock execution
+   // whether its memory references are checked.
+   if (HG_(clo_sample_accesses) > 1 && VG_(sb_accesses_memory)(bbIn))
+      sampled = VG_(mk_sample_guard)( bbOut, vge->base[0] );
+
    // Get the first statement, and initial cia from it
    tl_assert(bbIn->stmts_used > 0);
    tl_assert(i < bbIn->stmts_used);
@@ -4711,7 +4724,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      * sizeofIRType(typeOfIRExpr(bbIn->tyenv, cas->dataLo)),
                   False/*!isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL/*no-guard*/, sampled
                );
             }
             break;
@@ -4732,7 +4745,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(dataTy),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL/*no-guard*/, sampled
                   );
                }
             } else {
@@ -4750,7 +4763,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   sizeofIRType(typeOfIRExpr(bbIn->tyenv, st->Ist.Store.data)),
                   True/*isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL/*no-guard*/, sampled
                );
             }
             break;
@@ -4764,7 +4777,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    True/*isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, sg->guard );
+                                   goff_sp, sg->guard, sampled );
             break;
          }
 
@@ -4778,7 +4791,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    False/*!isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, lg->guard );
+                                   goff_sp, lg->guard, sampled );
             break;
          }
 
@@ -4792,7 +4805,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(data->Iex.Load.ty),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL/*no-guard*/, sampled
                   );
                }
             }
@@ -4812,7 +4825,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, False/*!isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/,
+                        sampled
                      );
                   }
                }
@@ -4820,7 +4834,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, True/*isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/,
+                        sampled
                      );
                   }
                }
@@ -5553,6 +5568,8 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
 
    else if VG_BOOL_CLO(arg, "--check-stack-refs",
                             HG_(clo_check_stack_refs)) {}
+   else if VG_BINT_CLO(arg, "--sample-accesses",
+                            HG_(clo_sample_accesses), 1, 1 << 20) {}
    else if VG_BOOL_CLO(arg, "--ignore-thread-creation",
                             HG_(clo_ignore_thread_creation)) {}
 
@@ -5574,6 +5591,9 @@ static void hg_print_usage ( void )
 "    --conflict-cache-size=N   size of 'full' history cache [2000000]\n"
 "    --check-stack-refs=no|yes race-check reads and writes on the\n"
 "                              main stack and thread stacks? [yes]\n"
+"    --sample-accesses=N       race-check the memory references of only\n"
+"                              about 1 in N executions of each code block;\n"
+"                              rarely run code is always checked [1]\n"
 "    --ignore-thread-creation=yes|no Ignore activities during thread\n"
 "                              creation [%s]\n",
 HG_(clo_ignore_thread_creation) ? "yes" : "no"
@@ -5661,6 +5681,12 @@ static void hg_print_stats (void)
                stats__lockN_releases
               );
    VG_(printf)("   sanity checks: %'8lu\n", stats__sanity_checks);
+   if (HG_(clo_sample_accesses) > 1) {
+      ULong sampled, skipped;
+      VG_(sampler_stats)(&sampled, &skipped);
+      VG_(printf)("         sampler: %'8llu sampled, %'llu skipped SBs\n",
+                  sampled, skipped);
+   }
 
    VG_(printf)("\n");
    libhb_shutdown(True); // This in fact only print stats.
@@ -5739,6 +5765,8 @@ static void hg_post_clo_init ( void )
    if (HG_(clo_track_lockorders))
       laog__init();
 
+   VG_(sampler_set_rate)(HG_(clo_sample_accesses));
+
    initialise_data_structures(hbthr_root);
 }
 
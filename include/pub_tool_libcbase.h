@@ -218,6 +218,21 @@ extern Int VG_(log2_64)( ULong x );
 // non-NULL, it uses and updates whatever pSeed points at.
 extern UInt VG_(random) ( /*MOD*/UInt* pSeed );
 
+// Heap sampling, as done by tcmalloc: an allocation is sampled when the
+// count of bytes allocated since the previous sample exceeds a random gap,
+// exponentially distributed with a mean of mean_szB bytes.
+// VG_(heap_sample_gap) draws such a gap, using VG_(random)(pSeed).
+// An allocation of szB bytes is then sampled with a probability of
+// 1 - exp(-szB/mean_szB);  VG_(heap_sample_weight) gives the inverse of
+// that probability, ie. the number of allocations of that size which a
+// sampled one stands for.  It is a fixed-point number, in units of
+// 1/VG_HEAP_SAMPLE_WEIGHT_ONE, and is not rounded to a whole number of
+// allocations, as that would bias the estimates by block size.
+#define VG_HEAP_SAMPLE_WEIGHT_SHIFT 16
+#define VG_HEAP_SAMPLE_WEIGHT_ONE   (1ULL << VG_HEAP_SAMPLE_WEIGHT_SHIFT)
+extern SizeT VG_(heap_sample_gap)    ( /*MOD*/UInt* pSeed, SizeT mean_szB );
+extern ULong VG_(heap_sample_weight) ( SizeT szB, SizeT mean_szB );
+
 /* Update a running Adler-32 checksum with the bytes buf[0..len-1] and
    return the updated checksum. If buf is NULL, this function returns
    the required initial value for the checksum. An Adler-32 checksum is
@@ -105,6 +105,7 @@ typedef struct _VgFile VgFile;
 
 extern VgFile *VG_(fopen)    ( const HChar *name, Int flags, Int mode );
 extern void    VG_(fclose)   ( VgFile *fp );
+extern void    VG_(fflush)   ( VgFile *fp );
 extern UInt    VG_(fprintf)  ( VgFile *fp, const HChar *format, ... )
                                PRINTF_CHECK(2, 3);
 extern UInt    VG_(vfprintf) ( VgFile *fp, const HChar *format, va_list vargs )
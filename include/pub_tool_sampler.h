@@ -0,0 +1,69 @@
+/*--------------------------------------------------------------------*/
+/*--- Sampling of superblock executions.        pub_tool_sampler.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2026 The Valgrind Developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_TOOL_SAMPLER_H
+#define __PUB_TOOL_SAMPLER_H
+
+#include "libvex.h"              // for IRSB, IRExpr
+
+//--------------------------------------------------------------------
+// PURPOSE: lets a tool check only a fraction of the executions of each
+// superblock, as used by the race detectors' --sample-accesses=N.
+// Superblocks are hashed by guest address onto a fixed table of
+// samplers.  A sampler says yes every time until a burst of samples
+// has been taken, then doubles its period, until only one in N
+// executions is sampled.  Hence cold code is oversampled and hot code
+// converges to the requested rate.  Superblocks that collide share a
+// sampler, which only affects the sampling rate.
+//--------------------------------------------------------------------
+
+/* Set the sampling rate: about one in n executions of a hot
+   superblock is sampled.  n must be at least 1.  Defaults to 1, which
+   samples everything. */
+extern void VG_(sampler_set_rate) ( UInt n );
+
+/* Does bb contain any statement that accesses memory, that is, one
+   that a sampling guard could apply to? */
+extern Bool VG_(sb_accesses_memory) ( const IRSB* bb );
+
+/* Add to sbOut a call to the sampler of the superblock at guest
+   address ga, and return a 1-bit atom that is true if this execution
+   of the superblock is sampled.  The tool should emit this once per
+   superblock and use the result as (part of) the guard of its
+   helper calls. */
+extern IRExpr* VG_(mk_sample_guard) ( IRSB* sbOut, Addr ga );
+
+/* Number of superblock executions sampled and skipped so far. */
+extern void VG_(sampler_stats) ( /*OUT*/ULong* sampled,
+                                 /*OUT*/ULong* skipped );
+
+#endif   // __PUB_TOOL_SAMPLER_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
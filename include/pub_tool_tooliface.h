@@ -487,6 +487,13 @@ extern void VG_(needs_malloc_replacement)(
    SizeT client_malloc_redzone_szB
 );
 
+/* May translated code call the tool's malloc replacements directly,
+   rather than going back to the scheduler for each call?  This is much
+   faster for heap-intensive programs.  The tool must also replace
+   malloc, and must not track post_reg_write_clientcall_return, since
+   it is the scheduler which reports that event. */
+extern void VG_(needs_direct_malloc_calls) ( void );
+
 /* Can the tool do XML output?  This is a slight misnomer, because the tool
  * is not requesting the core to do anything, rather saying "I can handle
  * it". */
@@ -239,6 +239,7 @@ static UInt n_heap_frees            = 0;
 static UInt n_ignored_heap_allocs   = 0;
 static UInt n_ignored_heap_frees    = 0;
 static UInt n_ignored_heap_reallocs = 0;
+static UInt n_unsampled_heap_allocs = 0;
 static UInt n_stack_allocs          = 0;
 static UInt n_stack_frees           = 0;
 static UInt n_xpts                  = 0;
@@ -399,7 +400,9 @@ static double clo_peak_inaccuracy = 1.0;  // percentage
 static Int    clo_time_unit       = TimeI;
 static Int    clo_detailed_freq   = 10;
 static Int    clo_max_snapshots   = 100;
+static SizeT  clo_sample_bytes    = 0;    // 0 means record every block
 static const HChar* clo_massif_out_file = "massif.out.%p";
+static const HChar* clo_stream_out_file = NULL;
 
 static XArray* args_for_massif;
 
@@ -443,7 +446,11 @@ static Bool ms_process_cmd_line_option(const HChar* arg)
 
    else if VG_BINT_CLO(arg, "--max-snapshots",  clo_max_snapshots, 10, 1000) {}
 
+   else if VG_BINT_CLO(arg, "--sample-bytes",   clo_sample_bytes,
+                                                0, 1024*1024*1024) {}
+
    else if VG_STR_CLO(arg, "--massif-out-file", clo_massif_out_file) {}
+   else if VG_STR_CLO(arg, "--stream-out-file", clo_stream_out_file) {}
 
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
@@ -468,7 +475,12 @@ static void ms_print_usage(void)
 "                              or heap bytes alloc'd/dealloc'd [i]\n"
 "    --detailed-freq=<N>       every Nth snapshot should be detailed [10]\n"
 "    --max-snapshots=<N>       maximum number of snapshots recorded [100]\n"
+"    --sample-bytes=<N>        only record the stack trace of one heap block\n"
+"                              per <N> bytes allocated, on average; 0 means\n"
+"                              every block [0]\n"
 "    --massif-out-file=<file>  output file name [massif.out.%%p]\n"
+"    --stream-out-file=<file>  also append each snapshot to <file> (or FIFO)\n"
+"                              as soon as it is taken [none]\n"
    );
 }
 
@@ -529,9 +541,15 @@ typedef struct _XPt XPt;
 struct _XPt {
    Addr  ip;              // code address
 
-   // Bottom-XPts: space for the precise context.
-   // Other XPts:  space of all the descendent bottom-XPts.
-   // Nb: this value goes up and down as the program executes.
+   // Space allocated with this XPt as the bottom of the XCon.  Nb: this
+   // is normally zero for XPts with children, but see the comment at the
+   // bottom of get_XCon.  This value goes up and down as the program
+   // executes;  only it is updated on each allocation and deallocation.
+   SizeT self_szB;
+
+   // self_szB plus the szB of all the children, ie. the space of all the
+   // XCons going through this XPt.  It is computed by aggregate_XTree
+   // only when a detailed snapshot is taken, so it is stale otherwise.
    SizeT szB;
 
    XPt*  parent;           // pointer to parent XPt
@@ -585,9 +603,10 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    // Note that we cannot use VG_(perm_malloc) for the 'children' array, because
    // that needs to be resizable.
    XPt* xpt    = VG_(perm_malloc)(sizeof(XPt), vg_alignof(XPt));
-   xpt->ip     = ip;
-   xpt->szB    = 0;
-   xpt->parent = parent;
+   xpt->ip       = ip;
+   xpt->self_szB = 0;
+   xpt->szB      = 0;
+   xpt->parent   = parent;
 
    // We don't initially allocate any space for children.  We let that
    // happen on demand.  Many XPts (ie. all the bottom-XPts) don't have any
@@ -639,6 +658,21 @@ static Int SXPt_revcmp_szB(const void* n1, const void* n2)
 //--- XTree Operations                                     ---//
 //------------------------------------------------------------//
 
+// Computes the szB of every XPt of the XTree, from the self_szB of the XPt
+// and of its descendents.  Doing this once per detailed snapshot is much
+// cheaper than percolating each allocation and deallocation up the XCon,
+// as dup_XTree walks the XTree anyway.
+static SizeT aggregate_XTree(XPt* xpt)
+{
+   UInt  i;
+   SizeT szB = xpt->self_szB;
+
+   for (i = 0; i < xpt->n_children; i++)
+      szB += aggregate_XTree(xpt->children[i]);
+   xpt->szB = szB;
+   return szB;
+}
+
 // Duplicates an XTree as an SXTree.
 static SXPt* dup_XTree(XPt* xpt, SizeT total_szB)
 {
@@ -762,8 +796,8 @@ static void sanity_check_XTree(XPt* xpt, XPt* parent)
    // Check children counts look sane.
    tl_assert(xpt->n_children <= xpt->max_children);
 
-   // Unfortunately, xpt's size is not necessarily equal to the sum of xpt's
-   // children's sizes.  See comment at the bottom of get_XCon.
+   // Unfortunately, xpt's self_szB is not necessarily zero when xpt has
+   // children.  See comment at the bottom of get_XCon.
 }
 
 // Sanity checking:  we check SXTrees (which are in snapshots) after
@@ -970,22 +1004,62 @@ static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
    return xpt;
 }
 
-// Update 'szB' of every XPt in the XCon, by percolating upwards.
+// With --sample-bytes=N, only some heap blocks get an XCon: a block is
+// sampled when the bytes allocated since the previous sampled block exceed
+// a random gap with a mean of N bytes (see VG_(heap_sample_gap)).  This
+// saves most of the stack unwinding, which dominates Massif's cost for
+// allocation-heavy programs.  A sampled block is charged to its XCon for
+// all the blocks it stands for (see VG_(heap_sample_weight)), ie. szB/p
+// bytes rounded to the byte, so the XTree holds unbiased estimates;  the
+// heap totals are still exact.  Unsampled blocks get
+// 'unsampled_xpt' as their XCon, which is not part of the XTree.
+static XPt*   unsampled_xpt     = NULL;
+static SSizeT sample_bytes_left = 0;
+static UInt   sample_seed       = 1;
+
+static Bool sample_block(SizeT req_szB)
+{
+   if (0 == clo_sample_bytes) return True;
+
+   sample_bytes_left -= req_szB;
+   if (sample_bytes_left > 0) {
+      n_unsampled_heap_allocs++;
+      return False;
+   }
+   sample_bytes_left = VG_(heap_sample_gap)(&sample_seed, clo_sample_bytes);
+   return True;
+}
+
+// The size a block of req_szB bytes is charged to its XCon.
+static SSizeT XCon_szB(SizeT req_szB)
+{
+   if (0 == clo_sample_bytes) return req_szB;
+   return (req_szB * VG_(heap_sample_weight)(req_szB, clo_sample_bytes)
+           + VG_HEAP_SAMPLE_WEIGHT_ONE / 2) >> VG_HEAP_SAMPLE_WEIGHT_SHIFT;
+}
+
+// When sampling, the XTree sizes are estimates which need not add up to
+// the exact heap size.  Scale them so that they do, as the output
+// (and ms_print) expects no part of the tree to be bigger than the heap.
+static void normalise_XTree(XPt* xpt, double ratio)
+{
+   UInt i;
+
+   xpt->szB = (SizeT)(xpt->szB * ratio);
+   for (i = 0; i < xpt->n_children; i++)
+      normalise_XTree(xpt->children[i], ratio);
+}
+
+// Update 'self_szB' of the XCon's bottom-XPt.  The XPts above it are
+// only updated when a detailed snapshot is taken, by aggregate_XTree.
 static void update_XCon(XPt* xpt, SSizeT space_delta)
 {
    tl_assert(clo_heap);
    tl_assert(NULL != xpt);
 
-   if (0 == space_delta)
-      return;
-
-   while (xpt != alloc_xpt) {
-      if (space_delta < 0) tl_assert(xpt->szB >= -space_delta);
-      xpt->szB += space_delta;
-      xpt = xpt->parent;
-   }
-   if (space_delta < 0) tl_assert(alloc_xpt->szB >= -space_delta);
-   alloc_xpt->szB += space_delta;
+   if (xpt == unsampled_xpt) return;
+   if (space_delta < 0) tl_assert(xpt->self_szB >= -space_delta);
+   xpt->self_szB += space_delta;
 }
 
 
@@ -1309,6 +1383,13 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
       snapshot->heap_szB = heap_szB;
       if (is_detailed) {
          SizeT total_szB = heap_szB + heap_extra_szB + stacks_szB;
+         aggregate_XTree(alloc_xpt);
+         if (clo_sample_bytes > 0) {
+            if (alloc_xpt->szB > 0)
+               normalise_XTree(alloc_xpt,
+                               (double)heap_szB / (double)alloc_xpt->szB);
+            alloc_xpt->szB = heap_szB;   // undo any rounding
+         }
          snapshot->alloc_sxpt = dup_XTree(alloc_xpt, total_szB);
          tl_assert(           alloc_xpt->szB == heap_szB);
          tl_assert(snapshot->alloc_sxpt->szB == heap_szB);
@@ -1333,6 +1414,9 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
 }
 
 
+// Forward declaration.
+static void stream_snapshot(Snapshot* snapshot);
+
 // Take a snapshot, if it's time, or if we've hit a peak.
 static void
 maybe_take_snapshot(SnapshotKind kind, const HChar* what)
@@ -1388,6 +1472,7 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
    // Take the snapshot.
    snapshot = & snapshots[next_snapshot_i];
    take_snapshot(snapshot, kind, my_time, is_detailed);
+   stream_snapshot(snapshot);
 
    // Record if it was detailed.
    if (is_detailed) {
@@ -1511,7 +1596,9 @@ void* record_block( ThreadId tid, void* p, SizeT req_szB, SizeT slop_szB,
    if (clo_heap) {
       VERB(3, "<<< record_block (%lu, %lu)\n", req_szB, slop_szB);
 
-      hc->where = get_XCon( tid, exclude_first_entry );
+      hc->where = sample_block(req_szB)
+                ? get_XCon( tid, exclude_first_entry )
+                : unsampled_xpt;
 
       if (hc->where) {
          // Update statistics.
@@ -1521,7 +1608,7 @@ void* record_block( ThreadId tid, void* p, SizeT req_szB, SizeT slop_szB,
          update_heap_stats(req_szB, clo_heap_admin + slop_szB);
 
          // Update XTree.
-         update_XCon(hc->where, req_szB);
+         update_XCon(hc->where, XCon_szB(req_szB));
 
          // Maybe take a snapshot.
          if (maybe_snapshot) {
@@ -1592,7 +1679,7 @@ void unrecord_block ( void* p, Bool maybe_snapshot )
          update_heap_stats(-hc->req_szB, -clo_heap_admin - hc->slop_szB);
 
          // Update XTree.
-         update_XCon(hc->where, -hc->req_szB);
+         update_XCon(hc->where, -XCon_szB(hc->req_szB));
 
          // Maybe take a snapshot.
          if (maybe_snapshot) {
@@ -1686,11 +1773,13 @@ void* realloc_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
 
       // Update XTree.
       if (clo_heap) {
-         new_where = get_XCon( tid, /*exclude_first_entry*/True);
+         new_where = sample_block(new_req_szB)
+                   ? get_XCon( tid, /*exclude_first_entry*/True)
+                   : unsampled_xpt;
          if (!is_ignored && new_where) {
             hc->where = new_where;
-            update_XCon(old_where, -old_req_szB);
-            update_XCon(new_where,  new_req_szB);
+            update_XCon(old_where, -XCon_szB(old_req_szB));
+            update_XCon(new_where,  XCon_szB(new_req_szB));
          } else {
             // The realloc itself is ignored.
             is_ignored = True;
@@ -2260,22 +2349,10 @@ static void pp_snapshot(VgFile *fp, Snapshot* snapshot, Int snapshot_n)
    }
 }
 
-static void write_snapshots_to_file(const HChar* massif_out_file, 
-                                    Snapshot snapshots_array[], 
-                                    Int nr_elements)
+// Prints the lines before the snapshots.
+static void pp_header(VgFile *fp)
 {
    Int i;
-   VgFile *fp;
-
-   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                    VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
-      VG_(umsg)("       ... so profiling results will be missing.\n");
-      return;
-   }
 
    // Print massif-specific options that were used.
    // XXX: is it worth having a "desc:" line?  Could just call it "options:"
@@ -2299,7 +2376,26 @@ static void write_snapshots_to_file(const HChar* massif_out_file,
    FP("\n");
 
    FP("time_unit: %s\n", TimeUnit_to_string(clo_time_unit));
+}
+
+static void write_snapshots_to_file(const HChar* massif_out_file, 
+                                    Snapshot snapshots_array[], 
+                                    Int nr_elements)
+{
+   Int i;
+   VgFile *fp;
 
+   fp = VG_(fopen)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                    VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      // If the file can't be opened for whatever reason (conflict
+      // between multiple cachegrinded processes?), give up now.
+      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
+      VG_(umsg)("       ... so profiling results will be missing.\n");
+      return;
+   }
+
+   pp_header(fp);
    for (i = 0; i < nr_elements; i++) {
       Snapshot* snapshot = & snapshots_array[i];
       pp_snapshot(fp, snapshot, i);     // Detailed snapshot!
@@ -2320,6 +2416,61 @@ static void write_snapshots_array_to_file(void)
    VG_(free)(massif_out_file);
 }
 
+// With --stream-out-file, each snapshot taken by maybe_take_snapshot is
+// also appended to the stream file as soon as it is taken, in the
+// massif.out format, so that the whole history can be followed while the
+// program runs, whatever cull_snapshots removes from the snapshots array.
+// Snapshots are numbered in the order they were taken.  A peak snapshot
+// is written when taken, so the stream can contain several of them: the
+// last one is the peak, as ms_print assumes.
+static VgFile* stream_fp          = NULL;
+static Bool    stream_open_failed = False;
+static Int     stream_snapshot_n  = 0;
+
+static void stream_snapshot(Snapshot* snapshot)
+{
+   if (clo_stream_out_file == NULL || stream_open_failed)
+      return;
+
+   // Open the file when the first snapshot is taken, for the same reason
+   // as in write_snapshots_array_to_file.
+   if (stream_fp == NULL) {
+      HChar* stream_out_file =
+         VG_(expand_file_name)("--stream-out-file", clo_stream_out_file);
+      stream_fp = VG_(fopen)(stream_out_file,
+                             VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                             VKI_S_IRUSR|VKI_S_IWUSR);
+      if (stream_fp == NULL) {
+         VG_(umsg)("error: can't open stream output file '%s'\n",
+                   stream_out_file );
+         VG_(umsg)("       ... so no snapshot will be streamed.\n");
+         stream_open_failed = True;
+         VG_(free)(stream_out_file);
+         return;
+      }
+      VG_(free)(stream_out_file);
+      pp_header(stream_fp);
+   }
+
+   pp_snapshot(stream_fp, snapshot, stream_snapshot_n++);
+   VG_(fflush)(stream_fp);
+}
+
+// A forked child streams to its own file if the file name has a %p.
+// Otherwise the child would truncate the parent's stream, or interleave
+// its records with the parent's ones, so it does not stream at all.
+// Nothing is buffered, as each snapshot is flushed.
+static void stream_atfork_child(ThreadId tid)
+{
+   if (stream_fp != NULL) {
+      VG_(fclose)(stream_fp);
+      stream_fp = NULL;
+   }
+   stream_snapshot_n = 0;
+   if (VG_(strstr)(clo_stream_out_file, "%p") == NULL)
+      stream_open_failed = True;
+}
+
 static void handle_snapshot_monitor_command (const HChar *filename,
                                              Bool detailed)
 {
@@ -2408,6 +2559,7 @@ static void ms_print_stats (void)
    STATS("ignored heap allocs:   %u\n", n_ignored_heap_allocs);
    STATS("ignored heap frees:    %u\n", n_ignored_heap_frees);
    STATS("ignored heap reallocs: %u\n", n_ignored_heap_reallocs);
+   STATS("unsampled heap allocs: %u\n", n_unsampled_heap_allocs);
    STATS("stack allocs:          %u\n", n_stack_allocs);
    STATS("stack frees:           %u\n", n_stack_frees);
    STATS("XPts:                  %u\n", n_xpts);
@@ -2434,6 +2586,10 @@ static void ms_print_stats (void)
 static void ms_fini(Int exit_status)
 {
    // Output.
+   if (stream_fp != NULL) {
+      VG_(fclose)(stream_fp);
+      stream_fp = NULL;
+   }
    write_snapshots_array_to_file();
 
    // Stats
@@ -2465,6 +2621,14 @@ static void ms_post_clo_init(void)
    if (!clo_heap) {
       clo_pages_as_heap = False;
    }
+   if (clo_sample_bytes > 0) {
+      unsampled_xpt = new_XPt(/*ip*/0, /*parent*/NULL);
+      // 'sample_seed' starts at a fixed value, so that runs are
+      // repeatable.  Not zero: the first VG_(random) number would then
+      // be tiny, and the first gap about 13 times the mean.
+      sample_bytes_left =
+         VG_(heap_sample_gap)(&sample_seed, clo_sample_bytes);
+   }
 
    // If --pages-as-heap=yes we don't want malloc replacement to occur.  So we
    // disable vgpreload_massif-$PLATFORM.so by removing it from LD_PRELOAD (or
@@ -2545,6 +2709,9 @@ static void ms_post_clo_init(void)
       clear_snapshot( & snapshots[i], /*do_sanity_check*/False );
    }
    sanity_check_snapshots_array();
+
+   if (clo_stream_out_file != NULL)
+      VG_(atfork)(NULL, NULL, stream_atfork_child);
 }
 
 static void ms_pre_clo_init(void)
@@ -2588,6 +2755,7 @@ static void ms_pre_clo_init(void)
                                    ms_realloc,
                                    ms_malloc_usable_size,
                                    0 );
+   VG_(needs_direct_malloc_calls) ();
 
    // HP_Chunks.
    malloc_list = VG_(HT_construct)( "Massif's malloc list" );
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Massif's malloc replacements are called straight from translated code.
+// Check that they return what they should, and that the blocks are
+// attributed to the right lines of main().
+
+static void check(int ok, const char* what)
+{
+   if (!ok) {
+      fprintf(stderr, "%s failed\n", what);
+      exit(1);
+   }
+}
+
+int main(void)
+{
+   char* a;
+   int*  b;
+   void* d;
+   int   i;
+
+   a = malloc(400);
+   check(a != NULL, "malloc");
+   memset(a, 'x', 400);
+
+   b = calloc(100, sizeof(int));
+   check(b != NULL, "calloc");
+   for (i = 0; i < 100; i++)
+      check(b[i] == 0, "calloc zeroing");
+
+   a = realloc(a, 800);          // bigger, so the block moves
+   check(a != NULL, "realloc");
+   for (i = 0; i < 400; i++)
+      check(a[i] == 'x', "realloc copying");
+
+   check(posix_memalign(&d, 64, 1600) == 0, "posix_memalign");
+   check(((uintptr_t)d & 63) == 0, "posix_memalign alignment");
+
+   free(b);
+   free(a);
+   free(d);
+
+   return 0;
+}
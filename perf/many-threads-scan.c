@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// many-threads-scan simulates a multithreaded application that scans a
+// shared buffer, for the sake of tuning race detectors (mainly DRD):
+//  * nr_thr threads each scan the whole shared buffer nr_loops times;
+//  * the buffer is split in nr_chunks chunks, each protected by its own
+//    mutex, such that every chunk access creates new segments and the
+//    threads synchronise frequently with each other;
+//  * a chunk is read entirely and about one byte in eight is written.
+// This stresses the bitmap merge, comparison and race checking operations
+// of DRD since the accesses of each segment cover a wide address range.
+
+static int sz_chunk;  // size of a chunk in bytes
+static int nr_chunks; // nr of chunks in the shared buffer
+static int nr_loops;  // nr of times each thread scans the buffer
+static int nr_thr;    // nr of threads
+
+static unsigned char *buf;
+static pthread_mutex_t *chunk_mutex;
+
+static void *scan_fn(void *v)
+{
+   const int id = *(int *)v;
+   unsigned sum = 0;
+   int loops, c, b;
+
+   for (loops = 0; loops < nr_loops; loops++) {
+      for (c = 0; c < nr_chunks; c++) {
+         // Start at a different chunk in each thread to reduce contention.
+         const int chunk = (c + id) % nr_chunks;
+         unsigned char *p = buf + (size_t)chunk * sz_chunk;
+
+         pthread_mutex_lock(&chunk_mutex[chunk]);
+         for (b = 0; b < sz_chunk; b++) {
+            sum += p[b];
+            if ((b & 7) == (id & 7))
+               p[b] = (unsigned char)(sum + id);
+         }
+         pthread_mutex_unlock(&chunk_mutex[chunk]);
+      }
+   }
+   return (void *)(unsigned long)sum;
+}
+
+int main(int argc, char *argv[])
+{
+   int a;
+   int i;
+   int ret;
+   int *ids;
+   pthread_t *thr;
+
+   // usage: many-threads-scan [-t nr_thr default 16]
+   //                          [-c nr_chunks default 64]
+   //                          [-b chunk size default 16384]
+   //                          [-l nr_loops default 4]
+   nr_thr = 16;
+   nr_chunks = 64;
+   sz_chunk = 16384;
+   nr_loops = 4;
+   for (a = 1; a + 1 < argc; a += 2) {
+      if        (strcmp(argv[a], "-t") == 0) {
+         nr_thr = atoi(argv[a+1]);
+      } else if (strcmp(argv[a], "-c") == 0) {
+         nr_chunks = atoi(argv[a+1]);
+      } else if (strcmp(argv[a], "-b") == 0) {
+         sz_chunk = atoi(argv[a+1]);
+      } else if (strcmp(argv[a], "-l") == 0) {
+         nr_loops = atoi(argv[a+1]);
+      } else {
+         printf("unknown arg %s\n", argv[a]);
+      }
+   }
+
+   buf = calloc(nr_chunks, sz_chunk);
+   chunk_mutex = malloc(nr_chunks * sizeof(chunk_mutex[0]));
+   thr = malloc(nr_thr * sizeof(thr[0]));
+   ids = malloc(nr_thr * sizeof(ids[0]));
+   if (buf == NULL || chunk_mutex == NULL || thr == NULL || ids == NULL) {
+      perror("malloc");
+      return 1;
+   }
+   for (i = 0; i < nr_chunks; i++)
+      pthread_mutex_init(&chunk_mutex[i], NULL);
+
+   for (i = 0; i < nr_thr; i++) {
+      ids[i] = i;
+      ret = pthread_create(&thr[i], NULL, scan_fn, &ids[i]);
+      if (ret != 0)
+         perror("pthread_create");
+   }
+   for (i = 0; i < nr_thr; i++) {
+      ret = pthread_join(thr[i], NULL);
+      if (ret != 0)
+         perror("pthread_join");
+   }
+
+   for (i = 0; i < nr_chunks; i++)
+      pthread_mutex_destroy(&chunk_mutex[i]);
+   free(ids);
+   free(thr);
+   free(chunk_mutex);
+   free(buf);
+
+   return 0;
+}